@@ -0,0 +1,327 @@
+#include "beagle/GP.hpp"
+#include "ArtifactCollector.hpp"
+
+#include <algorithm>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace Beagle;
+
+
+/*!
+ *  \brief Construct an artifact collector; the background thread is started on first use.
+ *  \param inName Name of the component.
+ */
+GP::ArtifactCollector::ArtifactCollector(const std::string& inName) :
+		Component(inName),
+		mStarted(false),
+		mNrFilesRemoved(0),
+		mNrBytesRemoved(0)
+{
+	pthread_mutex_init(&mMutex, NULL);
+	pthread_cond_init(&mCondition, NULL);
+}
+
+
+/*!
+ *  \brief Process all requests queued, then stop the background thread.
+ */
+GP::ArtifactCollector::~ArtifactCollector()
+{
+	if (mStarted)
+	{
+		Request lStop;
+		lStop.mType= Request::eStop;
+		post(lStop);
+		pthread_join(mThread, NULL);
+	}
+	pthread_cond_destroy(&mCondition);
+	pthread_mutex_destroy(&mMutex);
+}
+
+
+/*!
+ *  \brief Register the parameters of the retention policy.
+ *  \param ioSystem System of the evolution.
+ */
+void GP::ArtifactCollector::registerParams(System& ioSystem)
+{
+	Beagle_StackTraceBeginM();
+	Component::registerParams(ioSystem);
+
+	// 'icu.compiler.keep-generations', how many generations of generated files to keep.
+	{
+		std::ostringstream lOSS;
+		lOSS << "Remove the sources, objects, and libraries generated by the compile operators ";
+		lOSS << "once they are this many generations old; the latest hall of fame library and ";
+		lOSS << "its members are always kept. 0 keeps all files.";
+		Register::Description lDescription(
+		    "Generations of files kept",
+		    "Int",
+		    "0",
+		    lOSS.str()
+		);
+		mKeepGenerations= castHandleT<Int>(
+		    ioSystem.getRegister().insertEntry("icu.compiler.keep-generations", new Int(0), lDescription));
+	}
+
+	// 'icu.compiler.max-megabytes', budget of the files generated.
+	{
+		std::ostringstream lOSS;
+		lOSS << "Remove the oldest files generated by the compile operators until all files generated ";
+		lOSS << "in this run fit into this many megabytes; files of the current generation and the ";
+		lOSS << "latest hall of fame are always kept. 0 for no budget.";
+		Register::Description lDescription(
+		    "Megabytes of files kept",
+		    "Int",
+		    "0",
+		    lOSS.str()
+		);
+		mMaxMegabytes= castHandleT<Int>(
+		    ioSystem.getRegister().insertEntry("icu.compiler.max-megabytes", new Int(0), lDescription));
+	}
+
+	Beagle_StackTraceEndM("void GP::ArtifactCollector::registerParams(System&)");
+}
+
+
+/*!
+ *  \brief Tell whether a retention policy is set.
+ */
+bool GP::ArtifactCollector::isEnabled() const
+{
+	Beagle_StackTraceBeginM();
+	return (mKeepGenerations != NULL && mKeepGenerations->getWrappedValue() > 0) ||
+	       (mMaxMegabytes != NULL && mMaxMegabytes->getWrappedValue() > 0);
+	Beagle_StackTraceEndM("bool GP::ArtifactCollector::isEnabled() const");
+}
+
+
+/*!
+ *  \brief Track a file generated.
+ *  \param inPath       Path of the file; files not existing are ignored when collecting.
+ *  \param inGeneration Generation the file has been generated in.
+ *
+ *  Libraries compiled in memory, /proc/self/fd/N, are not tracked.
+ */
+void GP::ArtifactCollector::add(const std::string& inPath, unsigned int inGeneration)
+{
+	Beagle_StackTraceBeginM();
+	if (!isEnabled() || inPath.compare(0, 6, "/proc/") == 0) return;
+	Request lRequest;
+	lRequest.mType= Request::eAdd;
+	lRequest.mPath= inPath;
+	lRequest.mGeneration= inGeneration;
+	post(lRequest);
+	Beagle_StackTraceEndM("void GP::ArtifactCollector::add(const std::string&, unsigned int)");
+}
+
+
+/*!
+ *  \brief Keep files regardless of the retention policy.
+ *  \param inOwner Owner of the files, e.g. the name of an operator; replaces the files pinned by the owner before.
+ *  \param inPaths Paths of the files.
+ */
+void GP::ArtifactCollector::pin(const std::string& inOwner, const std::vector<std::string>& inPaths)
+{
+	Beagle_StackTraceBeginM();
+	if (!isEnabled()) return;
+	Request lRequest;
+	lRequest.mType= Request::ePin;
+	lRequest.mPath= inOwner;
+	lRequest.mPaths= inPaths;
+	post(lRequest);
+	Beagle_StackTraceEndM("void GP::ArtifactCollector::pin(const std::string&, const std::vector<std::string>&)");
+}
+
+
+/*!
+ *  \brief Remove the files the retention policy does no longer keep, in the background.
+ *  \param inGeneration Current generation.
+ */
+void GP::ArtifactCollector::collect(unsigned int inGeneration)
+{
+	Beagle_StackTraceBeginM();
+	if (!isEnabled()) return;
+	Request lRequest;
+	lRequest.mType= Request::eCollect;
+	lRequest.mGeneration= inGeneration;
+	lRequest.mKeepGenerations= std::max(0, mKeepGenerations->getWrappedValue());
+	lRequest.mMaxBytes= (unsigned long long)std::max(0, mMaxMegabytes->getWrappedValue())* 1024* 1024;
+	post(lRequest);
+	Beagle_StackTraceEndM("void GP::ArtifactCollector::collect(unsigned int)");
+}
+
+
+/*!
+ *  \brief Return the number of files and bytes removed so far.
+ */
+void GP::ArtifactCollector::getTotals(unsigned int& outNrFiles, unsigned long long& outNrBytes)
+{
+	Beagle_StackTraceBeginM();
+	pthread_mutex_lock(&mMutex);
+	outNrFiles= mNrFilesRemoved;
+	outNrBytes= mNrBytesRemoved;
+	pthread_mutex_unlock(&mMutex);
+	Beagle_StackTraceEndM("void GP::ArtifactCollector::getTotals(unsigned int&, unsigned long long&)");
+}
+
+
+/*!
+ *  \brief Queue a request for the background thread, starting the thread if needed.
+ *
+ *  If the thread cannot be started, the request is processed inline.
+ */
+void GP::ArtifactCollector::post(const Request& inRequest)
+{
+	Beagle_StackTraceBeginM();
+	if (!mStarted)
+	{
+		if (inRequest.mType == Request::eStop) return;
+		mStarted= (pthread_create(&mThread, NULL, runThread, this) == 0);
+		if (!mStarted)
+		{
+			process(inRequest);
+			return;
+		}
+	}
+	pthread_mutex_lock(&mMutex);
+	mRequests.push_back(inRequest);
+	pthread_cond_signal(&mCondition);
+	pthread_mutex_unlock(&mMutex);
+	Beagle_StackTraceEndM("void GP::ArtifactCollector::post(const Request&)");
+}
+
+
+/*!
+ *  \brief Entry point of the background thread.
+ */
+void* GP::ArtifactCollector::runThread(void* inCollector)
+{
+	static_cast<ArtifactCollector*>(inCollector)->run();
+	return NULL;
+}
+
+
+/*!
+ *  \brief Process requests in order, until asked to stop.
+ */
+void GP::ArtifactCollector::run()
+{
+	for(;;)
+	{
+		pthread_mutex_lock(&mMutex);
+		while (mRequests.empty()) pthread_cond_wait(&mCondition, &mMutex);
+		Request lRequest= mRequests.front();
+		mRequests.pop_front();
+		pthread_mutex_unlock(&mMutex);
+		if (lRequest.mType == Request::eStop) return;
+		process(lRequest);
+	}
+}
+
+
+/*!
+ *  \brief Process one request, on the background thread.
+ */
+void GP::ArtifactCollector::process(const Request& inRequest)
+{
+	switch (inRequest.mType)
+	{
+	case Request::eAdd:
+	{
+		// A file generated again, e.g. a library recompiled, is tracked with its latest generation.
+		for(std::deque<Artifact>::iterator lArtifact=mArtifacts.begin(); lArtifact!=mArtifacts.end(); ++lArtifact)
+		{
+			if (lArtifact->mPath == inRequest.mPath)
+			{
+				mArtifacts.erase(lArtifact);
+				break;
+			}
+		}
+		Artifact lArtifact;
+		lArtifact.mPath= inRequest.mPath;
+		lArtifact.mGeneration= inRequest.mGeneration;
+		lArtifact.mSize= 0;
+		lArtifact.mExamined= false;
+		mArtifacts.push_back(lArtifact);
+		break;
+	}
+	case Request::ePin:
+		mPinned[inRequest.mPath]= inRequest.mPaths;
+		break;
+	case Request::eCollect:
+		removeOld(inRequest.mGeneration, inRequest.mKeepGenerations, inRequest.mMaxBytes);
+		break;
+	case Request::eStop:
+		break;
+	}
+}
+
+
+/*!
+ *  \brief Remove the files tracked the retention policy does no longer keep.
+ *  \param inGeneration      Current generation; its files are kept.
+ *  \param inKeepGenerations Generations whose files are kept, 0 for all.
+ *  \param inMaxBytes        Budget of the files tracked, 0 for none.
+ *
+ *  Files are examined once, after they have been written; files missing are forgotten.
+ */
+void GP::ArtifactCollector::removeOld(unsigned int inGeneration, unsigned int inKeepGenerations, unsigned long long inMaxBytes)
+{
+	std::set<std::string> lPinned;
+	for(std::map<std::string, std::vector<std::string> >::const_iterator lOwner=mPinned.begin(); lOwner!=mPinned.end(); ++lOwner)
+	{
+		lPinned.insert(lOwner->second.begin(), lOwner->second.end());
+	}
+
+	unsigned long long lTotal= 0;
+	std::vector<bool> lRemove(mArtifacts.size(), false);
+	for(unsigned int i=0; i<mArtifacts.size(); ++i)
+	{
+		Artifact& lArtifact= mArtifacts[i];
+		if (!lArtifact.mExamined)
+		{
+			struct stat lStat;
+			if (stat(lArtifact.mPath.c_str(), &lStat) != 0)
+			{
+				lRemove[i]= true;
+				continue;
+			}
+			lArtifact.mSize= lStat.st_size;
+			lArtifact.mExamined= true;
+		}
+		lTotal+= lArtifact.mSize;
+	}
+
+	unsigned int lNrFiles= 0;
+	unsigned long long lNrBytes= 0;
+	for(unsigned int i=0; i<mArtifacts.size(); ++i)
+	{
+		const Artifact& lArtifact= mArtifacts[i];
+		if (lRemove[i] || lArtifact.mGeneration >= inGeneration || lPinned.count(lArtifact.mPath) > 0) continue;
+		bool lTooOld= (inKeepGenerations > 0) && (lArtifact.mGeneration+ inKeepGenerations <= inGeneration);
+		bool lOverBudget= (inMaxBytes > 0) && (lTotal > inMaxBytes);
+		if (!lTooOld && !lOverBudget) continue;
+		if (unlink(lArtifact.mPath.c_str()) == 0)
+		{
+			lNrFiles++;
+			lNrBytes+= lArtifact.mSize;
+		}
+		lTotal-= lArtifact.mSize;
+		lRemove[i]= true;
+	}
+
+	std::deque<Artifact> lKept;
+	for(unsigned int i=0; i<mArtifacts.size(); ++i)
+	{
+		if (!lRemove[i]) lKept.push_back(mArtifacts[i]);
+	}
+	mArtifacts.swap(lKept);
+
+	pthread_mutex_lock(&mMutex);
+	mNrFilesRemoved+= lNrFiles;
+	mNrBytesRemoved+= lNrBytes;
+	pthread_mutex_unlock(&mMutex);
+}
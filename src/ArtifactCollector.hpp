@@ -0,0 +1,113 @@
+#ifndef Beagle_GP_ArtifactCollector_hpp
+#define Beagle_GP_ArtifactCollector_hpp
+
+#include "beagle/GP.hpp"
+#include "beagle/Int.hpp"
+
+#include <pthread.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Beagle
+{
+
+namespace GP
+{
+
+/*!
+ *  \class ArtifactCollector ArtifactCollector.hpp "ArtifactCollector.hpp"
+ *  \brief Component removing the sources, objects, and libraries generated by the compile operators.
+ *  \ingroup GPF
+ *
+ *  The compile operators add each file they generate, along with the generation it
+ *  has been generated in, and call collect at the end of each compilation. Files
+ *  generated icu.compiler.keep-generations generations ago or earlier are removed;
+ *  if icu.compiler.max-megabytes is set as well, the oldest files are removed until
+ *  the files tracked fit the budget. Files of the current generation and pinned
+ *  files, e.g. the latest hall of fame library and its members, are never removed.
+ *
+ *  Files are examined and removed by a background thread, so the generation loop
+ *  never waits for the file system; the calls of this class only queue requests.
+ *  With both parameters 0, the default, nothing is tracked nor removed. Files left
+ *  by previous runs are not tracked.
+ */
+class ArtifactCollector : public Component
+{
+
+public:
+
+	//! GP::ArtifactCollector allocator type.
+	typedef AllocatorT<ArtifactCollector,Component::Alloc>
+	Alloc;
+	//! GP::ArtifactCollector handle type.
+	typedef PointerT<ArtifactCollector,Component::Handle>
+	Handle;
+	//! GP::ArtifactCollector bag type.
+	typedef ContainerT<ArtifactCollector,Component::Bag>
+	Bag;
+
+	explicit ArtifactCollector(const std::string& inName=std::string("ArtifactCollector"));
+	virtual ~ArtifactCollector();
+
+	virtual void registerParams(System& ioSystem);
+
+	void add(const std::string& inPath, unsigned int inGeneration);
+	void pin(const std::string& inOwner, const std::vector<std::string>& inPaths);
+	void collect(unsigned int inGeneration);
+	bool isEnabled() const;
+	void getTotals(unsigned int& outNrFiles, unsigned long long& outNrBytes);
+
+protected:
+
+	//! A request to the background thread.
+	struct Request
+	{
+		enum Type { eAdd, ePin, eCollect, eStop };
+		Type                     mType;
+		std::string              mPath;         //!< File added, or owner of the files pinned.
+		std::vector<std::string> mPaths;        //!< Files pinned.
+		unsigned int             mGeneration;   //!< Generation of the file added, or current generation.
+		unsigned int             mKeepGenerations;
+		unsigned long long       mMaxBytes;
+	};
+
+	//! A file tracked.
+	struct Artifact
+	{
+		std::string        mPath;
+		unsigned int       mGeneration;
+		unsigned long long mSize;               //!< Size in bytes, once examined.
+		bool               mExamined;
+	};
+
+	void post(const Request& inRequest);
+	void run();
+	void process(const Request& inRequest);
+	void removeOld(unsigned int inGeneration, unsigned int inKeepGenerations, unsigned long long inMaxBytes);
+	static void* runThread(void* inCollector);
+
+	Int::Handle mKeepGenerations;   //!< Generations whose files are kept (icu.compiler.keep-generations), 0 for all.
+	Int::Handle mMaxMegabytes;      //!< Budget of the files tracked (icu.compiler.max-megabytes), 0 for none.
+
+	// Shared with the background thread, guarded by mMutex.
+	pthread_mutex_t     mMutex;
+	pthread_cond_t      mCondition;
+	pthread_t           mThread;
+	bool                mStarted;
+	std::deque<Request> mRequests;
+	unsigned int        mNrFilesRemoved;
+	unsigned long long  mNrBytesRemoved;
+
+	// Owned by the background thread.
+	std::deque<Artifact>                             mArtifacts;   //!< Files tracked, oldest first.
+	std::map<std::string, std::vector<std::string> > mPinned;      //!< Files pinned, by owner.
+
+};
+
+}
+
+}
+
+#endif // Beagle_GP_ArtifactCollector_hpp
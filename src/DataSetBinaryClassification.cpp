@@ -1,6 +1,9 @@
 #include "beagle/Beagle.hpp"
 #include "DataSetBinaryClassification.hpp"
 
+#include <algorithm>
+#include <map>
+
 using namespace Beagle;
 
 
@@ -11,7 +14,9 @@ using namespace Beagle;
 DataSetBinaryClassification::DataSetBinaryClassification(const std::string& inName) :
 		DataSetClassification(inName),
 		mIndexesNegatives(new std::vector<unsigned int>),
-		mIndexesPositives(new std::vector<unsigned int>)
+		mIndexesPositives(new std::vector<unsigned int>),
+		mPresampled(false),
+		mMaxLevels(0)
 { }
 
 
@@ -54,6 +59,9 @@ void DataSetBinaryClassification::readWithSystem(PACC::XML::ConstIterator inIter
 
 /*!
  * \brief Scan the dataset to create indexes of positive and negative samples.
+ *
+ * Identical rows are collapsed first, see collapseDuplicates; each row read is
+ * entered into the indexes as the row it has been collapsed into.
  */
 void DataSetBinaryClassification::createIndexes()
 {
@@ -66,17 +74,266 @@ void DataSetBinaryClassification::createIndexes()
 	{
 		mIndexesNegatives->resize(0);
 	}
+	std::vector<unsigned int> lLabels;
 	for (DataSetClassification::const_iterator lSample=begin(); lSample!=end(); ++lSample)
 	{
-		if (lSample->first == 1)
+		lLabels.push_back(lSample->first);
+	}
+	std::vector<unsigned int> lRows;
+	collapseDuplicates(lRows);
+	mMisses.assign(size(), 0);
+	mTrials.assign(size(), 0);
+	mAges.assign(size(), 0);
+	mPresampled= false;
+	for (unsigned int i=0; i<lRows.size(); ++i)
+	{
+		if (lLabels[i] == 1)
 		{
-			mIndexesPositives->push_back(lSample- begin());
+			mIndexesPositives->push_back(lRows[i]);
 		}
 		else
 		{
-			mIndexesNegatives->push_back(lSample- begin());
+			mIndexesNegatives->push_back(lRows[i]);
 		}
 	}
 	Beagle_StackTraceEndM("void DataSetBinaryClassification::createIndexes()");
 }
 
+
+/*!
+ * \brief Collapse rows with identical features and label into the first of them.
+ * \param outRows For each row read, the index of the row it has been collapsed into.
+ *
+ * The data set is compacted in place, keeping the order of first occurrences;
+ * the number of rows collapsed into each row is kept in mWeights.
+ */
+void DataSetBinaryClassification::collapseDuplicates(std::vector<unsigned int>& outRows)
+{
+	Beagle_StackTraceBeginM();
+	outRows.resize(size());
+	mWeights.clear();
+
+	// Rows are bucketed by a hash of label and features, compared in full within a bucket.
+	std::map< unsigned long long, std::vector<unsigned int> > lBuckets;
+	unsigned int lNrUnique= 0;
+	for (unsigned int i=0; i<size(); ++i)
+	{
+		const Beagle::Vector& lFeatures= (*this)[i].second;
+		unsigned long long lHash= 14695981039346656037ULL^ (*this)[i].first;
+		for (unsigned int j=0; j<lFeatures.size(); ++j)
+		{
+			double lValue= lFeatures[j];
+			const unsigned char* lBytes= (const unsigned char*)&lValue;
+			for (unsigned int k=0; k<sizeof(double); ++k)
+			{
+				lHash= (lHash^ lBytes[k])* 1099511628211ULL;
+			}
+		}
+
+		std::vector<unsigned int>& lBucket= lBuckets[lHash];
+		unsigned int lRow= lNrUnique;
+		for (std::vector<unsigned int>::const_iterator lCandidate=lBucket.begin(); lCandidate!=lBucket.end(); ++lCandidate)
+		{
+			if ((*this)[*lCandidate].first == (*this)[i].first &&
+			    (*this)[*lCandidate].second.size() == lFeatures.size() &&
+			    std::equal(lFeatures.begin(), lFeatures.end(), (*this)[*lCandidate].second.begin()))
+			{
+				lRow= *lCandidate;
+				break;
+			}
+		}
+		if (lRow == lNrUnique)
+		{
+			if (i != lNrUnique) (*this)[lNrUnique]= (*this)[i];
+			lBucket.push_back(lNrUnique);
+			mWeights.push_back(0);
+			lNrUnique++;
+		}
+		mWeights[lRow]++;
+		outRows[i]= lRow;
+	}
+	erase(begin()+ lNrUnique, end());
+	Beagle_StackTraceEndM("void DataSetBinaryClassification::collapseDuplicates(std::vector<unsigned int>&)");
+}
+
+
+
+/*!
+ *  \brief Record how often a row has been classified, and misclassified.
+ *  \param inRow Index of the row in the data set.
+ *  \param inMisses Number of individuals misclassifying the row.
+ *  \param inTrials Number of individuals classifying the row.
+ */
+void DataSetBinaryClassification::addMisses(unsigned int inRow, unsigned int inMisses, unsigned int inTrials)
+{
+	Beagle_StackTraceBeginM();
+	mMisses[inRow]+= inMisses;
+	mTrials[inRow]+= inTrials;
+	Beagle_StackTraceEndM("void DataSetBinaryClassification::addMisses(unsigned int, unsigned int, unsigned int)");
+}
+
+
+/*!
+ *  \brief Return the misclassification frequency of a row.
+ *  \param inRow Index of the row in the data set.
+ *  \return Fraction of individuals misclassifying the row, 1.0 for rows never classified.
+ */
+float DataSetBinaryClassification::getDifficulty(unsigned int inRow) const
+{
+	Beagle_StackTraceBeginM();
+	if (mTrials[inRow] == 0) return 1.0;
+	return (float)mMisses[inRow]/ mTrials[inRow];
+	Beagle_StackTraceEndM("float DataSetBinaryClassification::getDifficulty(unsigned int) const");
+}
+
+
+/*!
+ *  \brief Bucketize each column into at most inMaxLevels levels, by per-column quantiles.
+ *  \param inMaxLevels Maximum number of levels per column, at most 65536.
+ *  \return Number of columns quantized exactly.
+ *
+ *  Columns holding no more than inMaxLevels distinct values get one level per value,
+ *  so that comparing codes is exact; other columns are cut at quantiles.
+ *  Values are quantized as the floats evaluators pack into the training set.
+ */
+unsigned int DataSetBinaryClassification::quantize(unsigned int inMaxLevels)
+{
+	Beagle_StackTraceBeginM();
+	Beagle_AssertM(inMaxLevels >= 2 && inMaxLevels <= 65536);
+	mMaxLevels= inMaxLevels;
+	mLevels.clear();
+	mCodes.clear();
+	if (empty()) return 0;
+
+	unsigned int lNrColumns= (*this)[0].second.size();
+	mLevels.resize(lNrColumns);
+	mCodes.resize(size()* lNrColumns);
+	std::vector<double> lValues(size());
+	unsigned int lNrExact= 0;
+	for(unsigned int j=0; j<lNrColumns; ++j)
+	{
+		for(unsigned int i=0; i<size(); ++i)
+		{
+			lValues[i]= (float)(*this)[i].second[j];
+		}
+		std::sort(lValues.begin(), lValues.end());
+
+		// One level per distinct value, or the value at each quantile.
+		std::vector<double>& lLevels= mLevels[j];
+		lLevels.assign(lValues.begin(), std::unique(lValues.begin(), lValues.end()));
+		if (lLevels.size() > inMaxLevels)
+		{
+			lLevels.clear();
+			for(unsigned int k=0; k<inMaxLevels; ++k)
+			{
+				lLevels.push_back(lValues[(unsigned long)k* lValues.size()/ inMaxLevels]);
+			}
+			lLevels.erase(std::unique(lLevels.begin(), lLevels.end()), lLevels.end());
+		}
+		else
+		{
+			lNrExact++;
+		}
+
+		for(unsigned int i=0; i<size(); ++i)
+		{
+			double lValue= (float)(*this)[i].second[j];
+			unsigned int lCode= std::upper_bound(lLevels.begin(), lLevels.end(), lValue)- lLevels.begin();
+			mCodes[i* lNrColumns+ j]= (lCode > 0) ? lCode- 1 : 0;
+		}
+	}
+	return lNrExact;
+	Beagle_StackTraceEndM("unsigned int DataSetBinaryClassification::quantize(unsigned int)");
+}
+
+
+/*!
+ *  \brief Return the number of levels of column inColumn lower than inValue.
+ *
+ *  A value v of level k satisfies v < inValue, if k < countLevelsBelow(inValue);
+ *  exactly so, if the column has one level per distinct value.
+ */
+unsigned int DataSetBinaryClassification::countLevelsBelow(unsigned int inColumn, double inValue) const
+{
+	Beagle_StackTraceBeginM();
+	const std::vector<double>& lLevels= mLevels[inColumn];
+	return std::lower_bound(lLevels.begin(), lLevels.end(), inValue)- lLevels.begin();
+	Beagle_StackTraceEndM("unsigned int DataSetBinaryClassification::countLevelsBelow(unsigned int, double) const");
+}
+
+
+/*!
+ *  \brief Return the number of levels of column inColumn not greater than inValue.
+ *
+ *  A value v of level k satisfies inValue < v, if k >= countLevelsNotAbove(inValue).
+ */
+unsigned int DataSetBinaryClassification::countLevelsNotAbove(unsigned int inColumn, double inValue) const
+{
+	Beagle_StackTraceBeginM();
+	const std::vector<double>& lLevels= mLevels[inColumn];
+	return std::upper_bound(lLevels.begin(), lLevels.end(), inValue)- lLevels.begin();
+	Beagle_StackTraceEndM("unsigned int DataSetBinaryClassification::countLevelsNotAbove(unsigned int, double) const");
+}
+
+
+/*!
+ *  \brief Return the level of column inColumn equal to inValue, -1 if there is none.
+ */
+int DataSetBinaryClassification::findLevel(unsigned int inColumn, double inValue) const
+{
+	Beagle_StackTraceBeginM();
+	const std::vector<double>& lLevels= mLevels[inColumn];
+	std::vector<double>::const_iterator lLevel= std::lower_bound(lLevels.begin(), lLevels.end(), inValue);
+	if (lLevel == lLevels.end() || *lLevel != inValue) return -1;
+	return lLevel- lLevels.begin();
+	Beagle_StackTraceEndM("int DataSetBinaryClassification::findLevel(unsigned int, double) const");
+}
+
+
+/*!
+ *  \brief Store columns with few nonzero values as lists of their nonzero rows and values.
+ *  \param inMaxDensity Maximum fraction of rows holding a nonzero value for a column to be stored sparsely.
+ *  \return Number of columns stored sparsely.
+ *
+ *  Rows keep all columns, so the lists are an index on top of the dense rows and cost
+ *  memory: they let the bitmap index resolve a comparison for all rows holding zero
+ *  at once, and visit the nonzero rows only. The compiled individuals do not use them.
+ *  Values are compared to zero as the floats evaluators pack into the training set.
+ */
+unsigned int DataSetBinaryClassification::sparsify(float inMaxDensity)
+{
+	Beagle_StackTraceBeginM();
+	mSparse.clear();
+	mNonZeroRows.clear();
+	mNonZeroValues.clear();
+	if (empty()) return 0;
+
+	unsigned int lNrColumns= (*this)[0].second.size();
+	mSparse.resize(lNrColumns, false);
+	mNonZeroRows.resize(lNrColumns);
+	mNonZeroValues.resize(lNrColumns);
+	unsigned int lNrSparse= 0;
+	for(unsigned int j=0; j<lNrColumns; ++j)
+	{
+		unsigned int lNrNonZero= 0;
+		for(unsigned int i=0; i<size(); ++i)
+		{
+			if ((float)(*this)[i].second[j] != 0.0f) lNrNonZero++;
+		}
+		if (lNrNonZero > inMaxDensity* size()) continue;
+
+		mSparse[j]= true;
+		mNonZeroRows[j].reserve(lNrNonZero);
+		mNonZeroValues[j].reserve(lNrNonZero);
+		for(unsigned int i=0; i<size(); ++i)
+		{
+			float lValue= (*this)[i].second[j];
+			if (lValue == 0.0f) continue;
+			mNonZeroRows[j].push_back(i);
+			mNonZeroValues[j].push_back(lValue);
+		}
+		lNrSparse++;
+	}
+	return lNrSparse;
+	Beagle_StackTraceEndM("unsigned int DataSetBinaryClassification::sparsify(float)");
+}
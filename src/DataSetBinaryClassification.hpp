@@ -2,6 +2,7 @@
 #define Beagle_DataSetBinaryClassification_hpp
 
 #include "beagle/Beagle.hpp"
+#include "HugePageAllocator.hpp"
 #include <vector>
 
 
@@ -42,15 +43,134 @@ public:
 		return mIndexesNegatives;
 		Beagle_StackTraceEndM("void DataSetBinaryClassification::getIndexesNegatives()");
 	}
-	
+
+	/*!
+	 *  \brief Tell whether the training set has been selected by TrainingSetSamplingOp.
+	 *  \return True, if the first icu.trainingset.size-pos/-neg entries of the positive/negative
+	 *          indexes form the training set; false, if evaluators should draw the training set.
+	 */
+	inline bool isPresampled() const
+	{
+		return mPresampled;
+	}
+	inline void setPresampled(bool inPresampled)
+	{
+		mPresampled= inPresampled;
+	}
+
+	/*!
+	 *  \brief Return the number of rows read identical to row inRow, including inRow.
+	 *
+	 *  Identical rows (features and label) are collapsed into one row by createIndexes;
+	 *  the indexes of positive and negative rows hold each row as often as it has been read.
+	 */
+	inline unsigned int getWeight(unsigned int inRow) const
+	{
+		return mWeights[inRow];
+	}
+
+	void         addMisses(unsigned int inRow, unsigned int inMisses, unsigned int inTrials);
+	float        getDifficulty(unsigned int inRow) const;
+
+	/*!
+	 *  \brief Return the number of generations since row inRow has last been part of the training set.
+	 */
+	inline unsigned int getAge(unsigned int inRow) const
+	{
+		return mAges[inRow];
+	}
+	inline void setAge(unsigned int inRow, unsigned int inAge)
+	{
+		mAges[inRow]= inAge;
+	}
+
+	unsigned int quantize(unsigned int inMaxLevels);
+	unsigned int countLevelsBelow(unsigned int inColumn, double inValue) const;
+	unsigned int countLevelsNotAbove(unsigned int inColumn, double inValue) const;
+	int          findLevel(unsigned int inColumn, double inValue) const;
+
+	/*!
+	 *  \brief Tell whether quantize has been called; if so, rows are available as level codes.
+	 */
+	inline bool isQuantized() const
+	{
+		return !mLevels.empty();
+	}
+
+	/*!
+	 *  \brief Return the size of a level code in bytes, 1 for up to 256 levels per column, 2 otherwise.
+	 */
+	inline unsigned int getCodeBytes() const
+	{
+		return (mMaxLevels <= 256) ? 1 : 2;
+	}
+
+	/*!
+	 *  \brief Return the levels of column inColumn, ascending; code k stands for values in [level k, level k+1).
+	 */
+	inline const std::vector<double>& getLevels(unsigned int inColumn) const
+	{
+		return mLevels[inColumn];
+	}
+
+	/*!
+	 *  \brief Return the level code of column inColumn in row inRow.
+	 */
+	inline unsigned int getCode(unsigned int inRow, unsigned int inColumn) const
+	{
+		return mCodes[inRow* mLevels.size()+ inColumn];
+	}
+
+	unsigned int sparsify(float inMaxDensity);
+
+	/*!
+	 *  \brief Tell whether column inColumn is also stored as a list of its nonzero values, see sparsify.
+	 */
+	inline bool isSparse(unsigned int inColumn) const
+	{
+		return inColumn < mSparse.size() && mSparse[inColumn];
+	}
+
+	/*!
+	 *  \brief Return the rows holding a nonzero value in sparse column inColumn, ascending.
+	 */
+	inline const std::vector<unsigned int>& getNonZeroRows(unsigned int inColumn) const
+	{
+		return mNonZeroRows[inColumn];
+	}
+
+	/*!
+	 *  \brief Return the nonzero values of sparse column inColumn, in the order of getNonZeroRows.
+	 */
+	inline const std::vector<float>& getNonZeroValues(unsigned int inColumn) const
+	{
+		return mNonZeroValues[inColumn];
+	}
+
 protected:
 
 	std::vector<unsigned int>* mIndexesPositives;
 	std::vector<unsigned int>* mIndexesNegatives;
 
+	bool mPresampled;	//!< Whether the training set has been selected by TrainingSetSamplingOp.
+
+	std::vector<unsigned int> mMisses;	//!< Number of times each row has been misclassified.
+	std::vector<unsigned int> mTrials;	//!< Number of times each row has been classified.
+	std::vector<unsigned int> mAges;	//!< Number of generations since each row has last been sampled.
+	std::vector<unsigned int> mWeights;	//!< Number of rows read identical to each row.
+
+	unsigned int mMaxLevels;	//!< Maximum number of levels per column, see quantize.
+	std::vector< std::vector<double> > mLevels;	//!< Lower bound of each level, per column.
+	std::vector< unsigned short, HugePageAllocator<unsigned short> > mCodes;	//!< Level code of each value, row by row.
+
+	std::vector<bool> mSparse;	//!< Whether each column is stored as nonzero lists, see sparsify.
+	std::vector< std::vector<unsigned int> > mNonZeroRows;	//!< Rows holding a nonzero value, per sparse column.
+	std::vector< std::vector<float> > mNonZeroValues;	//!< Nonzero values, per sparse column.
+
 private:
 
 	virtual void createIndexes();
+	void         collapseDuplicates(std::vector<unsigned int>& outRows);
 };
 
 }
@@ -0,0 +1,415 @@
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <dlfcn.h>
+
+#include "EquivalenceCheckOp.hpp"
+#include "ArtifactCollector.hpp"
+#include "SharedLibCompiler.hpp"
+#include "ThresholdBitmapIndex.hpp"
+
+using namespace Beagle;
+using namespace GP;
+
+namespace
+{
+
+//! Signature of the functions in a library's fgp_individuals table.
+typedef int (*ApplyIndividual)(float[]);
+
+//! Signature of a library's ensemble_predict kernel.
+typedef void (*EnsemblePredict)(const float*, int, int, int, int*);
+
+//! Number of disagreements logged per backend; all are counted.
+const unsigned int gMaxReports= 20;
+
+}
+
+/*!
+ *  \brief Construct an equivalence check operator.
+ *  \param inName Name of the operator.
+ */
+EquivalenceCheckOp::EquivalenceCheckOp(std::string inName) :
+    Operator(inName)
+{
+}
+
+/*!
+ *  \brief Check the compiled backends against the interpreter on random individuals and rows.
+ *  \param ioDeme Deme to draw the individuals from.
+ *  \param ioContext Evolutionary context.
+ */
+void EquivalenceCheckOp::operate(Beagle::Deme& ioDeme, Beagle::Context& ioContext)
+{
+    Beagle_StackTraceBeginM();
+
+    GP::Context& lContext= castObjectT<GP::Context&>(ioContext);
+    DataSetBinaryClassification::Handle lDataSet= castHandleT<DataSetBinaryClassification>(ioContext.getSystem().getComponent("DataSet"));
+    if (ioDeme.size() == 0 || lDataSet->size() == 0) return;
+    int lNrIndividualsWanted= mNrIndividuals->getWrappedValue();
+    int lNrRowsWanted= mNrRows->getWrappedValue();
+    if (lNrIndividualsWanted <= 0 || lNrRowsWanted <= 0) return;
+
+    // Draw individuals and rows.
+    std::vector<unsigned int> lIndividuals(ioDeme.size());
+    for(unsigned int i=0; i<lIndividuals.size(); ++i) lIndividuals[i]= i;
+    std::random_shuffle(lIndividuals.begin(), lIndividuals.end(), ioContext.getSystem().getRandomizer());
+    lIndividuals.resize(std::min<unsigned int>(lNrIndividualsWanted, lIndividuals.size()));
+    std::sort(lIndividuals.begin(), lIndividuals.end());
+
+    std::vector<unsigned int> lRows(lDataSet->size());
+    for(unsigned int i=0; i<lRows.size(); ++i) lRows[i]= i;
+    std::random_shuffle(lRows.begin(), lRows.end(), ioContext.getSystem().getRandomizer());
+    lRows.resize(std::min<unsigned int>(lNrRowsWanted, lRows.size()));
+    unsigned int lNrRows= lRows.size();
+    unsigned int lNrColumns= (*lDataSet)[0].second.size();
+
+    // Rows as the float backends see them; the interpreter sees the same floats, widened.
+    std::vector<float> lFloats(lNrRows* lNrColumns);
+    std::vector<double> lValues(lNrRows* lNrColumns);
+    for(unsigned int r=0; r<lNrRows; ++r)
+    {
+        const Beagle::Vector& lData= (*lDataSet)[lRows[r]].second;
+        for(unsigned int j=0; j<lNrColumns; ++j)
+        {
+            lFloats[r* lNrColumns+ j]= (float)lData[j];
+            lValues[r* lNrColumns+ j]= lFloats[r* lNrColumns+ j];
+        }
+    }
+    std::vector<int> lReference;
+    interpret(ioDeme, lContext, lIndividuals, lValues, lNrRows, lNrColumns, lReference);
+
+    std::map<std::string, unsigned int> lDisagreements;
+    lDisagreements["exact"]= checkLibrary(ioDeme, lContext, "exact", lIndividuals, lRows, lFloats, lNrColumns, lReference);
+    lDisagreements["fast"]= checkLibrary(ioDeme, lContext, "fast", lIndividuals, lRows, lFloats, lNrColumns, lReference);
+    lDisagreements["ssa"]= checkLibrary(ioDeme, lContext, "ssa", lIndividuals, lRows, lFloats, lNrColumns, lReference);
+
+    // Quantized backends see the lower bound of each value's level.
+    std::vector<int> lReferenceLevels;
+    if (lDataSet->isQuantized())
+    {
+        unsigned int lCodeBytes= lDataSet->getCodeBytes();
+        unsigned int lRowStride= (lNrColumns* lCodeBytes+ sizeof(float)- 1)/ sizeof(float);
+        std::vector<float> lCodes(lNrRows* lRowStride, 0.0f);
+        for(unsigned int r=0; r<lNrRows; ++r)
+        {
+            float* lRow= &lCodes[0]+ r* lRowStride;
+            for(unsigned int j=0; j<lNrColumns; ++j)
+            {
+                unsigned int lCode= lDataSet->getCode(lRows[r], j);
+                if (lCodeBytes == 1) ((unsigned char*)lRow)[j]= lCode;
+                else ((unsigned short*)lRow)[j]= lCode;
+                lValues[r* lNrColumns+ j]= lDataSet->getLevels(j)[lCode];
+            }
+        }
+        interpret(ioDeme, lContext, lIndividuals, lValues, lNrRows, lNrColumns, lReferenceLevels);
+        lDisagreements["quantized"]= checkLibrary(ioDeme, lContext, "quantized", lIndividuals, lRows, lCodes, lRowStride, lReferenceLevels);
+    }
+    lDisagreements["bitmap"]= checkBitmap(ioDeme, lContext, lIndividuals, lRows, lDataSet->isQuantized() ? lReferenceLevels : lReference);
+
+    unsigned int lTotal= 0;
+    std::ostringstream lOSS;
+    lOSS << "g" << lContext.getGeneration() << " d" << lContext.getDemeIndex() << ": ";
+    lOSS << lIndividuals.size() << " individuals on " << lNrRows << " rows, disagreements with the interpreter:";
+    for(std::map<std::string, unsigned int>::const_iterator lBackend=lDisagreements.begin(); lBackend!=lDisagreements.end(); ++lBackend)
+    {
+        lOSS << " " << lBackend->first << " " << lBackend->second;
+        lTotal+= lBackend->second;
+    }
+    lOSS << ".";
+    if (lTotal > 0)
+    {
+        Beagle_LogBasicM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::EquivalenceCheckOp", lOSS.str());
+        if (mFail->getWrappedValue())
+        {
+            throw Beagle_RunTimeExceptionM("Compiled backends disagree with the interpreter, see log; "+ lOSS.str());
+        }
+    }
+    else
+    {
+        Beagle_LogInfoM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::EquivalenceCheckOp", lOSS.str());
+    }
+
+    Beagle_StackTraceEndM("void EquivalenceCheckOp::operate(Deme&, Context&)");
+}
+
+/*!
+ *  \brief Run individuals by the interpreter on rows of values.
+ *
+ *  The value of each column is set on the INc terminals of the individuals' trees,
+ *  row by row, as GP::EvaluationOp::setValue would; then each individual is run.
+ */
+void EquivalenceCheckOp::interpret(Beagle::Deme& ioDeme,
+                                   GP::Context& ioContext,
+                                   const std::vector<unsigned int>& inIndividuals,
+                                   const std::vector<double>& inValues,
+                                   unsigned int inNrRows,
+                                   unsigned int inNrColumns,
+                                   std::vector<int>& outPredictions) const
+{
+    Beagle_StackTraceBeginM();
+
+    // Collect the distinct INc terminals of all trees, with their columns.
+    std::map<GP::Primitive*, unsigned int> lTerminals;
+    for(unsigned int k=0; k<inIndividuals.size(); ++k)
+    {
+        GP::Individual& lIndividual= castObjectT<GP::Individual&>(*ioDeme[inIndividuals[k]]);
+        for(unsigned int i=0; i<lIndividual.size(); ++i)
+        {
+            GP::Tree& lTree= *lIndividual[i];
+            for(unsigned int j=0; j<lTree.size(); ++j)
+            {
+                const std::string& lName= lTree[j].mPrimitive->getName();
+                if (lName.size() > 2 && lName.compare(0, 2, "IN") == 0 && lTree[j].mPrimitive->getNumberArguments() == 0)
+                {
+                    lTerminals[&*lTree[j].mPrimitive]= atoi(lName.c_str()+ 2);
+                }
+            }
+        }
+    }
+
+    GP::Individual::Handle lOldIndividual= castHandleT<GP::Individual>(ioContext.getIndividualHandle());
+    unsigned int lOldIndex= ioContext.getIndividualIndex();
+    outPredictions.assign(inIndividuals.size()* inNrRows, 0);
+    Bool lResult;
+    for(unsigned int r=0; r<inNrRows; ++r)
+    {
+        for(std::map<GP::Primitive*, unsigned int>::iterator lTerminal=lTerminals.begin(); lTerminal!=lTerminals.end(); ++lTerminal)
+        {
+            lTerminal->first->setValue(Double(inValues[r* inNrColumns+ lTerminal->second]));
+        }
+        for(unsigned int k=0; k<inIndividuals.size(); ++k)
+        {
+            ioContext.setIndividualIndex(inIndividuals[k]);
+            GP::Individual::Handle lIndividual= castHandleT<GP::Individual>(ioDeme[inIndividuals[k]]);
+            ioContext.setIndividualHandle(lIndividual);
+            lIndividual->run(lResult, ioContext);
+            outPredictions[k* inNrRows+ r]= lResult.getWrappedValue() ? 1 : 0;
+        }
+    }
+    ioContext.setIndividualIndex(lOldIndex);
+    ioContext.setIndividualHandle(lOldIndividual);
+
+    Beagle_StackTraceEndM("void EquivalenceCheckOp::interpret(Deme&, GP::Context&, const std::vector<unsigned int>&, const std::vector<double>&, unsigned int, unsigned int, std::vector<int>&) const");
+}
+
+/*!
+ *  \brief Compile individuals for a backend, apply them to rows, compare with the interpreter.
+ *  \param inBackend 'exact', 'fast', or 'quantized'.
+ *  \param inRows The data set row of each row in inBlock.
+ *  \param inBlock The rows as the backend reads them, inRowStride floats apart.
+ *
+ *  The library compiled for 'exact' holds the ensemble kernel of all individuals as well;
+ *  its majority vote is compared with the majority of the interpreter's predictions.
+ */
+unsigned int EquivalenceCheckOp::checkLibrary(Beagle::Deme& ioDeme,
+                                              GP::Context& ioContext,
+                                              const std::string& inBackend,
+                                              const std::vector<unsigned int>& inIndividuals,
+                                              const std::vector<unsigned int>& inRows,
+                                              const std::vector<float>& inBlock,
+                                              unsigned int inRowStride,
+                                              const std::vector<int>& inReference) const
+{
+    Beagle_StackTraceBeginM();
+
+    DataSetBinaryClassification::Handle lDataSet= castHandleT<DataSetBinaryClassification>(ioContext.getSystem().getComponent("DataSet"));
+    unsigned int lNrColumns= (*lDataSet)[0].second.size();
+    std::string lTmpDirectory= "./tmp";
+    if (ioContext.getSystem().getRegister().isRegistered("icu.compiler.tmp-directory"))
+    {
+        lTmpDirectory= castHandleT<String>(ioContext.getSystem().getRegister()["icu.compiler.tmp-directory"])->getWrappedValue();
+    }
+
+    SharedLibCompiler lCompiler(lNrColumns, lTmpDirectory);
+    lCompiler.setFastMath(inBackend == "fast");
+    lCompiler.setSSA(inBackend == "ssa");
+    if (inBackend == "quantized") lCompiler.setQuantization(lDataSet);
+    std::vector<GP::Individual::Handle> lMembers;
+    for(unsigned int k=0; k<inIndividuals.size(); ++k)
+    {
+        GP::Individual::Handle lIndividual= castHandleT<GP::Individual>(ioDeme[inIndividuals[k]]);
+        lCompiler.addIndividual(*lIndividual, ioContext.getGeneration(), ioContext.getDemeIndex(), inIndividuals[k]);
+        lMembers.push_back(lIndividual);
+    }
+    bool lEnsemble= (inBackend == "exact");
+    if (lEnsemble) lCompiler.addEnsemble(lMembers, std::vector<double>());
+
+    std::ostringstream lLibName;
+    lLibName << "verify_g" << ioContext.getGeneration() << "_d" << ioContext.getDemeIndex() << "_" << inBackend;
+    std::string lLibPath= lCompiler.compile(lLibName.str());
+    ArtifactCollector::Handle lCollector= castHandleT<ArtifactCollector>(ioContext.getSystem().getComponent("ArtifactCollector"));
+    if (lCollector != NULL)
+    {
+        lCollector->add(lTmpDirectory+ "/"+ lLibName.str()+ ".c", ioContext.getGeneration());
+        lCollector->add(lLibPath, ioContext.getGeneration());
+    }
+    void* lHandle= dlopen(lLibPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!lHandle)
+    {
+        throw Beagle_RunTimeExceptionM("Cannot open shared library "+ lLibPath+ ": "+ dlerror()+ ".");
+    }
+    dlerror();
+    ApplyIndividual* lFunctions= (ApplyIndividual*)dlsym(lHandle, "fgp_individuals");
+    EnsemblePredict lEnsemblePredict= lEnsemble ? (EnsemblePredict)dlsym(lHandle, "ensemble_predict") : NULL;
+    char* lError= dlerror();
+    if (lError != NULL)
+    {
+        std::string lMessage= lError;
+        dlclose(lHandle);
+        throw Beagle_RunTimeExceptionM("Error loading "+ lLibPath+ ": "+ lMessage+ ".");
+    }
+
+    unsigned int lNrRows= inRows.size();
+    unsigned int lDisagreements= 0;
+    for(unsigned int k=0; k<inIndividuals.size(); ++k)
+    {
+        GP::Individual& lIndividual= castObjectT<GP::Individual&>(*ioDeme[inIndividuals[k]]);
+        for(unsigned int r=0; r<lNrRows; ++r)
+        {
+            int lPrediction= (lFunctions[k](const_cast<float*>(&inBlock[0])+ r* inRowStride) != 0);
+            if (lPrediction == inReference[k* lNrRows+ r]) continue;
+            if (lDisagreements++ < gMaxReports)
+            {
+                report(ioContext, inBackend, lIndividual, inIndividuals[k], inRows[r], inReference[k* lNrRows+ r], lPrediction);
+            }
+        }
+    }
+
+    // The ensemble kernel against the interpreter's majority vote.
+    if (lEnsemblePredict != NULL && !inIndividuals.empty())
+    {
+        std::vector<int> lVotes(lNrRows);
+        lEnsemblePredict(&inBlock[0], lNrRows, inRowStride, 0, &lVotes[0]);
+        for(unsigned int r=0; r<lNrRows; ++r)
+        {
+            unsigned int lPositives= 0;
+            for(unsigned int k=0; k<inIndividuals.size(); ++k)
+            {
+                lPositives+= inReference[k* lNrRows+ r];
+            }
+            int lMajority= (2* lPositives > inIndividuals.size());
+            if ((lVotes[r] != 0) == lMajority) continue;
+            if (lDisagreements++ < gMaxReports)
+            {
+                std::ostringstream lOSS;
+                lOSS << "ensemble of " << inIndividuals.size() << " individuals disagrees on data set row " << inRows[r];
+                lOSS << ": interpreter majority " << lMajority << ", kernel " << lVotes[r] << ".";
+                Beagle_LogBasicM(ioContext.getSystem().getLogger(), "checkLibrary", "Beagle::GP::EquivalenceCheckOp", lOSS.str());
+            }
+        }
+    }
+    dlclose(lHandle);
+    return lDisagreements;
+
+    Beagle_StackTraceEndM("unsigned int EquivalenceCheckOp::checkLibrary(Deme&, GP::Context&, const std::string&, const std::vector<unsigned int>&, const std::vector<unsigned int>&, const std::vector<float>&, unsigned int, const std::vector<int>&) const");
+}
+
+/*!
+ *  \brief Evaluate individuals from a bitmap index over the rows, compare with the interpreter.
+ *
+ *  Individuals whose trees the index cannot evaluate are skipped.
+ */
+unsigned int EquivalenceCheckOp::checkBitmap(Beagle::Deme& ioDeme,
+                                             GP::Context& ioContext,
+                                             const std::vector<unsigned int>& inIndividuals,
+                                             const std::vector<unsigned int>& inRows,
+                                             const std::vector<int>& inReference) const
+{
+    Beagle_StackTraceBeginM();
+
+    DataSetBinaryClassification::Handle lDataSet= castHandleT<DataSetBinaryClassification>(ioContext.getSystem().getComponent("DataSet"));
+    ThresholdBitmapIndex lIndex;
+    lIndex.build(lDataSet, inRows, (*lDataSet)[0].second.size());
+    ThresholdBitmapIndex::Bitmap lBitmap;
+    unsigned int lBitsPerWord= 8* sizeof(unsigned long);
+    unsigned int lNrRows= inRows.size();
+    unsigned int lDisagreements= 0;
+    for(unsigned int k=0; k<inIndividuals.size(); ++k)
+    {
+        GP::Individual& lIndividual= castObjectT<GP::Individual&>(*ioDeme[inIndividuals[k]]);
+        if (!lIndex.evaluate(*lIndividual[0], lBitmap)) continue;
+        for(unsigned int r=0; r<lNrRows; ++r)
+        {
+            int lPrediction= (lBitmap[r/ lBitsPerWord] >> (r% lBitsPerWord)) & 1UL;
+            if (lPrediction == inReference[k* lNrRows+ r]) continue;
+            if (lDisagreements++ < gMaxReports)
+            {
+                report(ioContext, "bitmap", lIndividual, inIndividuals[k], inRows[r], inReference[k* lNrRows+ r], lPrediction);
+            }
+        }
+    }
+    return lDisagreements;
+
+    Beagle_StackTraceEndM("unsigned int EquivalenceCheckOp::checkBitmap(Deme&, GP::Context&, const std::vector<unsigned int>&, const std::vector<unsigned int>&, const std::vector<int>&) const");
+}
+
+/*!
+ *  \brief Log a row on which a backend disagrees with the interpreter, with the individual's tree.
+ */
+void EquivalenceCheckOp::report(GP::Context& ioContext,
+                                const std::string& inBackend,
+                                GP::Individual& inIndividual,
+                                unsigned int inIndividualIndex,
+                                unsigned int inRow,
+                                int inExpected,
+                                int inActual) const
+{
+    Beagle_StackTraceBeginM();
+
+    std::ostringstream lOSS;
+    lOSS << inBackend << ": individual " << inIndividualIndex << " disagrees on data set row " << inRow;
+    lOSS << ": interpreter " << inExpected << ", compiled " << inActual << "; tree " << inIndividual[0]->deparse();
+    Beagle_LogBasicM(ioContext.getSystem().getLogger(), "report", "Beagle::GP::EquivalenceCheckOp", lOSS.str());
+
+    Beagle_StackTraceEndM("void EquivalenceCheckOp::report(GP::Context&, const std::string&, GP::Individual&, unsigned int, unsigned int, int, int) const");
+}
+
+/*!
+ *  \brief Register the parameters of the operator.
+ *  \param ioSystem System of the evolution.
+ */
+void EquivalenceCheckOp::registerParams(Beagle::System& ioSystem)
+{
+    Beagle_StackTraceBeginM();
+
+    Beagle::Operator::registerParams(ioSystem);
+
+    // 'icu.verify.individuals', individuals checked per deme.
+    {
+		Register::Description lDescription(
+		    "Individuals verified",
+		    "Integer",
+		    "20",
+		    "Number of individuals drawn at random from the deme, each time the operator is applied; 0 disables the check."
+		);
+        mNrIndividuals= castHandleT<Int>(
+            ioSystem.getRegister().insertEntry("icu.verify.individuals", new Int(20), lDescription));
+    }
+
+    // 'icu.verify.rows', rows checked.
+    {
+		Register::Description lDescription(
+		    "Rows verified",
+		    "Integer",
+		    "500",
+		    "Number of rows drawn at random from the data set, on which all backends are compared with the interpreter."
+		);
+        mNrRows= castHandleT<Int>(
+            ioSystem.getRegister().insertEntry("icu.verify.rows", new Int(500), lDescription));
+    }
+
+    // 'icu.verify.fail', whether disagreements are fatal.
+    {
+		Register::Description lDescription(
+		    "Fail on disagreement",
+		    "Bool",
+		    "0",
+		    "Throw an exception, ending the evolution, if any backend disagrees with the interpreter; otherwise, only log."
+		);
+        mFail= castHandleT<Bool>(
+            ioSystem.getRegister().insertEntry("icu.verify.fail", new Bool(false), lDescription));
+    }
+
+    Beagle_StackTraceEndM("void EquivalenceCheckOp::registerParams(System&)");
+}
@@ -0,0 +1,123 @@
+#ifndef Beagle_GP_EquivalenceCheckOp_hpp
+#define Beagle_GP_EquivalenceCheckOp_hpp
+
+#include <string>
+#include <vector>
+
+#include "beagle/GP.hpp"
+#include "beagle/Operator.hpp"
+#include "DataSetBinaryClassification.hpp"
+
+namespace Beagle
+{
+
+namespace GP
+{
+
+/*!
+ *  \class EquivalenceCheckOp EquivalenceCheckOp.hpp "EquivalenceCheckOp.hpp"
+ *  \brief Verify that the compiled backends classify as Open BEAGLE's interpreter does.
+ *  \ingroup Op
+ *
+ *  icu.verify.individuals individuals are drawn from the deme at random, and
+ *  icu.verify.rows rows from the data set. Each individual is run by the interpreter,
+ *  GP::Individual::run, on each row; its predictions are the reference. The same
+ *  individuals are then compiled by SharedLibCompiler and applied to the same rows in
+ *  each backend:
+ *
+ *    + exact: floats, libm;
+ *    + fast: floats, fast math approximations;
+ *    + ssa: floats, libm, emitted as three-address temporaries;
+ *    + quantized: level codes, if the data set has been quantized;
+ *    + ensemble: the fused majority vote kernel of all individuals drawn;
+ *    + bitmap: ThresholdBitmapIndex, for the individuals it can evaluate.
+ *
+ *  Quantized backends see the lower bound of each value's level; their reference is
+ *  the interpreter run on the lower bounds. Each row on which a backend disagrees with
+ *  its reference is logged along with the individual's tree; with icu.verify.fail set,
+ *  any disagreement ends the evolution.
+ *
+ *  Placed in the bootstrap set after the initialization operator, the operator checks
+ *  random individuals built from the primitive set; in the main loop, evolved ones.
+ */
+class EquivalenceCheckOp : public Beagle::Operator
+{
+
+public:
+
+	//! Operator allocator type.
+	typedef Beagle::AllocatorT<EquivalenceCheckOp, Beagle::Operator::Alloc> Alloc;
+	//! Operator handle type.
+	typedef Beagle::PointerT<EquivalenceCheckOp, Beagle::Operator::Handle> Handle;
+	//! Operator bag type.
+	typedef Beagle::ContainerT<EquivalenceCheckOp, Beagle::Operator::Bag> Bag;
+
+	explicit EquivalenceCheckOp(std::string inName="EquivalenceCheckOp");
+	virtual ~EquivalenceCheckOp()
+	{ }
+
+	virtual void operate(Beagle::Deme& ioDeme, Beagle::Context& ioContext);
+	virtual void registerParams(Beagle::System& ioSystem);
+
+protected:
+
+	/*!
+	 * Run the individuals in inIndividuals of ioDeme by the interpreter on inNrRows rows of
+	 * inNrColumns values each in inValues; store the prediction of individual k on row r
+	 * in outPredictions[k* inNrRows+ r].
+	 */
+	void interpret(Beagle::Deme& ioDeme,
+	               GP::Context& ioContext,
+	               const std::vector<unsigned int>& inIndividuals,
+	               const std::vector<double>& inValues,
+	               unsigned int inNrRows,
+	               unsigned int inNrColumns,
+	               std::vector<int>& outPredictions) const;
+
+	/*!
+	 * Compile the individuals in inIndividuals of ioDeme into a library for backend inBackend,
+	 * apply them to the rows in inBlock, inRowStride floats apart, packed from data set rows
+	 * inRows; compare with inReference. Returns the number of disagreements.
+	 */
+	unsigned int checkLibrary(Beagle::Deme& ioDeme,
+	                          GP::Context& ioContext,
+	                          const std::string& inBackend,
+	                          const std::vector<unsigned int>& inIndividuals,
+	                          const std::vector<unsigned int>& inRows,
+	                          const std::vector<float>& inBlock,
+	                          unsigned int inRowStride,
+	                          const std::vector<int>& inReference) const;
+
+	/*!
+	 * Evaluate the individuals in inIndividuals of ioDeme on data set rows inRows
+	 * from a ThresholdBitmapIndex; compare with inReference.
+	 * Returns the number of disagreements.
+	 */
+	unsigned int checkBitmap(Beagle::Deme& ioDeme,
+	                         GP::Context& ioContext,
+	                         const std::vector<unsigned int>& inIndividuals,
+	                         const std::vector<unsigned int>& inRows,
+	                         const std::vector<int>& inReference) const;
+
+	/*!
+	 * Log a disagreement of backend inBackend on row inRow with the reference.
+	 */
+	void report(GP::Context& ioContext,
+	            const std::string& inBackend,
+	            GP::Individual& inIndividual,
+	            unsigned int inIndividualIndex,
+	            unsigned int inRow,
+	            int inExpected,
+	            int inActual) const;
+
+	Beagle::Int::Handle  mNrIndividuals;   //!< Individuals drawn per deme (icu.verify.individuals).
+	Beagle::Int::Handle  mNrRows;          //!< Rows drawn from the data set (icu.verify.rows).
+	Beagle::Bool::Handle mFail;            //!< Whether disagreements end the evolution (icu.verify.fail).
+
+};
+
+}
+
+}
+
+#endif // Beagle_GP_EquivalenceCheckOp_hpp
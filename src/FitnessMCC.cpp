@@ -5,8 +5,78 @@
 #include <cfloat>
 #include <algorithm>
 
+#include <pthread.h>
+
 using namespace Beagle;
 
+namespace
+{
+
+//! Number of FitnessMCC blocks allocated at once.
+const unsigned int cPoolChunk= 1024;
+
+//! Size of a block, a multiple of 16 bytes to keep blocks aligned.
+const size_t cPoolBlock= (sizeof(GP::FitnessMCC)+ 15)/ 16* 16;
+
+//! Blocks released, each holding a pointer to the next; chunks are never returned.
+void* gPoolFree= NULL;
+pthread_mutex_t gPoolMutex= PTHREAD_MUTEX_INITIALIZER;
+
+//! Serial number of the last evaluation, see GP::FitnessMCC::getSerial.
+unsigned long long gSerial= 0;
+
+/*!
+ *  \brief Return a new serial number; fitness objects may be created by several threads.
+ */
+unsigned long long nextSerial()
+{
+	return __sync_add_and_fetch(&gSerial, 1);
+}
+
+}
+
+
+/*!
+ *  \brief Take a FitnessMCC from the pool, allocating a chunk of blocks if it is empty.
+ *  \param inSize Size of the object; objects of derived classes are allocated by the global operator new.
+ */
+void* GP::FitnessMCC::operator new(size_t inSize)
+{
+	if (inSize != sizeof(GP::FitnessMCC)) return ::operator new(inSize);
+	pthread_mutex_lock(&gPoolMutex);
+	if (gPoolFree == NULL)
+	{
+		char* lChunk= static_cast<char*>(::operator new(cPoolChunk* cPoolBlock));
+		for(unsigned int i=0; i<cPoolChunk; ++i)
+		{
+			*reinterpret_cast<void**>(lChunk+ i* cPoolBlock)= (i+ 1 < cPoolChunk) ? lChunk+ (i+ 1)* cPoolBlock : NULL;
+		}
+		gPoolFree= lChunk;
+	}
+	void* lBlock= gPoolFree;
+	gPoolFree= *static_cast<void**>(lBlock);
+	pthread_mutex_unlock(&gPoolMutex);
+	return lBlock;
+}
+
+
+/*!
+ *  \brief Return a FitnessMCC to the pool.
+ */
+void GP::FitnessMCC::operator delete(void* inPointer, size_t inSize)
+{
+	if (inPointer == NULL) return;
+	if (inSize != sizeof(GP::FitnessMCC))
+	{
+		::operator delete(inPointer);
+		return;
+	}
+	pthread_mutex_lock(&gPoolMutex);
+	*static_cast<void**>(inPointer)= gPoolFree;
+	gPoolFree= inPointer;
+	pthread_mutex_unlock(&gPoolMutex);
+}
+
 
 /*!
  *  \brief Default construct a MCC's fitness object.
@@ -18,7 +88,9 @@ GP::FitnessMCC::FitnessMCC() :
 		mTruePositives(0),
 		mFalsePositives(0),
 		mTrueNegatives(0),
-		mFalseNegatives(0)
+		mFalseNegatives(0),
+		mFidelity(1.0),
+		mSerial(nextSerial())
 { }
 
 
@@ -32,7 +104,9 @@ GP::FitnessMCC::FitnessMCC() :
 GP::FitnessMCC::FitnessMCC(unsigned int inTruePositives,
 						unsigned int inFalsePositives,
 						unsigned int inTrueNegatives,
-						unsigned int inFalseNegatives)
+						unsigned int inFalseNegatives) :
+		mFidelity(1.0),
+		mSerial(0)
 {
 	Beagle_StackTraceBeginM();
 	setFitness(inTruePositives,
@@ -56,6 +130,36 @@ const std::string& GP::FitnessMCC::getType() const
 }
 
 
+/*!
+ *  \brief Tell whether two MCC fitnesses are equal, i.e. of the same fidelity and MCC.
+ *  \param inRightObj Fitness to compare to.
+ */
+bool GP::FitnessMCC::isEqual(const Object& inRightObj) const
+{
+	Beagle_StackTraceBeginM();
+	const GP::FitnessMCC& lRightFitness= castObjectT<const GP::FitnessMCC&>(inRightObj);
+	return (mFidelity == lRightFitness.mFidelity) && FitnessSimple::isEqual(inRightObj);
+	Beagle_StackTraceEndM("bool GP::FitnessMCC::isEqual(const Object&) const");
+}
+
+
+/*!
+ *  \brief Tell whether this fitness ranks below another, comparing fidelity first, then MCC.
+ *  \param inRightObj Fitness to compare to.
+ *
+ *  A noisy MCC computed on a small subsample can thus not outrank an MCC computed on
+ *  the full training set, neither in selection nor in the hall of fame.
+ */
+bool GP::FitnessMCC::isLess(const Object& inRightObj) const
+{
+	Beagle_StackTraceBeginM();
+	const GP::FitnessMCC& lRightFitness= castObjectT<const GP::FitnessMCC&>(inRightObj);
+	if (mFidelity != lRightFitness.mFidelity) return mFidelity < lRightFitness.mFidelity;
+	return FitnessSimple::isLess(inRightObj);
+	Beagle_StackTraceEndM("bool GP::FitnessMCC::isLess(const Object&) const");
+}
+
+
 /*!
  *  \brief Read a MCC's fitness from a XML subtree.
  *  \param inIter XML iterator to use to read the fitness values.
@@ -79,7 +183,9 @@ void GP::FitnessMCC::read(PACC::XML::ConstIterator inIter)
 			throw Beagle_IOExceptionNodeM(*inIter, lOSS.str());
 		}
 
-		// Read values of MCC's fitness
+		// Read values of MCC's fitness; fitness written without fidelity has been computed on the full training set.
+		mFidelity= 1.0;
+		mSerial= nextSerial();
 		for(PACC::XML::ConstIterator lChild=inIter->getFirstChild(); lChild; ++lChild) {
 			if(lChild->getType() == PACC::XML::eData) {
 				if(lChild->getValue() == "MCC") {
@@ -136,6 +242,12 @@ void GP::FitnessMCC::read(PACC::XML::ConstIterator inIter)
 					if(lChild2->getType() != PACC::XML::eString)
 						throw Beagle_IOExceptionNodeM(*lChild2, "no value for false negatives Rel present!");
 					mFalseNegativesRel= str2uint(lChild2->getValue());
+				} else if(lChild->getValue() == "Fidelity") {
+					PACC::XML::ConstIterator lChild2 = lChild->getFirstChild();
+					if(!lChild2) throw Beagle_IOExceptionNodeM(*lChild, "no value for fidelity present!");
+					if(lChild2->getType() != PACC::XML::eString)
+						throw Beagle_IOExceptionNodeM(*lChild2, "no value for fidelity present!");
+					mFidelity= str2dbl(lChild2->getValue());
 				}
 			}
 		}
@@ -164,6 +276,7 @@ void GP::FitnessMCC::setFitness(unsigned int inTruePositives,
                                 unsigned int inFalseNegatives)
 {
 	Beagle_StackTraceBeginM();
+    mSerial= nextSerial();
     mTruePositives=  inTruePositives;
     mFalsePositives= inFalsePositives;
     mTrueNegatives=  inTrueNegatives;
@@ -233,6 +346,9 @@ void GP::FitnessMCC::writeContent(PACC::XML::Streamer& ioStreamer, bool inIndent
 	ioStreamer.openTag("FalseNegativesRel", false);
 	ioStreamer.insertStringContent(dbl2str(mFalseNegativesRel));
 	ioStreamer.closeTag();
+	ioStreamer.openTag("Fidelity", false);
+	ioStreamer.insertStringContent(dbl2str(mFidelity));
+	ioStreamer.closeTag();
 	Beagle_StackTraceEndM("void GP::FitnessMCC::writeContent(PACC::XML::Streamer&, bool) const");
 }
 
@@ -37,6 +37,15 @@ namespace GP
  *  predictions (also termed accuracy), are not useful when the two classes are 
  *  of very different sizes.
  *
+ *  Fitness computed at a lower fidelity, i.e. on a smaller part of the training set
+ *  (see MultiFidelityEvalOp), ranks below fitness computed at a higher fidelity,
+ *  whatever their MCCs; MCCs are compared between fitnesses of the same fidelity only.
+ *
+ *  A fitness is created per individual and generation; FitnessMCC objects are therefore
+ *  taken from a pool of fixed size blocks, recycled as individuals release them. As an
+ *  address may thus be reused at once, each evaluation is identified by a serial number
+ *  instead, see getSerial.
+ *
  */
 class FitnessMCC : public FitnessSimple
 {
@@ -59,7 +68,12 @@ public:
 						unsigned int inTrueNegatives,
 						unsigned int inFalseNegatives);
 
+	static void* operator new(size_t inSize);
+	static void  operator delete(void* inPointer, size_t inSize);
+
 	virtual const std::string&  getType() const;
+	virtual bool                isEqual(const Object& inRightObj) const;
+	virtual bool                isLess(const Object& inRightObj) const;
 	virtual void                read(PACC::XML::ConstIterator inIter);
 	virtual void                setFitness(unsigned int inTruePositives,
                                            unsigned int inFalsePositives,
@@ -67,6 +81,41 @@ public:
                                            unsigned int inFalseNegatives);
 	virtual void                writeContent(PACC::XML::Streamer& ioStreamer, bool inIndent=true) const;
 
+	/*!
+	 *  \brief  Return the fidelity the fitness has been computed at.
+	 *  \return Fraction of the training set (icu.trainingset.size) used for evaluation,
+	 *          1.0 if the individual has been scored on the full training set.
+	 */
+	inline float getFidelity() const
+	{
+		Beagle_StackTraceBeginM();
+		return mFidelity;
+		Beagle_StackTraceEndM("float GP::FitnessMCC::getFidelity() const");
+	}
+
+	/*!
+	 *  \brief  Return the serial number of the evaluation the fitness holds.
+	 *  \return Number unique to each construction, setFitness, and read in this process;
+	 *          copies of a fitness keep its serial, as they hold the same evaluation.
+	 */
+	inline unsigned long long getSerial() const
+	{
+		Beagle_StackTraceBeginM();
+		return mSerial;
+		Beagle_StackTraceEndM("unsigned long long GP::FitnessMCC::getSerial() const");
+	}
+
+	/*!
+	 *  \brief Set the fidelity the fitness has been computed at.
+	 *  \param inFidelity Fraction of the training set used for evaluation, in (0,1].
+	 */
+	inline void setFidelity(float inFidelity)
+	{
+		Beagle_StackTraceBeginM();
+		mFidelity= inFidelity;
+		Beagle_StackTraceEndM("void GP::FitnessMCC::setFidelity(float)");
+	}
+
 	/*!
 	 *  \brief  Return the number of true positives 
 	 *          (TP, positive samples classified as positive).
@@ -178,6 +227,10 @@ private:
 	float mFalsePositivesRel;	//!< Relative number of false positives, FP/ (TN+ FP).
 	float mTrueNegativesRel;	//!< Relative number of true negatives, TN/ (TN+ FP).
 	float mFalseNegativesRel;	//!< Relative number of false negatives, FN/ (TP+ FN).
+
+	float mFidelity;	//!< Fraction of the training set the fitness has been computed on.
+
+	unsigned long long mSerial;	//!< Serial number of the evaluation, see getSerial.
 	
 };
 
@@ -0,0 +1,139 @@
+#include "beagle/GP.hpp"
+#include "FitnessTable.hpp"
+
+using namespace Beagle;
+
+
+/*!
+ *  \brief Construct an empty fitness table.
+ *  \param inName Name of the component.
+ */
+GP::FitnessTable::FitnessTable(const std::string& inName) :
+		Component(inName),
+		mGeneration(-1),
+		mDemeIndex(-1)
+{ }
+
+
+/*!
+ *  \brief Resize the table to inSize rows, keeping existing rows; unstamp the table.
+ *  \param inSize Number of rows, i.e. of individuals in the deme.
+ */
+void GP::FitnessTable::resize(unsigned int inSize)
+{
+	Beagle_StackTraceBeginM();
+	mMCC.resize(inSize, 0.0f);
+	mTruePositives.resize(inSize, 0);
+	mFalsePositives.resize(inSize, 0);
+	mTrueNegatives.resize(inSize, 0);
+	mFalseNegatives.resize(inSize, 0);
+	mTreeSizes.resize(inSize, 0);
+	mTreeDepths.resize(inSize, 0);
+	mSerials.resize(inSize, 0);
+	mGeneration= -1;
+	mDemeIndex= -1;
+	Beagle_StackTraceEndM("void GP::FitnessTable::resize(unsigned int)");
+}
+
+
+/*!
+ *  \brief Fill one row per individual of a deme from the fitness objects and trees.
+ *  \param ioDeme Deme of GP individuals with FitnessMCC fitness.
+ *
+ *  Individuals without fitness have all counts zero. The table is not stamped.
+ */
+void GP::FitnessTable::fill(Deme& ioDeme)
+{
+	Beagle_StackTraceBeginM();
+	resize(ioDeme.size());
+	for(unsigned int i=0; i<ioDeme.size(); ++i)
+	{
+		GP::Individual& lIndividual= castObjectT<GP::Individual&>(*ioDeme[i]);
+		if (lIndividual.getFitness() != NULL)
+		{
+			setFitness(i, castObjectT<const GP::FitnessMCC&>(*lIndividual.getFitness()));
+		}
+		else
+		{
+			setCounts(i, 0, 0, 0, 0, 0.0f);
+		}
+		setIndividual(i, lIndividual);
+	}
+	Beagle_StackTraceEndM("void GP::FitnessTable::fill(Deme&)");
+}
+
+
+/*!
+ *  \brief Set the counts and MCC of row inIndex from a fitness object.
+ *  \param inIndex   Row to set.
+ *  \param inFitness Fitness to read.
+ */
+void GP::FitnessTable::setFitness(unsigned int inIndex, const GP::FitnessMCC& inFitness)
+{
+	Beagle_StackTraceBeginM();
+	setCounts(inIndex,
+	          (unsigned int)inFitness.getTruePositives(),
+	          (unsigned int)inFitness.getFalsePositives(),
+	          (unsigned int)inFitness.getTrueNegatives(),
+	          (unsigned int)inFitness.getFalseNegatives(),
+	          inFitness.getValue());
+	Beagle_StackTraceEndM("void GP::FitnessTable::setFitness(unsigned int, const GP::FitnessMCC&)");
+}
+
+
+/*!
+ *  \brief Set the tree size and depth of row inIndex, and tie the row to the individual's evaluation.
+ *  \param inIndex      Row to set.
+ *  \param inIndividual Individual the row stands for.
+ */
+void GP::FitnessTable::setIndividual(unsigned int inIndex, GP::Individual& inIndividual)
+{
+	Beagle_StackTraceBeginM();
+	mTreeSizes[inIndex]= inIndividual.getTotalNodes();
+	mTreeDepths[inIndex]= inIndividual.getMaxTreeDepth();
+	const GP::FitnessMCC* lFitness= dynamic_cast<const GP::FitnessMCC*>(inIndividual.getFitness().getPointer());
+	mSerials[inIndex]= (lFitness == NULL) ? 0 : lFitness->getSerial();
+	Beagle_StackTraceEndM("void GP::FitnessTable::setIndividual(unsigned int, GP::Individual&)");
+}
+
+
+/*!
+ *  \brief Mark the table as filled for a generation and deme.
+ *  \param inGeneration Generation.
+ *  \param inDemeIndex  Index of the deme.
+ */
+void GP::FitnessTable::stamp(unsigned int inGeneration, unsigned int inDemeIndex)
+{
+	Beagle_StackTraceBeginM();
+	mGeneration= inGeneration;
+	mDemeIndex= inDemeIndex;
+	Beagle_StackTraceEndM("void GP::FitnessTable::stamp(unsigned int, unsigned int)");
+}
+
+
+/*!
+ *  \brief Tell whether the table holds the fitness of a deme.
+ *  \param ioDeme       Deme.
+ *  \param inGeneration Generation of the deme.
+ *  \param inDemeIndex  Index of the deme.
+ *  \return True, if the table has been stamped for the generation and deme, and each
+ *          individual of the deme still holds the valid evaluation its row has been filled from.
+ *
+ *  Individuals migrated, replaced, or re-evaluated since the table has been filled
+ *  hold evaluations of other serial numbers, or invalid ones; no counts are read.
+ *  Serial numbers are compared rather than addresses, as FitnessMCC objects are
+ *  pooled and a new fitness may take the address of one released.
+ */
+bool GP::FitnessTable::isCurrent(Deme& ioDeme, unsigned int inGeneration, unsigned int inDemeIndex) const
+{
+	Beagle_StackTraceBeginM();
+	if ((mGeneration != (int)inGeneration) || (mDemeIndex != (int)inDemeIndex)) return false;
+	if (mSerials.size() != ioDeme.size()) return false;
+	for(unsigned int i=0; i<ioDeme.size(); ++i)
+	{
+		const GP::FitnessMCC* lFitness= dynamic_cast<const GP::FitnessMCC*>(ioDeme[i]->getFitness().getPointer());
+		if ((lFitness == NULL) || (mSerials[i] == 0) || (lFitness->getSerial() != mSerials[i]) || !lFitness->isValid()) return false;
+	}
+	return true;
+	Beagle_StackTraceEndM("bool GP::FitnessTable::isCurrent(Deme&, unsigned int, unsigned int) const");
+}
@@ -0,0 +1,136 @@
+#ifndef Beagle_GP_FitnessTable_hpp
+#define Beagle_GP_FitnessTable_hpp
+
+#include "beagle/GP.hpp"
+#include "FitnessMCC.hpp"
+
+#include <vector>
+
+namespace Beagle
+{
+
+namespace GP
+{
+
+/*!
+ *  \class FitnessTable FitnessTable.hpp "FitnessTable.hpp"
+ *  \brief Component holding the MCC fitness and tree size of each individual of a deme, column by column.
+ *  \ingroup GPF
+ *
+ *  Row i of the table stands for individual i of the deme the table has been filled for.
+ *  SharedLibEvalOp fills the counts while scoring and stamps the table with the generation
+ *  and deme; StatsCalcFitnessMCCOp then reads the contiguous columns instead of the
+ *  fitness objects. A row is only trusted while the individual still holds the evaluation
+ *  the row has been filled from, identified by its serial number, see isCurrent.
+ */
+class FitnessTable : public Component
+{
+
+public:
+
+	//! GP::FitnessTable allocator type.
+	typedef AllocatorT<FitnessTable,Component::Alloc>
+	Alloc;
+	//! GP::FitnessTable handle type.
+	typedef PointerT<FitnessTable,Component::Handle>
+	Handle;
+	//! GP::FitnessTable bag type.
+	typedef ContainerT<FitnessTable,Component::Bag>
+	Bag;
+
+	explicit FitnessTable(const std::string& inName=std::string("FitnessTable"));
+	virtual ~FitnessTable()
+	{ }
+
+	void resize(unsigned int inSize);
+	void fill(Deme& ioDeme);
+	void setFitness(unsigned int inIndex, const FitnessMCC& inFitness);
+	void setIndividual(unsigned int inIndex, Individual& inIndividual);
+	void stamp(unsigned int inGeneration, unsigned int inDemeIndex);
+	bool isCurrent(Deme& ioDeme, unsigned int inGeneration, unsigned int inDemeIndex) const;
+
+	/*!
+	 *  \brief Set the counts and MCC of row inIndex.
+	 *
+	 *  The row must exist, see resize.
+	 */
+	inline void setCounts(unsigned int inIndex,
+	                      unsigned int inTruePositives,
+	                      unsigned int inFalsePositives,
+	                      unsigned int inTrueNegatives,
+	                      unsigned int inFalseNegatives,
+	                      float inMCC)
+	{
+		mTruePositives[inIndex]= inTruePositives;
+		mFalsePositives[inIndex]= inFalsePositives;
+		mTrueNegatives[inIndex]= inTrueNegatives;
+		mFalseNegatives[inIndex]= inFalseNegatives;
+		mMCC[inIndex]= inMCC;
+	}
+
+	//! Return the number of rows.
+	inline unsigned int size() const
+	{
+		return mMCC.size();
+	}
+
+	//! Return the MCC of each row.
+	inline const std::vector<float>& getMCC() const
+	{
+		return mMCC;
+	}
+	//! Return the true positives of each row.
+	inline const std::vector<unsigned int>& getTruePositives() const
+	{
+		return mTruePositives;
+	}
+	//! Return the false positives of each row.
+	inline const std::vector<unsigned int>& getFalsePositives() const
+	{
+		return mFalsePositives;
+	}
+	//! Return the true negatives of each row.
+	inline const std::vector<unsigned int>& getTrueNegatives() const
+	{
+		return mTrueNegatives;
+	}
+	//! Return the false negatives of each row.
+	inline const std::vector<unsigned int>& getFalseNegatives() const
+	{
+		return mFalseNegatives;
+	}
+	//! Return the number of nodes of the trees of each row.
+	inline const std::vector<unsigned int>& getTreeSizes() const
+	{
+		return mTreeSizes;
+	}
+	//! Return the maximum tree depth of each row.
+	inline const std::vector<unsigned int>& getTreeDepths() const
+	{
+		return mTreeDepths;
+	}
+
+protected:
+
+	std::vector<float>        mMCC;             //!< MCC of each row.
+	std::vector<unsigned int> mTruePositives;   //!< True positives of each row.
+	std::vector<unsigned int> mFalsePositives;  //!< False positives of each row.
+	std::vector<unsigned int> mTrueNegatives;   //!< True negatives of each row.
+	std::vector<unsigned int> mFalseNegatives;  //!< False negatives of each row.
+	std::vector<unsigned int> mTreeSizes;       //!< Number of nodes of the trees of each row.
+	std::vector<unsigned int> mTreeDepths;      //!< Maximum tree depth of each row.
+
+	//! Serial number of the evaluation each row has been filled from, 0 if none; see FitnessMCC::getSerial.
+	std::vector<unsigned long long> mSerials;
+
+	//! The generation and deme the table has been stamped for, -1 if not stamped.
+	int mGeneration;
+	int mDemeIndex;
+
+};
+
+}
+
+}
+
+#endif // Beagle_GP_FitnessTable_hpp
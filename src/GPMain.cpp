@@ -3,12 +3,18 @@
 #include "HOFSharedLibCompileOp.hpp"
 #include "TrainingSetSamplingOp.hpp"
 #include "SharedLibEvalOp.hpp"
+#include "MultiFidelityEvalOp.hpp"
+#include "EquivalenceCheckOp.hpp"
 #include "DataSetBinaryClassification.hpp"
+#include "FitnessTable.hpp"
+#include "ArtifactCollector.hpp"
+#include "HardwareCounters.hpp"
 #include "LessThan.hpp"
 #include "EqualTo.hpp"
 #include "IfThenElse.hpp"
 #include "EphemeralPercent.hpp"
 #include "TokenDeparserT.hpp"
+#include "HugePageAllocator.hpp"
 
 #include <cstdlib>
 #include <cmath>
@@ -43,11 +49,15 @@ int main(int argc, char *argv[])
     lFactory.insertAllocator("Beagle::GP::SharedLibCompileOp", new GP::SharedLibCompileOp::Alloc);
     lFactory.insertAllocator("Beagle::GP::HOFSharedLibCompileOp", new GP::HOFSharedLibCompileOp::Alloc);
     lFactory.insertAllocator("Beagle::GP::TrainingSetSamplingOp", new GP::TrainingSetSamplingOp::Alloc);
+    lFactory.insertAllocator("Beagle::GP::MultiFidelityEvalOp", new GP::MultiFidelityEvalOp::Alloc);
+    lFactory.insertAllocator("Beagle::GP::EquivalenceCheckOp", new GP::EquivalenceCheckOp::Alloc);
     lFactory.aliasAllocator("Beagle::GP::FitnessMCC", "GP-FitnessMCC");
     lFactory.aliasAllocator("Beagle::GP::StatsCalcFitnessMCCOp", "GP-StatsCalcFitnessMCCOp");
     lFactory.aliasAllocator("Beagle::GP::SharedLibCompileOp", "GP-SharedLibCompileOp");
     lFactory.aliasAllocator("Beagle::GP::HOFSharedLibCompileOp", "GP-HOFSharedLibCompileOp");
     lFactory.aliasAllocator("Beagle::GP::TrainingSetSamplingOp", "GP-TrainingSetSamplingOp");
+    lFactory.aliasAllocator("Beagle::GP::MultiFidelityEvalOp", "GP-MultiFidelityEvalOp");
+    lFactory.aliasAllocator("Beagle::GP::EquivalenceCheckOp", "GP-EquivalenceCheckOp");
 
 		// Register parameter "icu.dataset.path", the file holding training data.
     Register::Description lDescription(
@@ -68,6 +78,27 @@ int main(int argc, char *argv[])
     lDescription.mDescription=  "The number of columns each line in the data file consists of";
 		lSystem->getRegister().insertEntry(std::string("icu.dataset.columns"), new String(""), lDescription);
 
+		// Register parameter "icu.dataset.quantize", the number of levels to bucketize each column into.
+    lDescription.mBrief=        "Quantize data set";
+    lDescription.mType=         "Integer";
+    lDescription.mDescription=  "If greater than 0, bucketize each column into at most this many levels (2 to 65536) by quantiles, and evaluate on 8 bit (up to 256 levels) or 16 bit level codes instead of floats.";
+    lDescription.mDefaultValue= "0";
+		lSystem->getRegister().insertEntry(std::string("icu.dataset.quantize"), new Int(0), lDescription);
+
+		// Register parameter "icu.dataset.sparse-density", the maximum density of columns stored sparsely.
+    lDescription.mBrief=        "Sparse column density";
+    lDescription.mType=         "Float";
+    lDescription.mDescription=  "Index accelerator for the bitmap index (icu.eval.bitmap-index): columns with at most this fraction of nonzero values are stored as lists of their nonzero rows in addition to the dense rows, costing memory; the bitmap index then resolves comparisons for all zero rows at once. The compiled individuals always read the dense rows. 0, the default, disables sparse columns.";
+    lDescription.mDefaultValue= "0";
+		lSystem->getRegister().insertEntry(std::string("icu.dataset.sparse-density"), new Float(0), lDescription);
+
+		// Register parameter "icu.memory.huge-pages", the huge pages large blocks are backed by.
+    lDescription.mBrief=        "Huge pages";
+    lDescription.mType=         "String";
+    lDescription.mDescription=  "Pages backing the level codes of the data set and the training set blocks: 'auto' tries the huge page pool (MAP_HUGETLB), then transparent huge pages (MADV_HUGEPAGE); 'transparent' only tries the latter; 'off' uses normal pages.";
+    lDescription.mDefaultValue= "auto";
+		lSystem->getRegister().insertEntry(std::string("icu.memory.huge-pages"), new String("auto"), lDescription);
+
 		// Add constrained GP package
 		GP::PrimitiveSet::Handle lSet = new GP::PrimitiveSet(&typeid(Bool));
 		lSystem->addPackage(new GP::PackageConstrained(lSet));
@@ -75,10 +106,35 @@ int main(int argc, char *argv[])
 		// Set fitness evaluation operator
 		lSystem->setEvaluationOp("GP-SharedLibEvalOp", new GP::SharedLibEvalOp::Alloc);
 
+		// Components shared by the operators are added before initializing, as the operators
+		// look them up in init and the components register their parameters there.
+
+		// Removes generated sources and libraries in the background, see icu.compiler.keep-generations.
+		lSystem->addComponent(new GP::ArtifactCollector("ArtifactCollector"));
+
+		// Fitness of the deme evaluated last, column by column, shared by the evaluation and statistics operators.
+		lSystem->addComponent(new GP::FitnessTable("FitnessTable"));
+
+		// Hardware events per phase, counted if icu.eval.hw-counters is set; exported with the statistics.
+		lSystem->addComponent(new GP::HardwareCounters("HardwareCounters"));
+
 		// Initialize the evolver
 		Evolver::Handle lEvolver = new Evolver;
 		lEvolver->initialize(lSystem, argc, argv);
 
+		// Back large blocks by huge pages, as requested; report what a block is actually backed by.
+		std::string lHugePages= castHandleT<String>(lSystem->getRegister().getEntry("icu.memory.huge-pages"))->getWrappedValue();
+		HugePages::Mode lHugePagesMode;
+		if (!HugePages::parseMode(lHugePages, lHugePagesMode))
+		{
+			throw Beagle_RunTimeExceptionM("icu.memory.huge-pages: expected 'auto', 'transparent', or 'off', got '"+ lHugePages+ "'.");
+		}
+		HugePages::setMode(lHugePagesMode);
+		HugePages::Outcome lOutcome;
+		HugePages::deallocate(HugePages::allocate(HugePages::getHugePageSize(), &lOutcome), HugePages::getHugePageSize());
+		Beagle_LogInfoM(lSystem->getLogger(), "main", "GPMain",
+			"Huge pages '"+ lHugePages+ "': large blocks are backed by "+ HugePages::describe(lOutcome)+ ".");
+
 		/* Read data set.
 		 * If a CSV file has been specified through 'icu.dataset.path', read that file.
 		 * Otherwise, read from STDIN.
@@ -178,6 +234,37 @@ int main(int argc, char *argv[])
         lSystem->getRegister().modifyEntry("icu.dataset.rows", new Int(lNumberOfRows));
         lSystem->getRegister().modifyEntry("icu.dataset.columns", new Int(lNumberOfColumns));
 
+        // Quantize the data set, if requested.
+        int lQuantize= castHandleT<Int>(lSystem->getRegister().getEntry("icu.dataset.quantize"))->getWrappedValue();
+        if (lQuantize > 0)
+        {
+            if (lQuantize < 2 || lQuantize > 65536)
+            {
+                throw Beagle_RunTimeExceptionM("icu.dataset.quantize: expected 0, or 2 to 65536 levels, got "+ int2str(lQuantize)+ ".");
+            }
+            unsigned int lNrExact= lDataSet->quantize(lQuantize);
+            Beagle_LogInfoM(lSystem->getLogger(), "main", "GPMain",
+                "Data set quantized to at most "+ int2str(lQuantize)+ " levels per column, "+ int2str(lDataSet->getCodeBytes())+
+                " byte(s) per value; "+ int2str(lNrExact)+ " of "+ int2str(lNumberOfColumns)+ " columns quantized exactly.");
+        }
+
+        // Index mostly-zero columns by their nonzero rows, if requested; only the bitmap index reads the lists.
+        float lSparseDensity= castHandleT<Float>(lSystem->getRegister().getEntry("icu.dataset.sparse-density"))->getWrappedValue();
+        bool lBitmapIndex= lSystem->getRegister().isRegistered("icu.eval.bitmap-index") &&
+            castHandleT<Bool>(lSystem->getRegister().getEntry("icu.eval.bitmap-index"))->getWrappedValue();
+        if (lSparseDensity > 0 && !lBitmapIndex)
+        {
+            Beagle_LogInfoM(lSystem->getLogger(), "main", "GPMain",
+                "icu.dataset.sparse-density ignored, as icu.eval.bitmap-index is not set.");
+        }
+        else if (lSparseDensity > 0)
+        {
+            unsigned int lNrSparse= lDataSet->sparsify(lSparseDensity);
+            std::ostringstream lOSS;
+            lOSS << lNrSparse << " of " << lNumberOfColumns << " columns indexed by their nonzero rows, at most " << lSparseDensity << " of their values nonzero.";
+            Beagle_LogInfoM(lSystem->getLogger(), "main", "GPMain", lOSS.str());
+        }
+
 		// Create population
 		Vivarium::Handle lVivarium = new Vivarium;
 
@@ -2,11 +2,34 @@
 #include <cstdio>
 #include <fstream>
 #include "HOFSharedLibCompileOp.hpp"
+#include "ArtifactCollector.hpp"
 #include "SharedLibCompiler.hpp"
+#include "beagle/FitnessSimple.hpp"
 
 using namespace Beagle;
 using namespace GP;
 
+namespace
+{
+
+/*!
+ * 64 bit FNV-1a hash of inString, for naming member objects.
+ */
+std::string hashString(const std::string& inString)
+{
+    unsigned long long lHash= 14695981039346656037ULL;
+    for(std::string::const_iterator lChar=inString.begin(); lChar!=inString.end(); ++lChar)
+    {
+        lHash^= (unsigned char)*lChar;
+        lHash*= 1099511628211ULL;
+    }
+    char lBuffer[17];
+    snprintf(lBuffer, sizeof(lBuffer), "%016llx", lHash);
+    return lBuffer;
+}
+
+}
+
 /*!
  *  \brief Construct a milestone writer operator.
  */
@@ -38,6 +61,34 @@ void HOFSharedLibCompileOp::registerParams(Beagle::System& ioSystem)
         ioSystem.getRegister().insertEntry("icu.compiler.tmp-directory", new String("./tmp"), lDescription);
     }
 
+    // 'icu.compiler.hof-lib-path', the shared library compiled from the hall of fame last.
+    {
+		Register::Description lDescription(
+		    "Hall of fame library",
+		    "String",
+		    "",
+		    "Path of the shared library compiled from the hall of fame last, set by HOFSharedLibCompileOp."
+		);
+        mHOFLibPath= castHandleT<String>(
+            ioSystem.getRegister().insertEntry("icu.compiler.hof-lib-path", new String(""), lDescription));
+    }
+
+    // 'icu.compiler.hof-fused-ensemble', fuse the code of all members into the ensemble kernel.
+    {
+		std::ostringstream lOSS;
+		lOSS << "Compile the code of all members into the ensemble kernel, evaluating subexpressions ";
+		lOSS << "common to several members once per row. gcc then compiles every member again whenever ";
+		lOSS << "the hall of fame changes; otherwise, the kernel calls the member objects compiled before.";
+		Register::Description lDescription(
+		    "Fused ensemble kernel",
+		    "Bool",
+		    "0",
+		    lOSS.str()
+		);
+        mFusedEnsemble= castHandleT<Bool>(
+            ioSystem.getRegister().insertEntry("icu.compiler.hof-fused-ensemble", new Bool(false), lDescription));
+    }
+
 	Beagle_StackTraceEndM("void HOFSharedLibCompileOp::registerParams(Beagle::System&)");
 }
 
@@ -62,21 +113,103 @@ void HOFSharedLibCompileOp::operate(Beagle::Deme& ioDeme, Beagle::Context& ioCon
     int lNrColumns= castHandleT<Int>(ioContext.getSystem().getRegister()["icu.dataset.columns"])->getWrappedValue();
     std::string lTmpDirectory= castHandleT<String>(ioContext.getSystem().getRegister()["icu.compiler.tmp-directory"])->getWrappedValue();
     SharedLibCompiler lSharedLibCompiler(lNrColumns, lTmpDirectory);
+    if (ioContext.getSystem().getRegister().isRegistered("icu.compiler.emit"))
+    {
+        lSharedLibCompiler.setSSA(castHandleT<String>(ioContext.getSystem().getRegister()["icu.compiler.emit"])->getWrappedValue() == "ssa");
+    }
     
-    // Add individuals, compile.
-	std::string lPathLib;
+    // Key each member by its origin and tree; members compiled before are reused.
 	int lIndividualIndex= 0;
-//    for(Beagle::MemberMap::const_iterator lEntry=ioContext.getVivarium().getHallOfFame().begin(); lIndividual!=ioContext.getVivarium().getHallOfFame().end(); ++lEntry)
+	std::vector<std::string> lKeys;
+	std::vector<Beagle::GP::Individual::Handle> lMembers;
+	std::vector<double> lWeights;
     while (lIndividualIndex < lContext.getVivarium().getHallOfFame()->size())
     {
     	Beagle::HallOfFame::Entry lEntry= (*lContext.getVivarium().getHallOfFame())[lIndividualIndex];
         Beagle::GP::Individual::Handle lGPIndividual= castHandleT<Beagle::GP::Individual>(lEntry.mIndividual);
-		lSharedLibCompiler.addIndividual(*lGPIndividual, lEntry.mGeneration, lEntry.mDemeIndex, lIndividualIndex);
+		std::ostringstream lKey;
+		lKey << lEntry.mGeneration << "_" << lEntry.mDemeIndex << "_" << hashString((*lGPIndividual)[0]->deparse());
+		lKeys.push_back(lKey.str());
 		lIndividualIndex++;
+
+		// Weight each member's vote by its MCC.
+		lMembers.push_back(lGPIndividual);
+		double lWeight= 0.0;
+		if (lGPIndividual->getFitness() != NULL && lGPIndividual->getFitness()->isValid())
+		{
+			lWeight= castHandleT<Beagle::FitnessSimple>(lGPIndividual->getFitness())->getValue();
+		}
+		lWeights.push_back(lWeight);
+	}
+
+	// Nothing to do if the hall of fame has not changed since the last library.
+	if (lKeys == mKeys && mHOFLibPath->getWrappedValue().empty() == false)
+	{
+		Beagle_LogDetailedM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::HOFSharedLibCompileOp",
+			"Hall of fame unchanged, keeping "+ mHOFLibPath->getWrappedValue()+ ".");
+		return;
+	}
+
+	// Compile members new to the hall of fame, link all members.
+	std::map<std::string, std::string> lObjects;
+	unsigned int lNrCompiled= 0;
+	for(unsigned int i=0; i<lKeys.size(); ++i)
+	{
+		std::string lFunction= "hof_member_"+ lKeys[i];
+		std::map<std::string, std::string>::const_iterator lCached= mObjects.find(lKeys[i]);
+		if (lCached == mObjects.end())
+		{
+			lObjects[lKeys[i]]= lSharedLibCompiler.compileMember(*lMembers[i], lFunction, "hof_m"+ lKeys[i]);
+			lNrCompiled++;
+		}
+		else
+		{
+			lObjects[lKeys[i]]= lCached->second;
+		}
+		Beagle::HallOfFame::Entry lEntry= (*lContext.getVivarium().getHallOfFame())[i];
+		lSharedLibCompiler.addMember(lFunction, lObjects[lKeys[i]], lEntry.mGeneration, lEntry.mDemeIndex, i);
+	}
+	// Forget members which dropped out of the hall of fame.
+	mObjects.swap(lObjects);
+	mKeys.swap(lKeys);
+
+	// Add a kernel evaluating all members as a voting ensemble; the fused kernel recompiles the code of all members.
+	if (mFusedEnsemble->getWrappedValue())
+	{
+		int lNrSubexpressions= lSharedLibCompiler.addEnsemble(lMembers, lWeights);
+		Beagle_LogDetailedM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::HOFSharedLibCompileOp",
+			"Fused ensemble of "+ int2str(lMembers.size())+ " individuals, "+ int2str(lNrSubexpressions)+ " distinct subexpressions, "+
+			int2str(lNrCompiled)+ " members compiled.");
+	}
+	else
+	{
+		lSharedLibCompiler.addLinkedEnsemble(lWeights);
+		Beagle_LogDetailedM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::HOFSharedLibCompileOp",
+			"Ensemble of "+ int2str(lMembers.size())+ " individuals, "+ int2str(lNrCompiled)+ " members compiled.");
 	}
 	std::ostringstream lLibName;
 	lLibName << "hof_g" << lContext.getGeneration() << "_d" << lContext.getDemeIndex();
-	lPathLib= lSharedLibCompiler.compile(lLibName.str());
+	mHOFLibPath->getWrappedValue()= lSharedLibCompiler.compile(lLibName.str());
+
+	// Keep the latest library and its members, hand the library superseded to the retention policy.
+	ArtifactCollector::Handle lCollector= castHandleT<ArtifactCollector>(ioContext.getSystem().getComponent("ArtifactCollector"));
+	if (lCollector != NULL)
+	{
+		std::vector<std::string> lPinned;
+		lPinned.push_back(lTmpDirectory+ "/"+ lLibName.str()+ ".c");
+		lPinned.push_back(mHOFLibPath->getWrappedValue());
+		for(std::map<std::string, std::string>::const_iterator lObject=mObjects.begin(); lObject!=mObjects.end(); ++lObject)
+		{
+			lPinned.push_back(lObject->second);
+			lPinned.push_back(lObject->second.substr(0, lObject->second.size()- 2)+ ".c");
+		}
+		for(unsigned int i=0; i<lPinned.size(); ++i)
+		{
+			lCollector->add(lPinned[i], lContext.getGeneration());
+		}
+		lCollector->pin("HOFSharedLibCompileOp", lPinned);
+		lCollector->collect(lContext.getGeneration());
+	}
 
 	Beagle_StackTraceEndM("void HOFSharedLibCompileOp::operate(Beagle::Deme& ioDeme, Beagle::Context& ioContext)");
 }
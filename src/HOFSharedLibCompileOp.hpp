@@ -17,6 +17,10 @@
 #include "beagle/Vivarium.hpp"
 #include "beagle/Context.hpp"
 
+#include <map>
+#include <string>
+#include <vector>
+
 namespace Beagle
 {
 
@@ -27,6 +31,17 @@ namespace GP
  *  \class HOFSharedLibCompileOp beagle/HOFSharedLibCompileOp.hpp "beagle/HOFSharedLibCompileOp.hpp"
  *  \brief Compile a shared lib containing all individuals in the Hall of Fame.
  *  \ingroup Op
+ *
+ *  The Hall of Fame changes by a few members per generation at most.
+ *  Each member is therefore compiled once into an object file of its own,
+ *  keyed by the generation and deme it was born in and a hash of its tree;
+ *  only the small unit holding the table of members and the ensemble kernel
+ *  is compiled each time, and linked with the member objects. The ensemble
+ *  kernel calls the member functions; with icu.compiler.hof-fused-ensemble set,
+ *  it holds the code of all members instead, sharing common subexpressions,
+ *  and every member is compiled again whenever the hall of fame changes.
+ *  If the members have not changed since the last generation, the library is not rebuilt at all.
+ *  The path of the current library is published in icu.compiler.hof-lib-path.
  */
 class HOFSharedLibCompileOp : public Operator
 {
@@ -50,6 +65,20 @@ public:
 	virtual void registerParams(Beagle::System& ioSystem);
 	virtual void operate(Beagle::Deme& ioDeme, Beagle::Context& ioContext);
 
+protected:
+
+	//! Path of the library compiled last, published in icu.compiler.hof-lib-path.
+	String::Handle mHOFLibPath;
+
+	//! Whether the ensemble kernel holds the code of all members (icu.compiler.hof-fused-ensemble).
+	Bool::Handle mFusedEnsemble;
+
+	//! Keys of the members of the library compiled last, in Hall of Fame order.
+	std::vector<std::string> mKeys;
+
+	//! Object file compiled for each member key.
+	std::map<std::string, std::string> mObjects;
+
 };
 
 }
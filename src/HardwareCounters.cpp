@@ -0,0 +1,199 @@
+#include "beagle/GP.hpp"
+#include "HardwareCounters.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace Beagle;
+
+namespace
+{
+
+//! Type and configuration of each event, see perf_event_open(2).
+const unsigned int gEventTypes[]= {
+	PERF_TYPE_HARDWARE,
+	PERF_TYPE_HARDWARE,
+	PERF_TYPE_HARDWARE,
+	PERF_TYPE_HW_CACHE,
+	PERF_TYPE_HW_CACHE
+};
+const unsigned long long gEventConfigs[]= {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+	PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+};
+const char* const gEventNames[]= { "cycles", "instructions", "branch-misses", "llc-misses", "dtlb-misses" };
+const char* const gPhaseNames[]= { "compile", "open", "sample", "eval" };
+
+}
+
+
+/*!
+ *  \brief Construct hardware counters, not counting any event until opened.
+ *  \param inName Name of the component.
+ */
+GP::HardwareCounters::HardwareCounters(const std::string& inName) :
+		Component(inName),
+		mNrOpen(0)
+{
+	for(unsigned int e=0; e<eNrEvents; ++e) mFds[e]= -1;
+	reset();
+}
+
+
+/*!
+ *  \brief Close the counters.
+ */
+GP::HardwareCounters::~HardwareCounters()
+{
+	close();
+}
+
+
+/*!
+ *  \brief Open one counter per event for this process and the threads and processes it starts from now on.
+ *  \param outErrors Events not counted, and why, separated by "; ".
+ *  \return True, if any event is counted.
+ *
+ *  Only user space is counted, as most systems allow unprivileged users no more.
+ */
+bool GP::HardwareCounters::open(std::string& outErrors)
+{
+	Beagle_StackTraceBeginM();
+	close();
+	outErrors.clear();
+	for(unsigned int e=0; e<eNrEvents; ++e)
+	{
+#ifdef __NR_perf_event_open
+		struct perf_event_attr lAttributes;
+		memset(&lAttributes, 0, sizeof(lAttributes));
+		lAttributes.size= sizeof(lAttributes);
+		lAttributes.type= gEventTypes[e];
+		lAttributes.config= gEventConfigs[e];
+		lAttributes.read_format= PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		lAttributes.inherit= 1;
+		lAttributes.exclude_kernel= 1;
+		lAttributes.exclude_hv= 1;
+		mFds[e]= syscall(__NR_perf_event_open, &lAttributes, 0, -1, -1, 0);
+		if (mFds[e] < 0)
+		{
+			if (!outErrors.empty()) outErrors+= "; ";
+			outErrors+= std::string(gEventNames[e])+ ": "+ strerror(errno);
+			mFds[e]= -1;
+			continue;
+		}
+		mNrOpen++;
+#else
+		if (e == 0) outErrors= "perf_event_open not supported";
+#endif
+	}
+	reset();
+	return isOpen();
+	Beagle_StackTraceEndM("bool GP::HardwareCounters::open(std::string&)");
+}
+
+
+/*!
+ *  \brief Stop counting.
+ */
+void GP::HardwareCounters::close()
+{
+	Beagle_StackTraceBeginM();
+	for(unsigned int e=0; e<eNrEvents; ++e)
+	{
+		if (mFds[e] >= 0) ::close(mFds[e]);
+		mFds[e]= -1;
+	}
+	mNrOpen= 0;
+	Beagle_StackTraceEndM("void GP::HardwareCounters::close()");
+}
+
+
+/*!
+ *  \brief Mark the start of a phase.
+ *  \param inPhase Phase starting.
+ */
+void GP::HardwareCounters::begin(Phase inPhase)
+{
+	Beagle_StackTraceBeginM();
+	for(unsigned int e=0; e<eNrEvents; ++e)
+	{
+		if (mFds[e] >= 0) read((Event)e, mBegin[inPhase][e]);
+	}
+	Beagle_StackTraceEndM("void GP::HardwareCounters::begin(Phase)");
+}
+
+
+/*!
+ *  \brief Mark the end of a phase, add the events counted since it began to its totals.
+ *  \param inPhase Phase ending.
+ */
+void GP::HardwareCounters::end(Phase inPhase)
+{
+	Beagle_StackTraceBeginM();
+	for(unsigned int e=0; e<eNrEvents; ++e)
+	{
+		Reading lEnd;
+		if (mFds[e] < 0 || !read((Event)e, lEnd)) continue;
+		const Reading& lBegin= mBegin[inPhase][e];
+		unsigned long long lValue= lEnd.mValue- lBegin.mValue;
+		unsigned long long lEnabled= lEnd.mEnabled- lBegin.mEnabled;
+		unsigned long long lRunning= lEnd.mRunning- lBegin.mRunning;
+		if (lRunning > 0 && lRunning < lEnabled)
+		{
+			lValue= (unsigned long long)((double)lValue* lEnabled/ lRunning);
+		}
+		mTotals[inPhase][e]+= lValue;
+	}
+	Beagle_StackTraceEndM("void GP::HardwareCounters::end(Phase)");
+}
+
+
+/*!
+ *  \brief Set the totals of all phases to zero.
+ */
+void GP::HardwareCounters::reset()
+{
+	Beagle_StackTraceBeginM();
+	memset(mBegin, 0, sizeof(mBegin));
+	memset(mTotals, 0, sizeof(mTotals));
+	Beagle_StackTraceEndM("void GP::HardwareCounters::reset()");
+}
+
+
+/*!
+ *  \brief Read the counter of event inEvent.
+ *  \return False, if the counter cannot be read.
+ */
+bool GP::HardwareCounters::read(Event inEvent, Reading& outReading) const
+{
+	unsigned long long lBuffer[3];
+	if (::read(mFds[inEvent], lBuffer, sizeof(lBuffer)) != (ssize_t)sizeof(lBuffer)) return false;
+	outReading.mValue= lBuffer[0];
+	outReading.mEnabled= lBuffer[1];
+	outReading.mRunning= lBuffer[2];
+	return true;
+}
+
+
+/*!
+ *  \brief Return the name of event inEvent, e.g. "cycles".
+ */
+const char* GP::HardwareCounters::getEventName(Event inEvent)
+{
+	return gEventNames[inEvent];
+}
+
+
+/*!
+ *  \brief Return the name of phase inPhase, e.g. "eval".
+ */
+const char* GP::HardwareCounters::getPhaseName(Phase inPhase)
+{
+	return gPhaseNames[inPhase];
+}
@@ -0,0 +1,105 @@
+#ifndef Beagle_GP_HardwareCounters_hpp
+#define Beagle_GP_HardwareCounters_hpp
+
+#include "beagle/GP.hpp"
+
+#include <string>
+#include <vector>
+
+namespace Beagle
+{
+
+namespace GP
+{
+
+/*!
+ *  \class HardwareCounters HardwareCounters.hpp "HardwareCounters.hpp"
+ *  \brief Component counting hardware events per phase of a generation, by perf_event_open.
+ *  \ingroup GPF
+ *
+ *  Once opened, one counter per event counts this process and all threads and child
+ *  processes started afterwards, e.g. the evaluation threads and gcc; the counts of a
+ *  thread or child are added when it exits. begin and end read the counters and add
+ *  the difference to the totals of a phase; counters multiplexed by the kernel are
+ *  scaled by the fraction of time they have been running. Events the kernel refuses,
+ *  e.g. in virtual machines or with a restrictive /proc/sys/kernel/perf_event_paranoid,
+ *  are left out; if none can be opened, begin and end do nothing.
+ *
+ *  SharedLibCompileOp counts the compile phase, SharedLibEvalOp the open, sample, and
+ *  evaluate phases; StatsCalcFitnessMCCOp exports the totals and resets them.
+ */
+class HardwareCounters : public Component
+{
+
+public:
+
+	//! GP::HardwareCounters allocator type.
+	typedef AllocatorT<HardwareCounters,Component::Alloc>
+	Alloc;
+	//! GP::HardwareCounters handle type.
+	typedef PointerT<HardwareCounters,Component::Handle>
+	Handle;
+	//! GP::HardwareCounters bag type.
+	typedef ContainerT<HardwareCounters,Component::Bag>
+	Bag;
+
+	//! Events counted.
+	enum Event { eCycles, eInstructions, eBranchMisses, eLLCMisses, eDTLBMisses, eNrEvents };
+
+	//! Phases of a generation.
+	enum Phase { eCompile, eOpen, eSample, eEvaluate, eNrPhases };
+
+	explicit HardwareCounters(const std::string& inName=std::string("HardwareCounters"));
+	virtual ~HardwareCounters();
+
+	bool open(std::string& outErrors);
+	void close();
+	void begin(Phase inPhase);
+	void end(Phase inPhase);
+	void reset();
+
+	static const char* getEventName(Event inEvent);
+	static const char* getPhaseName(Phase inPhase);
+
+	//! Return true, if any event is counted.
+	inline bool isOpen() const
+	{
+		return mNrOpen > 0;
+	}
+
+	//! Return true, if event inEvent is counted.
+	inline bool isAvailable(Event inEvent) const
+	{
+		return mFds[inEvent] >= 0;
+	}
+
+	//! Return the total of event inEvent in phase inPhase since the last reset.
+	inline unsigned long long getTotal(Phase inPhase, Event inEvent) const
+	{
+		return mTotals[inPhase][inEvent];
+	}
+
+protected:
+
+	//! A reading of a counter: its value, and the time it has been enabled and running.
+	struct Reading
+	{
+		unsigned long long mValue;
+		unsigned long long mEnabled;
+		unsigned long long mRunning;
+	};
+
+	bool read(Event inEvent, Reading& outReading) const;
+
+	int                mFds[eNrEvents];                 //!< Descriptor of each event, -1 if not counted.
+	unsigned int       mNrOpen;                         //!< Number of events counted.
+	Reading            mBegin[eNrPhases][eNrEvents];    //!< Readings at the start of each phase.
+	unsigned long long mTotals[eNrPhases][eNrEvents];   //!< Totals of each phase since the last reset.
+
+};
+
+}
+
+}
+
+#endif // Beagle_GP_HardwareCounters_hpp
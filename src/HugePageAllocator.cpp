@@ -0,0 +1,151 @@
+#include "HugePageAllocator.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+
+HugePages::Mode gMode= HugePages::eAuto;
+size_t gHugePageSize= 0;
+
+/*!
+ * Return inBytes rounded up to a multiple of the huge page size.
+ */
+size_t roundUp(size_t inBytes)
+{
+    size_t lPage= HugePages::getHugePageSize();
+    return (inBytes+ lPage- 1)/ lPage* lPage;
+}
+
+}
+
+/*!
+ * Set the kinds of huge pages blocks allocated from now on are backed by.
+ */
+void HugePages::setMode(Mode inMode)
+{
+    gMode= inMode;
+    getHugePageSize();
+}
+
+HugePages::Mode HugePages::getMode()
+{
+    return gMode;
+}
+
+bool HugePages::parseMode(const std::string& inName, Mode& outMode)
+{
+    if (inName == "off") outMode= eOff;
+    else if (inName == "transparent") outMode= eTransparent;
+    else if (inName == "auto") outMode= eAuto;
+    else return false;
+    return true;
+}
+
+/*!
+ * Read "Hugepagesize:" from /proc/meminfo, once.
+ */
+size_t HugePages::getHugePageSize()
+{
+    if (gHugePageSize != 0) return gHugePageSize;
+    size_t lSize= 2* 1024* 1024;
+    std::ifstream lIFS("/proc/meminfo");
+    std::string lLine;
+    while (std::getline(lIFS, lLine))
+    {
+        if (lLine.compare(0, 13, "Hugepagesize:") == 0)
+        {
+            unsigned long lKB= strtoul(lLine.c_str()+ 13, NULL, 10);
+            if (lKB > 0) lSize= lKB* 1024;
+            break;
+        }
+    }
+    gHugePageSize= lSize;
+    return gHugePageSize;
+}
+
+/*!
+ * Transparent huge pages are used for advised blocks, unless the kernel setting is "never".
+ */
+bool HugePages::isTransparentEnabled()
+{
+    std::ifstream lIFS("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string lLine;
+    if (!std::getline(lIFS, lLine)) return false;
+    return lLine.find("[never]") == std::string::npos;
+}
+
+/*!
+ * Allocate inBytes, from huge pages if the mode allows and the block is large enough.
+ */
+void* HugePages::allocate(size_t inBytes, Outcome* outOutcome)
+{
+    if (outOutcome) *outOutcome= eSmallPages;
+    if (inBytes < getHugePageSize()/ 2)
+    {
+        return ::operator new(inBytes);
+    }
+
+    size_t lBytes= roundUp(inBytes);
+    void* lPointer= MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (gMode == eAuto)
+    {
+        lPointer= mmap(NULL, lBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (lPointer != MAP_FAILED)
+        {
+            if (outOutcome) *outOutcome= eHugeTLBPages;
+            return lPointer;
+        }
+    }
+#endif
+    lPointer= mmap(NULL, lBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lPointer == MAP_FAILED)
+    {
+        throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if (gMode != eOff && madvise(lPointer, lBytes, MADV_HUGEPAGE) == 0 && isTransparentEnabled())
+    {
+        if (outOutcome) *outOutcome= eTransparentPages;
+    }
+#endif
+    return lPointer;
+}
+
+/*!
+ * Release a block allocated by allocate(inBytes).
+ */
+void HugePages::deallocate(void* inPointer, size_t inBytes)
+{
+    if (inPointer == NULL) return;
+    if (inBytes < getHugePageSize()/ 2)
+    {
+        ::operator delete(inPointer);
+        return;
+    }
+    munmap(inPointer, roundUp(inBytes));
+}
+
+std::string HugePages::describe(Outcome inOutcome)
+{
+    std::ostringstream lOSS;
+    switch (inOutcome)
+    {
+        case eHugeTLBPages:
+            lOSS << "huge pages of " << getHugePageSize()/ 1024 << " kB (MAP_HUGETLB)";
+            break;
+        case eTransparentPages:
+            lOSS << "transparent huge pages of " << getHugePageSize()/ 1024 << " kB (MADV_HUGEPAGE)";
+            break;
+        default:
+            lOSS << "normal pages of " << sysconf(_SC_PAGESIZE)/ 1024 << " kB";
+            break;
+    }
+    return lOSS.str();
+}
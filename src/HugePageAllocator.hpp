@@ -0,0 +1,143 @@
+#ifndef HugePageAllocator_hpp
+#define HugePageAllocator_hpp
+
+#include <cstddef>
+#include <new>
+#include <string>
+
+/*!
+ *  \class HugePages HugePageAllocator.hpp "HugePageAllocator.hpp"
+ *  \brief Allocation of large blocks backed by huge pages, to cut TLB misses when sweeping them.
+ *
+ *  Blocks of at least half a huge page are mapped anonymously: from the huge page pool
+ *  (MAP_HUGETLB), if enabled and pages are reserved; otherwise as normal pages advised
+ *  for transparent huge pages (MADV_HUGEPAGE); otherwise as normal pages. Smaller blocks
+ *  are taken from operator new. Whether a block is mapped only depends on its size,
+ *  so blocks are released correctly whatever the mode at the time.
+ */
+class HugePages
+{
+
+public:
+
+    //! Which kinds of huge pages to try.
+    enum Mode
+    {
+        eOff,           //!< Normal pages only.
+        eTransparent,   //!< Transparent huge pages (madvise) only.
+        eAuto           //!< MAP_HUGETLB, falling back to transparent huge pages.
+    };
+
+    //! What a block has been backed by.
+    enum Outcome
+    {
+        eSmallPages,
+        eTransparentPages,
+        eHugeTLBPages
+    };
+
+    static void setMode(Mode inMode);
+    static Mode getMode();
+
+    //! Parse "off", "transparent", or "auto"; false if inName is none of these.
+    static bool parseMode(const std::string& inName, Mode& outMode);
+
+    //! Return the size of a huge page in bytes, from /proc/meminfo; 2 MiB, if not listed.
+    static size_t getHugePageSize();
+
+    //! Return whether transparent huge pages are enabled, from /sys/kernel/mm/transparent_hugepage.
+    static bool isTransparentEnabled();
+
+    /*!
+     * Allocate inBytes; throw std::bad_alloc on failure.
+     * outOutcome, if given, is set to what the block is backed by.
+     */
+    static void* allocate(size_t inBytes, Outcome* outOutcome=NULL);
+
+    //! Release inPointer, allocated by allocate(inBytes).
+    static void deallocate(void* inPointer, size_t inBytes);
+
+    //! Describe inOutcome, with the page size, for the log.
+    static std::string describe(Outcome inOutcome);
+};
+
+/*!
+ *  \class HugePageAllocator HugePageAllocator.hpp "HugePageAllocator.hpp"
+ *  \brief Standard allocator taking its memory from HugePages.
+ */
+template <class T>
+class HugePageAllocator
+{
+
+public:
+
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <class U>
+    struct rebind
+    {
+        typedef HugePageAllocator<U> other;
+    };
+
+    HugePageAllocator()
+    { }
+
+    template <class U>
+    HugePageAllocator(const HugePageAllocator<U>&)
+    { }
+
+    pointer address(reference inValue) const
+    {
+        return &inValue;
+    }
+
+    const_pointer address(const_reference inValue) const
+    {
+        return &inValue;
+    }
+
+    pointer allocate(size_type inCount, const void* =0)
+    {
+        return static_cast<pointer>(HugePages::allocate(inCount* sizeof(T)));
+    }
+
+    void deallocate(pointer inPointer, size_type inCount)
+    {
+        HugePages::deallocate(inPointer, inCount* sizeof(T));
+    }
+
+    size_type max_size() const
+    {
+        return size_type(-1)/ sizeof(T);
+    }
+
+    void construct(pointer inPointer, const T& inValue)
+    {
+        new((void*)inPointer) T(inValue);
+    }
+
+    void destroy(pointer inPointer)
+    {
+        inPointer->~T();
+    }
+};
+
+template <class T, class U>
+inline bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&)
+{
+    return true;
+}
+
+template <class T, class U>
+inline bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&)
+{
+    return false;
+}
+
+#endif // HugePageAllocator_hpp
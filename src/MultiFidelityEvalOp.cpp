@@ -0,0 +1,185 @@
+#include <cmath>
+#include <algorithm>
+
+#include "MultiFidelityEvalOp.hpp"
+
+using namespace Beagle;
+using namespace GP;
+
+namespace
+{
+
+/*!
+ * Order individual indexes by descending MCC, as held by the fitness table.
+ */
+class FitnessGreater
+{
+public:
+    explicit FitnessGreater(const std::vector<float>& inMCC) :
+        mMCC(inMCC)
+    { }
+
+    bool operator()(unsigned int inLeft, unsigned int inRight) const
+    {
+        return mMCC[inLeft] > mMCC[inRight];
+    }
+
+private:
+    const std::vector<float>& mMCC;
+};
+
+/*!
+ * Remove the entries of a hall of fame whose fitness has not been computed on the full training set.
+ */
+void removePartialEntries(HallOfFame& ioHallOfFame)
+{
+    unsigned int lNrKept= 0;
+    for(unsigned int i=0; i<ioHallOfFame.size(); ++i)
+    {
+        const Fitness::Handle& lFitness= ioHallOfFame[i].mIndividual->getFitness();
+        if (lFitness != NULL && castHandleT<FitnessMCC>(lFitness)->getFidelity() < 1.0) continue;
+        if (lNrKept != i) ioHallOfFame[lNrKept]= ioHallOfFame[i];
+        lNrKept++;
+    }
+    ioHallOfFame.resize(lNrKept);
+}
+
+}
+
+/*!
+ *  \brief Construct a new successive halving evaluation operator.
+ *  \param inName Name of the operator.
+ */
+MultiFidelityEvalOp::MultiFidelityEvalOp(std::string inName) :
+    SharedLibEvalOp(inName)
+{
+}
+
+/*!
+ *  \brief Register the parameters of this operator.
+ *  \param ioSystem System to use to initialize the operator.
+ */
+void MultiFidelityEvalOp::registerParams(Beagle::System& ioSystem)
+{
+    Beagle_StackTraceBeginM();
+
+    SharedLibEvalOp::registerParams(ioSystem);
+
+    {
+        FloatArray::Handle lDefault= new FloatArray(3);
+        (*lDefault)[0]= 0.1;
+        (*lDefault)[1]= 0.3;
+        (*lDefault)[2]= 1.0;
+        Register::Description lDescription(
+            "Fidelity levels",
+            "FloatArray",
+            "0.1/0.3/1",
+            "Fractions of the training set individuals are scored on, ascending; the last level is the full training set."
+        );
+        mLevels= castHandleT<FloatArray>(
+            ioSystem.getRegister().insertEntry("icu.fidelity.levels", lDefault, lDescription));
+    }
+
+    {
+        FloatArray::Handle lDefault= new FloatArray(2);
+        (*lDefault)[0]= 0.3;
+        (*lDefault)[1]= 0.5;
+        Register::Description lDescription(
+            "Promotion ratios",
+            "FloatArray",
+            "0.3/0.5",
+            "Fraction of the individuals scored at a fidelity level promoted to the next level."
+        );
+        mPromote= castHandleT<FloatArray>(
+            ioSystem.getRegister().insertEntry("icu.fidelity.promote", lDefault, lDescription));
+    }
+
+    Beagle_StackTraceEndM("void MultiFidelityEvalOp::registerParams(System&)");
+}
+
+/*!
+ *  \brief Score the individuals of a deme by successive halving.
+ *  \param ioDeme Deme to evaluate.
+ *  \param ioContext Evolutionary context.
+ *
+ *  Individuals eliminated at a level keep the fitness computed at that level,
+ *  FitnessMCC::getFidelity tells how much of the training set it is based on.
+ *  Such fitness ranks below any fitness computed at a higher fidelity, see
+ *  FitnessMCC::isLess, and is removed from the halls of fame of the deme and
+ *  the vivarium, so only individuals scored on the full training set are deployed.
+ */
+void MultiFidelityEvalOp::operate(Beagle::Deme& ioDeme, Beagle::Context& ioContext)
+{
+    Beagle_StackTraceBeginM();
+
+    Beagle_ValidateParameterM(mLevels->size() > 0, "icu.fidelity.levels", "at least one fidelity level expected");
+    for(unsigned int i=0; i<mLevels->size(); ++i)
+    {
+        Beagle_ValidateParameterM((*mLevels)[i] > 0.0 && (*mLevels)[i] <= 1.0 && (i == 0 || (*mLevels)[i] > (*mLevels)[i-1]),
+            "icu.fidelity.levels", "levels must be ascending, in (0,1]");
+    }
+    Beagle_ValidateParameterM(mPromote->size() > 0 || mLevels->size() == 1, "icu.fidelity.promote", "at least one promotion ratio expected");
+    for(unsigned int i=0; i<mPromote->size(); ++i)
+    {
+        Beagle_ValidateParameterM((*mPromote)[i] > 0.0 && (*mPromote)[i] <= 1.0, "icu.fidelity.promote", "ratios must lie in (0,1]");
+    }
+
+    GP::Context& lContext= castObjectT<GP::Context&>(ioContext);
+    if (ioDeme.size() == 0) return;
+    prepare(lContext);
+
+    // Collect all individuals to evaluate.
+    std::vector<unsigned int> lCandidates;
+    for(unsigned int i=0; i<ioDeme.size(); ++i)
+    {
+        if ((ioDeme[i]->getFitness() == NULL) || (ioDeme[i]->getFitness()->isValid() == false))
+        {
+            lCandidates.push_back(i);
+        }
+    }
+    mFitnesses.assign(ioDeme.size(), Fitness::Handle(NULL));
+
+    for(unsigned int lLevel=0; lLevel<mLevels->size() && !lCandidates.empty(); ++lLevel)
+    {
+        // The last level is evaluated on the full training set.
+        bool lLast= (lLevel+ 1 == mLevels->size());
+        float lFidelity= lLast ? 1.0 : (*mLevels)[lLevel];
+        unsigned int lNrPositives= lLast ? mNrSamplesPositive : std::max(1u, (unsigned int)ceil(lFidelity* mNrSamplesPositive));
+        unsigned int lNrNegatives= lLast ? mNrSamplesNegative : std::max(1u, (unsigned int)ceil(lFidelity* mNrSamplesNegative));
+        lNrPositives= std::min(lNrPositives, mNrSamplesPositive);
+        lNrNegatives= std::min(lNrNegatives, mNrSamplesNegative);
+
+        this->mTimer.reset();
+        evaluateDeme(ioDeme, lContext, lCandidates, lNrPositives, lNrNegatives);
+        for(std::vector<unsigned int>::const_iterator lIndex=lCandidates.begin(); lIndex!=lCandidates.end(); ++lIndex)
+        {
+            castHandleT<FitnessMCC>(mFitnesses[*lIndex])->setFidelity(lFidelity);
+        }
+
+        std::ostringstream lOSS;
+        lOSS << "g" << lContext.getGeneration() << " d" << lContext.getDemeIndex() << ", fidelity " << lFidelity;
+        lOSS << ": scored " << lCandidates.size() << " individuals on " << lNrPositives << " positive and ";
+        lOSS << lNrNegatives << " negative rows in " << this->mTimer.getValue() << "s.";
+        Beagle_LogDetailedM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::MultiFidelityEvalOp", lOSS.str());
+
+        if (lLast) break;
+
+        // Promote the best individuals to the next level.
+        float lRatio= (*mPromote)[std::min<unsigned int>(lLevel, mPromote->size()- 1)];
+        unsigned int lNrPromoted= std::max(1u, (unsigned int)ceil(lRatio* lCandidates.size()));
+        if (lNrPromoted < lCandidates.size())
+        {
+            std::stable_sort(lCandidates.begin(), lCandidates.end(), FitnessGreater(mFitnessTable->getMCC()));
+            lCandidates.resize(lNrPromoted);
+        }
+    }
+
+    // Let EvaluationOp assign the fitness computed above, update the hall of fame and statistics.
+    SharedLibEvalOp::operate(ioDeme, ioContext);
+
+    // Keep individuals eliminated before the last level out of the halls of fame.
+    if (ioDeme.getHallOfFame() != NULL) removePartialEntries(*ioDeme.getHallOfFame());
+    if (lContext.getVivarium().getHallOfFame() != NULL) removePartialEntries(*lContext.getVivarium().getHallOfFame());
+
+    Beagle_StackTraceEndM("void MultiFidelityEvalOp::operate(Deme&, Context&)");
+}
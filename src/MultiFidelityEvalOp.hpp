@@ -0,0 +1,74 @@
+#ifndef MultiFidelityEvalOp_hpp
+#define MultiFidelityEvalOp_hpp
+
+#include "beagle/GP.hpp"
+#include "SharedLibEvalOp.hpp"
+
+#include <string>
+#include <vector>
+
+namespace Beagle
+{
+
+namespace GP
+{
+
+/*!
+ *  \class MultiFidelityEvalOp MultiFidelityEvalOp.hpp "MultiFidelityEvalOp.hpp"
+ *  \brief Successive halving evaluation operator for shared libraries.
+ *  \ingroup ICU
+ *
+ *  All individuals of a deme are first scored on a small stratified subsample of the
+ *  training set drawn by SharedLibEvalOp (sized by TrainingSetSamplingOp).
+ *  Only the best individuals are promoted and re-scored on progressively larger
+ *  subsamples, up to the full training set (icu.trainingset.size).
+ *  The fidelity an individual has finally been scored at is recorded in its FitnessMCC;
+ *  fitness of a lower fidelity ranks below fitness of a higher one in selection, and
+ *  individuals not scored on the full training set are kept out of the halls of fame.
+ *
+ *  The following parameters are registered:
+ *
+ *  icu.fidelity.levels (FloatArray, 0.1/0.3/1)
+ *    Fractions of the training set used at each level, ascending.
+ *    The last level is always evaluated on the full training set.
+ *
+ *  icu.fidelity.promote (FloatArray, 0.3/0.5)
+ *    Fraction of the individuals scored at level l promoted to level l+1.
+ *    The last value is reused, if fewer ratios than levels minus one are given.
+ */
+class MultiFidelityEvalOp : public SharedLibEvalOp
+{
+
+public:
+
+	//! MultiFidelityEvalOp allocator type.
+	typedef Beagle::AllocatorT<MultiFidelityEvalOp,SharedLibEvalOp::Alloc> Alloc;
+	//!< MultiFidelityEvalOp handle type.
+	typedef Beagle::PointerT<MultiFidelityEvalOp,SharedLibEvalOp::Handle> Handle;
+	//!< MultiFidelityEvalOp bag type.
+	typedef Beagle::ContainerT<MultiFidelityEvalOp,SharedLibEvalOp::Bag> Bag;
+
+	explicit MultiFidelityEvalOp(std::string inName="MultiFidelityEvalOp");
+	virtual ~MultiFidelityEvalOp()
+	{ }
+
+	virtual void registerParams(Beagle::System& ioSystem);
+
+	/*!
+	 * Score all individuals with invalid fitness by successive halving,
+	 * then hand over to EvaluationOp::operate for the bookkeeping.
+	 */
+	virtual void operate(Beagle::Deme& ioDeme, Beagle::Context& ioContext);
+
+protected:
+
+	FloatArray::Handle mLevels;
+	FloatArray::Handle mPromote;
+
+};
+
+}
+
+}
+
+#endif // MultiFidelityEvalOp_hpp
@@ -0,0 +1,125 @@
+#include "NumaTopology.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+/*!
+ * Construct the topology of this machine.
+ */
+NumaTopology::NumaTopology()
+{
+    detect();
+}
+
+/*!
+ * Read the CPUs of each node from /sys/devices/system/node/node<N>/cpulist.
+ */
+void NumaTopology::detect()
+{
+    mNodes.clear();
+    std::vector< std::pair<int, std::vector<int> > > lNodes;
+    DIR* lDir= opendir("/sys/devices/system/node");
+    if (lDir)
+    {
+        for(struct dirent* lEntry=readdir(lDir); lEntry!=NULL; lEntry=readdir(lDir))
+        {
+            std::string lName(lEntry->d_name);
+            if (lName.size() <= 4 || lName.compare(0, 4, "node") != 0 ||
+                lName.find_first_not_of("0123456789", 4) != std::string::npos)
+            {
+                continue;
+            }
+            std::ifstream lIFS(("/sys/devices/system/node/"+ lName+ "/cpulist").c_str());
+            std::string lList;
+            std::getline(lIFS, lList);
+            std::vector<int> lCpus= parseCpuList(lList);
+            if (!lCpus.empty())
+            {
+                lNodes.push_back(std::make_pair(atoi(lName.c_str()+ 4), lCpus));
+            }
+        }
+        closedir(lDir);
+    }
+    std::sort(lNodes.begin(), lNodes.end());
+    for(unsigned int i=0; i<lNodes.size(); ++i)
+    {
+        mNodes.push_back(lNodes[i].second);
+    }
+
+    if (mNodes.empty())
+    {
+        long lNrCpus= sysconf(_SC_NPROCESSORS_ONLN);
+        mNodes.resize(1);
+        for(long i=0; i<std::max(1L, lNrCpus); ++i)
+        {
+            mNodes[0].push_back(i);
+        }
+    }
+}
+
+/*!
+ * Return the total number of CPUs over all nodes.
+ */
+unsigned int NumaTopology::getNrCpus() const
+{
+    unsigned int lNrCpus= 0;
+    for(unsigned int i=0; i<mNodes.size(); ++i)
+    {
+        lNrCpus+= mNodes[i].size();
+    }
+    return lNrCpus;
+}
+
+/*!
+ * Pin the calling thread to the CPUs inCpus.
+ */
+bool NumaTopology::pin(const std::vector<int>& inCpus)
+{
+    cpu_set_t lSet;
+    CPU_ZERO(&lSet);
+    for(unsigned int i=0; i<inCpus.size(); ++i)
+    {
+        if (inCpus[i] >= 0 && inCpus[i] < CPU_SETSIZE) CPU_SET(inCpus[i], &lSet);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(lSet), &lSet) == 0;
+}
+
+/*!
+ * Parse a comma separated list of CPUs and CPU ranges; malformed entries are skipped.
+ */
+std::vector<int> NumaTopology::parseCpuList(const std::string& inList)
+{
+    std::vector<int> lCpus;
+    const char* lPos= inList.c_str();
+    while (*lPos)
+    {
+        char* lEnd= 0;
+        long lFirst= strtol(lPos, &lEnd, 10);
+        if (lEnd == lPos)
+        {
+            ++lPos;
+            continue;
+        }
+        long lLast= lFirst;
+        lPos= lEnd;
+        if (*lPos == '-')
+        {
+            lLast= strtol(lPos+ 1, &lEnd, 10);
+            if (lEnd == lPos+ 1) lLast= lFirst;
+            lPos= lEnd;
+        }
+        for(long i=lFirst; i<=lLast; ++i)
+        {
+            lCpus.push_back(i);
+        }
+    }
+    std::sort(lCpus.begin(), lCpus.end());
+    lCpus.erase(std::unique(lCpus.begin(), lCpus.end()), lCpus.end());
+    return lCpus;
+}
@@ -0,0 +1,55 @@
+#ifndef NumaTopology_hpp
+#define NumaTopology_hpp
+
+#include <string>
+#include <vector>
+
+/*!
+ *  \class NumaTopology NumaTopology.hpp "NumaTopology.hpp"
+ *  \brief NUMA nodes of the machine and the CPUs of each, read from /sys/devices/system/node.
+ *
+ *  Nodes without CPUs are left out. If /sys does not list any node, e.g. on kernels
+ *  built without NUMA support, all online CPUs are taken to form a single node.
+ */
+class NumaTopology
+{
+
+public:
+
+    NumaTopology();
+
+    //! Read the topology from /sys again.
+    void detect();
+
+    //! Return the number of nodes with CPUs, at least 1.
+    unsigned int getNrNodes() const
+    {
+        return mNodes.size();
+    }
+
+    //! Return the CPUs of node inNode, ascending.
+    const std::vector<int>& getCpus(unsigned int inNode) const
+    {
+        return mNodes[inNode];
+    }
+
+    //! Return the total number of CPUs.
+    unsigned int getNrCpus() const;
+
+    /*!
+     * Pin the calling thread to the CPUs inCpus; false, if the kernel refuses.
+     */
+    static bool pin(const std::vector<int>& inCpus);
+
+    /*!
+     * Parse a CPU list as found in /sys, e.g. "0-3,8-11", into CPU numbers.
+     */
+    static std::vector<int> parseCpuList(const std::string& inList);
+
+protected:
+
+    //! Per node with CPUs, the CPUs.
+    std::vector< std::vector<int> > mNodes;
+};
+
+#endif // NumaTopology_hpp
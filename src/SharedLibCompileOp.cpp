@@ -1,4 +1,10 @@
 #include "SharedLibCompileOp.hpp"
+#include "ArtifactCollector.hpp"
+#include "HardwareCounters.hpp"
+
+#include <cstdlib>
+#include <set>
+#include <unistd.h>
 
 using namespace Beagle;
 using namespace GP;
@@ -7,7 +13,9 @@ using namespace GP;
  *
  */
 SharedLibCompileOp::SharedLibCompileOp() : 
-    Operator("SharedLibCompileOp")
+    Operator("SharedLibCompileOp"),
+    mSharedLibCompiler(0),
+    mSharedLibCompilerExact(0)
 {
 }
 
@@ -16,6 +24,19 @@ SharedLibCompileOp::SharedLibCompileOp() :
  */
 SharedLibCompileOp::~SharedLibCompileOp()
 {
+    closeLibraryFds();
+}
+
+/*!
+ *  \brief Close the descriptors of the libraries compiled in memory so far.
+ */
+void SharedLibCompileOp::closeLibraryFds()
+{
+    for(std::vector<int>::const_iterator lFd=mLibraryFds.begin(); lFd!=mLibraryFds.end(); ++lFd)
+    {
+        close(*lFd);
+    }
+    mLibraryFds.clear();
 }
 
 /*!
@@ -37,24 +58,126 @@ void SharedLibCompileOp::operate(Beagle::Deme& ioDeme, Beagle::Context& ioContex
     */
     Beagle::GP::Context lContext= Beagle::castObjectT<Beagle::GP::Context&>(ioContext);
 
-	// Create a SharedLibCompiler.
+    // Count hardware events while compiling, gcc included, if SharedLibEvalOp has opened the counters.
+    HardwareCounters::Handle lCounters= castHandleT<HardwareCounters>(ioContext.getSystem().getComponent("HardwareCounters"));
+    if (lCounters != NULL) lCounters->begin(HardwareCounters::eCompile);
+
+	// Reset the SharedLibCompilers for this deme.
     int lNrColumns= castHandleT<Int>(ioContext.getSystem().getRegister()["icu.dataset.columns"])->getWrappedValue();
     std::string lTmpDirectory= castHandleT<String>(ioContext.getSystem().getRegister()["icu.compiler.tmp-directory"])->getWrappedValue();
-    SharedLibCompiler lSharedLibCompiler(lNrColumns, lTmpDirectory);
+    std::string lMath= castHandleT<String>(ioContext.getSystem().getRegister()["icu.compiler.math"])->getWrappedValue();
+    Beagle_ValidateParameterM(lMath == "exact" || lMath == "fast", "icu.compiler.math", "expected 'exact' or 'fast'");
+    bool lVerify= (lMath == "fast") && castHandleT<Bool>(ioContext.getSystem().getRegister()["icu.compiler.math-verify"])->getWrappedValue();
+    std::string lEmit= castHandleT<String>(ioContext.getSystem().getRegister()["icu.compiler.emit"])->getWrappedValue();
+    Beagle_ValidateParameterM(lEmit == "expr" || lEmit == "ssa", "icu.compiler.emit", "expected 'expr' or 'ssa'");
+    mSharedLibCompiler.reset(lNrColumns, lTmpDirectory);
+    mSharedLibCompiler.setFastMath(lMath == "fast");
+    mSharedLibCompiler.setSSA(lEmit == "ssa");
+    mSharedLibCompilerExact.reset(lNrColumns, lTmpDirectory);
+    mSharedLibCompilerExact.setSSA(lEmit == "ssa");
+    bool lInMemory= castHandleT<Bool>(ioContext.getSystem().getRegister()["icu.compiler.in-memory"])->getWrappedValue();
+    bool lKeepSource= castHandleT<Bool>(ioContext.getSystem().getRegister()["icu.compiler.keep-source"])->getWrappedValue();
+    mSharedLibCompiler.setInMemory(lInMemory, lKeepSource);
+    mSharedLibCompilerExact.setInMemory(lInMemory, lKeepSource);
+
+    // Compile for level codes, if the data set has been quantized.
+    DataSetBinaryClassification::Handle lDataSet= castHandleT<DataSetBinaryClassification>(ioContext.getSystem().getComponent("DataSet"));
+    if (lDataSet->isQuantized())
+    {
+        mSharedLibCompiler.setQuantization(lDataSet);
+        mSharedLibCompilerExact.setQuantization(lDataSet);
+    }
+
+    // Find the columns referenced by the deme; only these will be packed into the training set.
+    UIntArray::Handle lColumns= new UIntArray;
+    if (castHandleT<Bool>(ioContext.getSystem().getRegister()["icu.compiler.prune-columns"])->getWrappedValue())
+    {
+        std::set<unsigned int> lUsed;
+        for(Beagle::Deme::const_iterator lIndividual=ioDeme.begin(); lIndividual!=ioDeme.end(); ++lIndividual)
+        {
+            Beagle::GP::Individual::Handle lGPIndividual= castHandleT<Beagle::GP::Individual>(*lIndividual);
+            for(unsigned int i=0; i<lGPIndividual->size(); ++i)
+            {
+                Beagle::GP::Tree& lTree= *(*lGPIndividual)[i];
+                for(unsigned int j=0; j<lTree.size(); ++j)
+                {
+                    const std::string& lName= lTree[j].mPrimitive->getName();
+                    if (lName.size() > 2 && lName.compare(0, 2, "IN") == 0 && lTree[j].mPrimitive->getNumberArguments() == 0)
+                    {
+                        lUsed.insert(atoi(lName.c_str()+ 2));
+                    }
+                }
+            }
+        }
+        // Keep one column, should no tree reference any.
+        if (lUsed.empty()) lUsed.insert(0);
+        lColumns->assign(lUsed.begin(), lUsed.end());
+
+        std::vector<unsigned int> lPacked(lUsed.begin(), lUsed.end());
+        mSharedLibCompiler.setColumns(lPacked);
+        mSharedLibCompilerExact.setColumns(lPacked);
+
+        std::ostringstream lOSS;
+        lOSS << "g" << lContext.getGeneration() << " d" << lContext.getDemeIndex() << ": ";
+        lOSS << lPacked.size() << " of " << lNrColumns << " columns referenced.";
+        Beagle_LogDetailedM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::SharedLibCompileOp", lOSS.str());
+    }
+    lContext.getSystem().getRegister().modifyEntry("icu.compiler.columns", lColumns);
     
     // Add individuals, compile.
     for(Beagle::Deme::const_iterator lIndividual=ioDeme.begin(); lIndividual!=ioDeme.end(); ++lIndividual)
     {
         Beagle::GP::Individual::Handle lGPIndividual= castHandleT<Beagle::GP::Individual>(*lIndividual);
-		lSharedLibCompiler.addIndividual(*lGPIndividual, lContext.getGeneration(), lContext.getDemeIndex(), lIndividual- ioDeme.begin());
+		mSharedLibCompiler.addIndividual(*lGPIndividual, lContext.getGeneration(), lContext.getDemeIndex(), lIndividual- ioDeme.begin());
+		if (lVerify)
+		{
+			mSharedLibCompilerExact.addIndividual(*lGPIndividual, lContext.getGeneration(), lContext.getDemeIndex(), lIndividual- ioDeme.begin());
+		}
 	}
 	std::ostringstream lLibName;
 	lLibName << "g" << lContext.getGeneration() << "_d" << lContext.getDemeIndex();
-	lPathLib= lSharedLibCompiler.compile(lLibName.str());
+	lPathLib= mSharedLibCompiler.compile(lLibName.str());
 
     // Update register with the path of the newly compiled library.
     lContext.getSystem().getRegister().modifyEntry("icu.compiler.lib-path", new String(lPathLib));
 
+    // Compile the same individuals in exact mode, for verifying the fast library.
+    std::string lPathLibExact;
+    if (lVerify)
+    {
+        lPathLibExact= mSharedLibCompilerExact.compile(lLibName.str()+ "_exact");
+    }
+    lContext.getSystem().getRegister().modifyEntry("icu.compiler.lib-path-exact", new String(lPathLibExact));
+
+    if (lCounters != NULL) lCounters->end(HardwareCounters::eCompile);
+
+    // Hand the files generated to the retention policy.
+    ArtifactCollector::Handle lCollector= castHandleT<ArtifactCollector>(ioContext.getSystem().getComponent("ArtifactCollector"));
+    if (lCollector != NULL)
+    {
+        lCollector->add(lTmpDirectory+ "/"+ lLibName.str()+ ".c", lContext.getGeneration());
+        lCollector->add(lPathLib, lContext.getGeneration());
+        if (lVerify)
+        {
+            lCollector->add(lTmpDirectory+ "/"+ lLibName.str()+ "_exact.c", lContext.getGeneration());
+            lCollector->add(lPathLibExact, lContext.getGeneration());
+        }
+        lCollector->collect(lContext.getGeneration());
+        unsigned int lNrFiles= 0;
+        unsigned long long lNrBytes= 0;
+        lCollector->getTotals(lNrFiles, lNrBytes);
+        std::ostringstream lOSS;
+        lOSS << lNrFiles << " generated files, " << lNrBytes << " bytes removed so far.";
+        Beagle_LogDetailedM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::SharedLibCompileOp", lOSS.str());
+    }
+
+    // The libraries of the previous deme have been opened by now, their memory files are no longer needed.
+    closeLibraryFds();
+    int lFd= mSharedLibCompiler.takeLibraryFd();
+    if (lFd >= 0) mLibraryFds.push_back(lFd);
+    lFd= mSharedLibCompilerExact.takeLibraryFd();
+    if (lFd >= 0) mLibraryFds.push_back(lFd);
+
     Beagle_StackTraceEndM("void SharedLibCompileOp::operate(Deme& ioDeme, Context& ioContext)");
 }
 
@@ -107,6 +230,111 @@ void SharedLibCompileOp::registerParams(Beagle::System& ioSystem)
 		);
         ioSystem.getRegister().insertEntry("icu.compiler.lib-path", new String(""), lDescription);
     }
+
+    // 'icu.compiler.prune-columns', pack only the columns referenced by the deme.
+    {
+		std::ostringstream lOSS;
+		lOSS << "Pack only the columns referenced by the individuals of the deme into the training set, ";
+		lOSS << "compile individuals for rows of these columns.";
+		Register::Description lDescription(
+		    "Prune columns",
+		    "Bool",
+		    "1",
+		    lOSS.str()
+		);
+        ioSystem.getRegister().insertEntry("icu.compiler.prune-columns", new Bool(true), lDescription);
+    }
+
+    // 'icu.compiler.columns', the columns the current library has been compiled for.
+    {
+		Register::Description lDescription(
+		    "Columns packed",
+		    "UIntArray",
+		    "",
+		    "The columns, ascending, the library for the current generation and deme has been compiled for; empty for all columns."
+		);
+        ioSystem.getRegister().insertEntry("icu.compiler.columns", new UIntArray, lDescription);
+    }
+
+    // 'icu.compiler.math', how to compile the transcendental primitives.
+    {
+		std::ostringstream lOSS;
+		lOSS << "Compile EXP, LOG, SIN, and COS to calls of libm ('exact'), or to inlined ";
+		lOSS << "polynomial approximations ('fast'); the hall of fame is always compiled exactly.";
+		Register::Description lDescription(
+		    "Math mode",
+		    "String",
+		    "exact",
+		    lOSS.str()
+		);
+        ioSystem.getRegister().insertEntry("icu.compiler.math", new String("exact"), lDescription);
+    }
+
+    // 'icu.compiler.math-verify', compare fast math against exact math.
+    {
+		std::ostringstream lOSS;
+		lOSS << "In fast math mode, compile each deme in exact mode as well and ";
+		lOSS << "report the number of predictions on the training set differing between both.";
+		Register::Description lDescription(
+		    "Verify fast math",
+		    "Bool",
+		    "0",
+		    lOSS.str()
+		);
+        ioSystem.getRegister().insertEntry("icu.compiler.math-verify", new Bool(false), lDescription);
+    }
+
+    // 'icu.compiler.emit', how to emit the C code of each individual.
+    {
+		std::ostringstream lOSS;
+		lOSS << "Emit each individual as one nested expression ('expr'), or as a sequence of ";
+		lOSS << "temporaries, one per primitive, children first ('ssa'). The C code emitted in 'ssa' ";
+		lOSS << "mode stays flat for trees of any depth; gcc compiles it in time roughly linear in the number of nodes.";
+		Register::Description lDescription(
+		    "Emission mode",
+		    "String",
+		    "expr",
+		    lOSS.str()
+		);
+        ioSystem.getRegister().insertEntry("icu.compiler.emit", new String("expr"), lDescription);
+    }
+
+    // 'icu.compiler.in-memory', compile without writing to the tmp directory.
+    {
+		std::ostringstream lOSS;
+		lOSS << "Stream the source of each library to gcc over a pipe and have gcc write the library ";
+		lOSS << "into a memory file (memfd_create), opened from /proc/self/fd; nothing is written to ";
+		lOSS << "icu.compiler.tmp-directory. Libraries are compiled on disk where memory files are not supported.";
+		Register::Description lDescription(
+		    "Compile in memory",
+		    "Bool",
+		    "0",
+		    lOSS.str()
+		);
+        ioSystem.getRegister().insertEntry("icu.compiler.in-memory", new Bool(false), lDescription);
+    }
+
+    // 'icu.compiler.keep-source', write the source of libraries compiled in memory, for debugging.
+    {
+		Register::Description lDescription(
+		    "Keep source",
+		    "Bool",
+		    "0",
+		    "If icu.compiler.in-memory is set, write the source of each library to icu.compiler.tmp-directory as well, for debugging."
+		);
+        ioSystem.getRegister().insertEntry("icu.compiler.keep-source", new Bool(false), lDescription);
+    }
+
+    // 'icu.compiler.lib-path-exact', the library compiled in exact mode for verification.
+    {
+		Register::Description lDescription(
+		    "Path to exact shared library for current generation and deme",
+		    "String",
+		    "",
+		    "Path to the library compiled in exact mode, if icu.compiler.math-verify is set; empty otherwise."
+		);
+        ioSystem.getRegister().insertEntry("icu.compiler.lib-path-exact", new String(""), lDescription);
+    }
         
     Beagle_StackTraceEndM("void SharedLibCompileOp::registerParams(System&)");
 }
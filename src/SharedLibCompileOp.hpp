@@ -17,6 +17,23 @@ namespace GP
  *  \class SharedLibCompiler beagle/GP/SharedLibCompiler.hpp "beagle/GP/SharedLibCompiler.hpp"
  *  \brief Compile a shared library for evaluating the fitness of each individual in deme specified.
  *  \ingroup Op
+ *
+ *  With icu.compiler.math set to 'fast', EXP, LOG, SIN, and COS are compiled to
+ *  polynomial approximations (see SharedLibRuntime.hpp). If icu.compiler.math-verify
+ *  is set as well, a second library is compiled in exact mode, its path is stored
+ *  in icu.compiler.lib-path-exact; SharedLibEvalOp then reports how many predictions differ.
+ *
+ *  If the data set has been quantized (icu.dataset.quantize), the library is compiled
+ *  for the rows of level codes SharedLibEvalOp packs; see SharedLibCompiler::setQuantization.
+ *
+ *  With icu.compiler.emit set to 'ssa', each individual is emitted as a sequence of
+ *  three-address temporaries instead of one nested expression; see SharedLibCompiler::setSSA.
+ *
+ *  With icu.compiler.in-memory set, libraries are compiled into memory files and
+ *  published as /proc/self/fd/N; they stay open until the next deme has been compiled.
+ *
+ *  If icu.compiler.prune-columns is set, only the columns referenced by the deme are
+ *  packed into the training set; they are published in icu.compiler.columns.
  */
 class SharedLibCompileOp : public Beagle::Operator
 {
@@ -58,6 +75,17 @@ public:
 //	virtual void readWithSystem(PACC::XML::ConstIterator inIter, System& ioSystem);
 //	virtual void write(PACC::XML::Streamer& ioStreamer, bool inIndent=true) const;
 
+protected:
+
+	void closeLibraryFds();
+
+	//! Descriptors of the libraries compiled in memory for the current deme, see icu.compiler.in-memory.
+	std::vector<int> mLibraryFds;
+	//! Compiler of each deme's library, reset per deme; its code buffer keeps the capacity of the demes before.
+	SharedLibCompiler mSharedLibCompiler;
+	//! Compiler of each deme's library in exact mode, see icu.compiler.math-verify.
+	SharedLibCompiler mSharedLibCompilerExact;
+
 };
 
 }
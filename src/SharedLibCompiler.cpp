@@ -1,16 +1,88 @@
 #include "SharedLibCompiler.hpp"
+#include "SharedLibRuntime.hpp"
 #include "beagle/FitnessSimple.hpp"
 #include "FitnessMCC.hpp"
 
+#include <algorithm>
+#include <cstdarg>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+
+/*!
+ * Append the printf-style formatted iFormat to ioCode.
+ */
+void appendf(std::string& ioCode, const char* iFormat, ...)
+{
+    char lBuffer[256];
+    va_list lArguments;
+    va_start(lArguments, iFormat);
+    int lLength= vsnprintf(lBuffer, sizeof(lBuffer), iFormat, lArguments);
+    va_end(lArguments);
+    if (lLength < 0) return;
+    if ((size_t)lLength < sizeof(lBuffer))
+    {
+        ioCode.append(lBuffer, lLength);
+        return;
+    }
+    std::vector<char> lLarge(lLength+ 1);
+    va_start(lArguments, iFormat);
+    vsnprintf(&lLarge[0], lLarge.size(), iFormat, lArguments);
+    va_end(lArguments);
+    ioCode.append(&lLarge[0], lLength);
+}
+
+}
+
 /*!
  * ioTmpDirectory  The directory in which all files generated will be placed.
  * iNrColumns      The number of columns in the dataset.
  *                 A macro for accessing each column in the dataset must be generated dynamically.
  */
 SharedLibCompiler::SharedLibCompiler(int iNrColumns, std::string iTmpDirectory) :
-    mTmpDirectory(iTmpDirectory)
+    mTmpDirectory(iTmpDirectory),
+    mFastMath(false),
+    mSSA(false),
+    mInMemory(false),
+    mKeepSource(false),
+    mLibraryFd(-1),
+    mQuantization(NULL)
+{
+    mNrColumns= iNrColumns;
+}
+
+/*!
+ * Set the number of columns and the tmp directory, all other settings back to their defaults,
+ * and remove the individuals left, should the last library not have been compiled.
+ * The descriptor of the library compiled in memory last is closed, if not taken.
+ */
+void SharedLibCompiler::reset(int iNrColumns, std::string iTmpDirectory)
 {
+    if (mLibraryFd >= 0)
+    {
+        close(mLibraryFd);
+        mLibraryFd= -1;
+    }
     mNrColumns= iNrColumns;
+    mTmpDirectory= iTmpDirectory;
+    mFastMath= false;
+    mSSA= false;
+    mInMemory= false;
+    mKeepSource= false;
+    mQuantization= NULL;
+    mColumns.clear();
+    mCode.clear();
+    mNames.clear();
+    mFunctions.clear();
+    mObjects.clear();
+    mEnsemble.clear();
+    mQuantizedColumns.clear();
 }
 
 /*!
@@ -38,13 +110,11 @@ SharedLibCompiler::SharedLibCompiler(int iNrColumns, std::string iTmpDirectory)
  */
 int SharedLibCompiler::addIndividual(Beagle::GP::Individual& ioIndividual, int iGeneration, int iDemeIndex, int iIndividualIndex)
 {
-    std::ostringstream lCode;
-    lCode << "// Generation " << iGeneration << ", deme " << iDemeIndex;
-    lCode << ", individual " << iIndividualIndex << std::endl;
+    appendf(mCode, "// Generation %d, deme %d, individual %d\n", iGeneration, iDemeIndex, iIndividualIndex);
     if (ioIndividual.getFitness() != NULL && ioIndividual.getFitness()->isValid())
     {
         Beagle::FitnessSimple::Handle lFitness= Beagle::castHandleT<Beagle::FitnessSimple>(ioIndividual.getFitness());
-        lCode << "// " << lFitness->getType() << ": " << lFitness->getValue() << std::endl;
+        appendf(mCode, "// %s: %g\n", lFitness->getType().c_str(), (double)lFitness->getValue());
 // FIXME: all values (tp/fp/fn/tp) are always 0! problem with casting?
 //        if (lFitness->getType() == "GP-FitnessMCC")
 //        {
@@ -53,15 +123,261 @@ int SharedLibCompiler::addIndividual(Beagle::GP::Individual& ioIndividual, int i
 //            lCode << "/" << lMCC->getFalseNegatives() << "/" << lMCC->getTrueNegatives() << std::endl;
 //        }
     }
-    lCode << "int apply_individual_";
-    lCode << iGeneration << "_" << iDemeIndex << "_" << iIndividualIndex << "(float in[])" << std::endl;
+    char lName[64];
+    snprintf(lName, sizeof(lName), "apply_individual_%d_%d_%d", iGeneration, iDemeIndex, iIndividualIndex);
+    if (mQuantization != NULL)
+    {
+        std::string lBody;
+        appendf(mCode, "int %s(float in_[])\n{\n    const fgp_code_t* in= (const fgp_code_t*)in_;\n", lName);
+        std::string lRoot= emitQuantized(*ioIndividual[0], lBody);
+        mCode+= lBody;
+        mCode+= "    return ";
+        mCode+= lRoot;
+    }
+    else if (mSSA)
+    {
+        std::string lBody;
+        appendf(mCode, "int %s(float in[])\n{\n", lName);
+        std::string lRoot= emitExpression(*ioIndividual[0], lBody);
+        mCode+= lBody;
+        mCode+= "    return ";
+        mCode+= lRoot;
+    }
+    else
+    {
+        // The expression is generated into the code buffer directly.
+        appendf(mCode, "int %s(float in[])\n{\n    return ", lName);
+        appendExpression(*ioIndividual[0], mCode);
+    }
+    mCode+= ";\n}\n\n";
+
+    mNames.push_back(lName);
+    mFunctions.push_back(lName);
+    
+    return mNames.size();
+}
+
+/*!
+ * Compile ioIndividual on its own into the object file <iObjectName>.o.
+ *
+ * The object file is placed in the tmp directory, next to its source <iObjectName>.c.
+ * An object file of that name is always replaced, never reused: it may be left by an
+ * earlier run, or be removed concurrently by the ArtifactCollector; callers cache the
+ * paths returned instead. gcc writes to a temporary name first, renamed once complete,
+ * so the object file is never seen truncated.
+ *
+ */
+std::string SharedLibCompiler::compileMember(Beagle::GP::Individual& ioIndividual, std::string iFunctionName, std::string iObjectName)
+{
+    std::ostringstream lPathSource;
+    std::ostringstream lPathObject;
+    std::ostringstream lPathPartial;
+    std::ostringstream lCompile;
+
+    lPathSource << mTmpDirectory << "/" << iObjectName << ".c";
+    lPathObject << mTmpDirectory << "/" << iObjectName << ".o";
+    lPathPartial << mTmpDirectory << "/" << iObjectName << ".o.partial";
+    lCompile << "gcc -c -fPIC " << (mFastMath ? "-O3 " : "") << "-o " << lPathPartial.str() << " " << lPathSource.str();
+
+    std::ofstream lOFS(lPathSource.str().c_str());
+    writeHeader(lOFS);
+    std::string lBody;
+    std::string lRoot= emitExpression(*ioIndividual[0], lBody);
+    lOFS << "int " << iFunctionName << "(float in[])" << std::endl;
+    lOFS << "{" << std::endl;
+    lOFS << lBody;
+    lOFS << "    return " << lRoot << ";" << std::endl;
+    lOFS << "}" << std::endl;
+    lOFS.close();
+
+    if (system(lCompile.str().c_str()) != 0)
+    {
+        unlink(lPathPartial.str().c_str());
+        throw Beagle_RunTimeExceptionM("Error compiling object "+ lPathObject.str()+ ".");
+    }
+    if (rename(lPathPartial.str().c_str(), lPathObject.str().c_str()) != 0)
+    {
+        unlink(lPathPartial.str().c_str());
+        throw Beagle_RunTimeExceptionM("Error renaming object "+ lPathPartial.str()+ " to "+ lPathObject.str()+ ".");
+    }
+    return lPathObject.str();
+}
+
+/*!
+ * Add an individual compiled by compileMember to the library to compile.
+ *
+ * The table of individuals refers to iFunctionName directly;
+ * apply_individual_GENERATION_DEME_INDIVIDUAL is provided for lookups by name.
+ *
+ */
+int SharedLibCompiler::addMember(std::string iFunctionName, std::string iObjectPath, int iGeneration, int iDemeIndex, int iIndividualIndex)
+{
+    char lName[64];
+    snprintf(lName, sizeof(lName), "apply_individual_%d_%d_%d", iGeneration, iDemeIndex, iIndividualIndex);
+
+    appendf(mCode, "// Generation %d, deme %d, individual %d, compiled into %s\n", iGeneration, iDemeIndex, iIndividualIndex, iObjectPath.c_str());
+    appendf(mCode, "extern int %s(float in[]);\n", iFunctionName.c_str());
+    appendf(mCode, "int %s(float in[])\n{\n    return %s(in);\n}\n\n", lName, iFunctionName.c_str());
+
+    mNames.push_back(lName);
+    mFunctions.push_back(iFunctionName);
+    mObjects.push_back(iObjectPath);
+
+    return mNames.size();
+}
+
+/*!
+ * Add a fused kernel evaluating all individuals in ioMembers as a voting ensemble.
+ *
+ * Each member's tree is linearized into temporaries, one per distinct subtree;
+ * a subtree is identified by the expression computing it from the temporaries of
+ * its children (or by the leaf itself), as returned by GP::Primitive::deparse.
+ * Identical subtrees, within or across members, thus map to the same temporary
+ * and are evaluated once per row. Terminals are not assigned temporaries.
+ *
+ * ioMembers  The individuals forming the ensemble, e.g. the hall of fame.
+ * iWeights   The weight of each member's vote in weighted mode.
+ *
+ */
+int SharedLibCompiler::addEnsemble(std::vector<Beagle::GP::Individual::Handle>& ioMembers, const std::vector<double>& iWeights)
+{
+    std::ostringstream lBody;
+    std::ostringstream lVotes;
+    std::ostringstream lWeightedVotes;
+    std::map<std::string, std::string> lTemps;
+
+    for(unsigned int i=0; i<ioMembers.size(); ++i)
+    {
+        lBody << "        /* Member " << i << " */" << std::endl;
+        std::string lRoot= emitSharedSubtrees(*(*ioMembers[i])[0], lTemps, lBody);
+        lBody << "        int m" << i << "= (" << lRoot << ") != 0;" << std::endl;
+        lVotes << (i == 0 ? "" : "+ ") << "m" << i;
+        lWeightedVotes << (i == 0 ? "" : "+ ") << "m" << i << "* fgp_ensemble_weights[" << i << "]";
+    }
+
+    std::ostringstream lComment;
+    lComment << "// Ensemble of " << ioMembers.size() << " individuals, " << lTemps.size() << " distinct subexpressions.";
+    buildEnsemble(ioMembers.size(), iWeights, lBody.str(), lVotes.str(), lWeightedVotes.str(), lComment.str());
+    return lTemps.size();
+}
+
+/*!
+ * Add a kernel evaluating all individuals added so far as a voting ensemble,
+ * by calling the function of each, e.g. the members linked by addMember.
+ *
+ * Unlike addEnsemble, the kernel holds no code of the individuals: compiling it
+ * costs next to nothing, however many members there are, but subexpressions
+ * common to several members are evaluated once per member.
+ *
+ * iWeights   The weight of each individual's vote in weighted mode.
+ *
+ */
+void SharedLibCompiler::addLinkedEnsemble(const std::vector<double>& iWeights)
+{
+    std::ostringstream lBody;
+    std::ostringstream lVotes;
+    std::ostringstream lWeightedVotes;
+    for(unsigned int i=0; i<mFunctions.size(); ++i)
+    {
+        lBody << "        int m" << i << "= " << mFunctions[i] << "((float*)in) != 0;" << std::endl;
+        lVotes << (i == 0 ? "" : "+ ") << "m" << i;
+        lWeightedVotes << (i == 0 ? "" : "+ ") << "m" << i << "* fgp_ensemble_weights[" << i << "]";
+    }
+
+    std::ostringstream lComment;
+    lComment << "// Ensemble of " << mFunctions.size() << " individuals, calling the function of each.";
+    buildEnsemble(mFunctions.size(), iWeights, lBody.str(), lVotes.str(), lWeightedVotes.str(), lComment.str());
+}
+
+/*!
+ * Set the ensemble kernel of iNrMembers individuals: iBody computes the vote mI of each
+ * member I from the row in, iVotes and iWeightedVotes sum the votes, plain and weighted.
+ */
+void SharedLibCompiler::buildEnsemble(unsigned int iNrMembers, const std::vector<double>& iWeights, const std::string& iBody,
+                                      const std::string& iVotes, const std::string& iWeightedVotes, const std::string& iComment)
+{
+    std::ostringstream lWeights;
+    for(unsigned int i=0; i<iNrMembers; ++i)
+    {
+        double lWeight= (i < iWeights.size() && iWeights[i] > 0.0) ? iWeights[i] : 0.0;
+        lWeights << (i == 0 ? "" : ", ") << lWeight;
+    }
+
+    std::ostringstream lCode;
+    lCode << iComment << std::endl;
+    lCode << "const int fgp_nr_ensemble= " << iNrMembers << ";" << std::endl;
+    if (iNrMembers == 0)
+    {
+        lCode << "void ensemble_predict(const float* rows, int nrows, int stride, int weighted, int* out)" << std::endl;
+        lCode << "{" << std::endl;
+        lCode << "    int r;" << std::endl;
+        lCode << "    for (r= 0; r < nrows; ++r) out[r]= 0;" << std::endl;
+        lCode << "}" << std::endl;
+        mEnsemble= lCode.str();
+        return;
+    }
+    lCode << "static const double fgp_ensemble_weights[]= { " << lWeights.str() << " };" << std::endl;
+    lCode << "void ensemble_predict(const float* rows, int nrows, int stride, int weighted, int* out)" << std::endl;
     lCode << "{" << std::endl;
-    lCode << "    return " << ioIndividual[0]->deparse() << ";" << std::endl;
+    lCode << "    double lTotal= 0.0;" << std::endl;
+    lCode << "    int r;" << std::endl;
+    lCode << "    for (r= 0; r < " << iNrMembers << "; ++r) lTotal+= fgp_ensemble_weights[r];" << std::endl;
+    lCode << "    for (r= 0; r < nrows; ++r)" << std::endl;
+    lCode << "    {" << std::endl;
+    lCode << "        const float* in= rows+ (long)r* stride;" << std::endl;
+    lCode << iBody;
+    lCode << "        if (weighted)" << std::endl;
+    lCode << "            out[r]= 2.0* (" << iWeightedVotes << ") > lTotal;" << std::endl;
+    lCode << "        else" << std::endl;
+    lCode << "            out[r]= 2* (" << iVotes << ") > " << iNrMembers << ";" << std::endl;
+    lCode << "    }" << std::endl;
     lCode << "}" << std::endl;
 
-    mIndividuals.push_back(lCode.str());
-    
-    return mIndividuals.size();
+    mEnsemble= lCode.str();
+}
+
+/*!
+ * Linearize ioTree into temporaries, appended to ioCode, one per distinct non-terminal subtree.
+ *
+ * Nodes are visited from the end of the prefix array to its start, so that
+ * the expressions of all children are known when visiting their parent.
+ *
+ * ioTree    The tree to linearize.
+ * ioTemps   Temporaries emitted so far, keyed by the expression they hold.
+ * ioCode    The code computing the temporaries is appended here.
+ *
+ * Returns the expression computing the root of ioTree.
+ *
+ */
+std::string SharedLibCompiler::emitSharedSubtrees(Beagle::GP::Tree& ioTree, std::map<std::string, std::string>& ioTemps, std::ostream& ioCode)
+{
+    std::vector<std::string> lValues(ioTree.size());
+    for(int i=ioTree.size()- 1; i>=0; --i)
+    {
+        std::vector<std::string> lArguments;
+        unsigned int lChild= i+ 1;
+        for(unsigned int j=0; j<ioTree[i].mPrimitive->getNumberArguments(); ++j)
+        {
+            lArguments.push_back(lValues[lChild]);
+            lChild+= ioTree[lChild].mSubTreeSize;
+        }
+        std::string lExpression= ioTree[i].mPrimitive->deparse(lArguments);
+        if (lArguments.empty())
+        {
+            lValues[i]= lExpression;
+            continue;
+        }
+        std::map<std::string, std::string>::const_iterator lTemp= ioTemps.find(lExpression);
+        if (lTemp == ioTemps.end())
+        {
+            std::ostringstream lName;
+            lName << "t" << ioTemps.size();
+            ioCode << "        double " << lName.str() << "= " << lExpression << ";" << std::endl;
+            lTemp= ioTemps.insert(std::make_pair(lExpression, lName.str())).first;
+        }
+        lValues[i]= lTemp->second;
+    }
+    return lValues[0];
 }
 
 /*!
@@ -69,57 +385,457 @@ int SharedLibCompiler::addIndividual(Beagle::GP::Individual& ioIndividual, int i
  *                 E.g. "g0_d0" for deme 0 in generation 0.
  *                 The source file will be named <ioLibName>.c
  *                 The library will be named lib<ioLibName>.so.
- *                 All files will be generated in ioTmpDirectory.
+ *                 All files will be generated in ioTmpDirectory,
+ *                 unless compiling in memory, see setInMemory.
  *
  */
 std::string SharedLibCompiler::compile(std::string iLibName)
+{
+    std::string lPathLib;
+    if (mInMemory)
+    {
+        lPathLib= compileInMemory(iLibName);
+    }
+    if (lPathLib.empty())
+    {
+        lPathLib= compileOnDisk(iLibName);
+    }
+
+    // Remove all individuals; the buffers keep their capacity, for callers compiling library after library.
+    mCode.clear();
+    mNames.clear();
+    mFunctions.clear();
+    mObjects.clear();
+    mEnsemble.clear();
+    mQuantizedColumns.clear();
+
+    return lPathLib;
+}
+
+/*!
+ * Close the descriptor of the library compiled in memory last, if not taken.
+ */
+SharedLibCompiler::~SharedLibCompiler()
+{
+    if (mLibraryFd >= 0)
+    {
+        close(mLibraryFd);
+    }
+}
+
+/*!
+ * Compile a shared library.
+ *
+ * gcc -shared -nostartfiles -o libFILE FILE.c
+ *
+ * Added '-lm' to include math in linking (sin, cos, exp, log).
+ * Added '-O3' in fast math mode, for inlining and vectorizing the approximations.
+ * See: http://linux.die.net/man/3/dlopen
+ *
+ * Reading the source from stdin, '-x c' sets its language; '-x none' restores
+ * detection by suffix for the object files of members following it.
+ *
+ */
+std::string SharedLibCompiler::getCompileCommand(const std::string& iPathSource, const std::string& iPathLib) const
+{
+    std::ostringstream lCompile;
+    lCompile << "gcc -shared -nostartfiles -lm " << (mFastMath ? "-O3 " : "") << "-o " << iPathLib;
+    if (iPathSource == "-")
+    {
+        lCompile << " -pipe -x c - -x none";
+    }
+    else
+    {
+        lCompile << " " << iPathSource;
+    }
+    for(std::vector<std::string>::const_iterator lObject=mObjects.begin(); lObject!=mObjects.end(); ++lObject)
+    {
+        lCompile << " " << *lObject;
+    }
+    return lCompile.str();
+}
+
+/*!
+ * Write the source to <iLibName>.c and compile lib<iLibName>.so, both in the tmp directory.
+ */
+std::string SharedLibCompiler::compileOnDisk(const std::string& iLibName)
 {
     std::ostringstream lPathSource;
     std::ostringstream lPathLib;
-    std::ostringstream lCompile;
 
     lPathSource << mTmpDirectory << "/" << iLibName << ".c";
     lPathLib << mTmpDirectory << "/lib" << iLibName << ".so";
-    lCompile << "gcc -shared -nostartfiles -lm -o " << lPathLib.str() << " " << lPathSource.str();
 
     // Open a file for writting out the C code generated.
     std::ofstream lOFS(lPathSource.str().c_str());
+    writeHeader(lOFS);
+    lOFS << mCode;
+    writeTables(lOFS);
+    lOFS.close();
+
+    std::string lCompile= getCompileCommand(lPathSource.str(), lPathLib.str());
+    if (system(lCompile.c_str()) != 0)
+    {
+        throw Beagle_RunTimeExceptionM("Error compiling shared library.");
+    }
+    return lPathLib.str();
+}
+
+/*!
+ * Compile library iLibName without touching the file system.
+ *
+ * An anonymous memory file is created by memfd_create. gcc, run by popen, reads the
+ * source from the pipe and writes the library to /proc/<pid>/fd/N, i.e. into the
+ * memory file, which dlopen then maps from /proc/self/fd/N. The descriptor is
+ * close-on-exec, so it is not inherited by gcc or any other child process; gcc
+ * reaches it through the /proc entry of this process instead.
+ *
+ * Returns an empty string, if memfd_create or /proc are not available; errors
+ * reported by gcc throw, as on disk.
+ *
+ */
+std::string SharedLibCompiler::compileInMemory(const std::string& iLibName)
+{
+#ifdef MFD_CLOEXEC
+    if (access("/proc/self/fd", X_OK) != 0) return "";
+    int lFd= memfd_create(("lib"+ iLibName+ ".so").c_str(), MFD_CLOEXEC);
+    if (lFd < 0) return "";
+
+    std::ostringstream lHeader;
+    writeHeader(lHeader);
+    std::ostringstream lTables;
+    writeTables(lTables);
+
+    // Keep a copy of the source for debugging.
+    if (mKeepSource)
+    {
+        std::ofstream lOFS((mTmpDirectory+ "/"+ iLibName+ ".c").c_str());
+        lOFS << lHeader.str() << mCode << lTables.str();
+    }
+
+    std::ostringstream lPathOutput;
+    lPathOutput << "/proc/" << getpid() << "/fd/" << lFd;
+    std::string lCompile= getCompileCommand("-", lPathOutput.str());
+    FILE* lPipe= popen(lCompile.c_str(), "w");
+    if (lPipe == NULL)
+    {
+        close(lFd);
+        return "";
+    }
+
+    // A compiler exiting early must not take this process down with SIGPIPE.
+    void (*lHandler)(int)= signal(SIGPIPE, SIG_IGN);
+    fwrite(lHeader.str().data(), 1, lHeader.str().size(), lPipe);
+    fwrite(mCode.data(), 1, mCode.size(), lPipe);
+    fwrite(lTables.str().data(), 1, lTables.str().size(), lPipe);
+    int lStatus= pclose(lPipe);
+    signal(SIGPIPE, lHandler);
+    if (lStatus != 0)
+    {
+        close(lFd);
+        throw Beagle_RunTimeExceptionM("Error compiling shared library "+ iLibName+ " in memory.");
+    }
+
+    if (mLibraryFd >= 0) close(mLibraryFd);
+    mLibraryFd= lFd;
+    std::ostringstream lPathLib;
+    lPathLib << "/proc/self/fd/" << lFd;
+    return lPathLib.str();
+#else
+    return "";
+#endif
+}
+
+/*!
+ * Write the tables of all individuals, and the ensemble kernel if added, to ioOS.
+ */
+void SharedLibCompiler::writeTables(std::ostream& ioOS) const
+{
+    ioOS << "const int fgp_runtime_version= FGP_RUNTIME_VERSION;" << std::endl;
+    ioOS << "const int fgp_fast_math= " << (mFastMath ? 1 : 0) << ";" << std::endl;
+    ioOS << "const int fgp_code_bytes= " << ((mQuantization != NULL) ? mQuantization->getCodeBytes() : 0) << ";" << std::endl;
+    ioOS << "const int fgp_nr_columns= " << mNrColumns << ";" << std::endl;
+    ioOS << "const int fgp_nr_packed= " << (mColumns.empty() ? mNrColumns : (int)mColumns.size()) << ";" << std::endl;
+    ioOS << "const int fgp_columns[]= {";
+    for(int i=0; i<(mColumns.empty() ? mNrColumns : (int)mColumns.size()); ++i)
+    {
+        ioOS << ((i == 0) ? " " : ", ") << (mColumns.empty() ? i : (int)mColumns[i]);
+    }
+    ioOS << " };" << std::endl;
+    ioOS << "const int fgp_nr_individuals= " << mNames.size() << ";" << std::endl;
+    ioOS << "int (* const fgp_individuals[])(float in[])= {" << std::endl;
+    for(std::vector<std::string>::const_iterator lFunction=mFunctions.begin(); lFunction!=mFunctions.end(); ++lFunction)
+    {
+        ioOS << "    " << *lFunction << "," << std::endl;
+    }
+    ioOS << "    0" << std::endl << "};" << std::endl;
+    ioOS << "const char* const fgp_individual_names[]= {" << std::endl;
+    for(std::vector<std::string>::const_iterator lName=mNames.begin(); lName!=mNames.end(); ++lName)
+    {
+        ioOS << "    \"" << *lName << "\"," << std::endl;
+    }
+    ioOS << "    0" << std::endl << "};" << std::endl;
+    if (!mEnsemble.empty())
+    {
+        ioOS << std::endl << mEnsemble;
+    }
+}
 
-    // Write macros for translating Beagle::GP::Primitives into C functions.
-    // Macros defining arithmetic and logical operations do not change -- include ./macros.h.
+
+/*!
+ * Write includes and macros preceding the code of all individuals to ioOS.
+ */
+void SharedLibCompiler::writeHeader(std::ostream& ioOS) const
+{
+    // Functions translating Beagle::GP::Primitives into C do not change -- copy the runtime.
     // Macros accessing fields in the dataset must be generated dynamically.
-    // FIXME: this assumes that tmpDirectory is ./tmp!!
-    lOFS << "#include \"math.h\"" << std::endl;
-    lOFS << "#include \"../lib/macros.h\"" << std::endl << std::endl;
+    ioOS << "#define FGP_RUNTIME_VERSION " << FGP_RUNTIME_VERSION << std::endl;
+    if (mFastMath)
+    {
+        ioOS << "#define FGP_FAST_MATH 1" << std::endl;
+    }
+    ioOS << SharedLibRuntime << std::endl;
+    if (mQuantization != NULL)
+    {
+        // Rows hold level codes; columns used as values map their codes to levels.
+        ioOS << "typedef " << ((mQuantization->getCodeBytes() == 1) ? "unsigned char" : "unsigned short") << " fgp_code_t;" << std::endl;
+        ioOS << std::setprecision(17);
+        for(std::set<unsigned int>::const_iterator lColumn=mQuantizedColumns.begin(); lColumn!=mQuantizedColumns.end(); ++lColumn)
+        {
+            const std::vector<double>& lLevels= mQuantization->getLevels(*lColumn);
+            ioOS << "static const double fgp_levels_" << *lColumn << "[]= {";
+            for(unsigned int k=0; k<lLevels.size(); ++k)
+            {
+                ioOS << ((k == 0) ? " " : ", ") << lLevels[k];
+            }
+            ioOS << " };" << std::endl;
+            ioOS << "#define IN" << *lColumn << " fgp_levels_" << *lColumn << "[in[" << getPackedIndex(*lColumn) << "]]" << std::endl;
+        }
+        ioOS << std::endl;
+        return;
+    }
+    if (!mColumns.empty())
+    {
+        // Only the columns in mColumns are packed, in order.
+        for(unsigned int i=0; i<mColumns.size(); ++i)
+        {
+            ioOS << "#define IN" << mColumns[i] << " in[" << i << "]" << std::endl;
+        }
+        ioOS << std::endl;
+        return;
+    }
     int lColumnIndex= 0;
     while (lColumnIndex < mNrColumns)
     {
-        lOFS << "#define IN" << lColumnIndex << " in[" << lColumnIndex << "]" << std::endl;
+        ioOS << "#define IN" << lColumnIndex << " in[" << lColumnIndex << "]" << std::endl;
         lColumnIndex++;
     }
-    lOFS << std::endl;
-    
-    // Append all individuals to the library.
-    for(std::vector<std::string>::const_iterator lIndividual=mIndividuals.begin(); lIndividual!=mIndividuals.end(); ++lIndividual)
-    {
-        lOFS << *lIndividual << std::endl;
-    }
-        
-    // Compile a shared library.
-    //
-    // gcc -shared -nostartfiles -o libFILE FILE.c
-    // 
-    // Added '-lm' to include math in linking (sin, cos, exp, log).
-    // See: http://linux.die.net/man/3/dlopen
-    Beagle_LogDebugM(lContext.getSystem().getLogger(), "makeSharedLib", "Beagle::GP::SpamebaseEvalOp", lCompile.str());
-    if (system(lCompile.str().c_str()) != 0)
+    ioOS << std::endl;
+}
+
+/*!
+ * Return the index of column iColumn in the rows packed, see setColumns.
+ */
+unsigned int SharedLibCompiler::getPackedIndex(unsigned int iColumn) const
+{
+    if (mColumns.empty()) return iColumn;
+    return std::lower_bound(mColumns.begin(), mColumns.end(), iColumn)- mColumns.begin();
+}
+
+/*!
+ * Deparse ioTree for rows of level codes.
+ *
+ * LT(INc, EPR(x)), LT(EPR(x), INc), and EQ of a column and a constant are
+ * rewritten into comparisons of the code in[c] to a threshold computed from
+ * the levels of column c; they are exact for columns having one level per
+ * distinct value. All other uses of INc look up the lower bound of the level.
+ *
+ * ioTree    The tree to deparse.
+ * ioBody    The temporaries are appended here, in SSA mode.
+ *
+ * Returns the expression computing the root of ioTree.
+ *
+ */
+std::string SharedLibCompiler::emitQuantized(Beagle::GP::Tree& ioTree, std::string& ioBody)
+{
+    unsigned int lNrTemps= 0;
+    std::vector<std::string> lValues(ioTree.size());
+    std::vector<int> lColumns(ioTree.size(), -1);
+    for(int i=ioTree.size()- 1; i>=0; --i)
     {
-        throw Beagle_RunTimeExceptionM("Error compiling shared library.");
+        std::string lName= ioTree[i].mPrimitive->getName();
+        std::vector<std::string> lArguments;
+        std::vector<unsigned int> lChildren;
+        unsigned int lChild= i+ 1;
+        for(unsigned int j=0; j<ioTree[i].mPrimitive->getNumberArguments(); ++j)
+        {
+            lArguments.push_back(lValues[lChild]);
+            lChildren.push_back(lChild);
+            lChild+= ioTree[lChild].mSubTreeSize;
+        }
+        if (lArguments.empty())
+        {
+            lValues[i]= ioTree[i].mPrimitive->deparse(lArguments);
+            if (lName.size() > 2 && lName.compare(0, 2, "IN") == 0)
+            {
+                lColumns[i]= atoi(lName.c_str()+ 2);
+            }
+            continue;
+        }
+
+        // Comparisons of a column and a constant.
+        if ((lName == "LT" || lName == "EQ") && lChildren.size() == 2)
+        {
+            int lColumn= -1;
+            bool lConstantFirst= false;
+            std::string lConstant;
+            if (lColumns[lChildren[0]] >= 0 && ioTree[lChildren[1]].mPrimitive->getName() == "EPR")
+            {
+                lColumn= lColumns[lChildren[0]];
+                lConstant= lValues[lChildren[1]];
+            }
+            else if (ioTree[lChildren[0]].mPrimitive->getName() == "EPR" && lColumns[lChildren[1]] >= 0)
+            {
+                lColumn= lColumns[lChildren[1]];
+                lConstant= lValues[lChildren[0]];
+                lConstantFirst= true;
+            }
+            if (lColumn >= 0)
+            {
+                double lValue= strtod(lConstant.c_str()+ lConstant.find('(')+ 1, NULL);
+                std::ostringstream lCompare;
+                if (lName == "EQ")
+                {
+                    int lLevel= mQuantization->findLevel(lColumn, lValue);
+                    if (lLevel < 0) lCompare << "0";
+                    else lCompare << "(in[" << getPackedIndex(lColumn) << "] == " << lLevel << ")";
+                }
+                else if (lConstantFirst)
+                {
+                    lCompare << "(in[" << getPackedIndex(lColumn) << "] >= " << mQuantization->countLevelsNotAbove(lColumn, lValue) << ")";
+                }
+                else
+                {
+                    lCompare << "(in[" << getPackedIndex(lColumn) << "] < " << mQuantization->countLevelsBelow(lColumn, lValue) << ")";
+                }
+                lValues[i]= assign(lCompare.str(), lName, lNrTemps, ioBody);
+                continue;
+            }
+        }
+
+        // Any other use of a column needs its levels.
+        for(unsigned int j=0; j<lChildren.size(); ++j)
+        {
+            if (lColumns[lChildren[j]] >= 0) mQuantizedColumns.insert(lColumns[lChildren[j]]);
+        }
+        lValues[i]= assign(ioTree[i].mPrimitive->deparse(lArguments), lName, lNrTemps, ioBody);
     }
-    
-    // Remove all individuals.
-    mIndividuals.clear();
+    return lValues[0];
+}
 
-    return lPathLib.str();
+/*!
+ * Append the nested expression computing ioTree to ioCode.
+ *
+ * GP::Tree::deparse builds the string of each subtree from copies of the strings
+ * of its children, which takes time quadratic in the depth of the tree. Here, the
+ * prefix array is walked once: a non-terminal appends its name and an opening
+ * parenthesis, a terminal appends itself, followed by the separators and closing
+ * parentheses of the subtrees it completes. Terminals are deparsed by their own
+ * deparse method, honouring TokenDeparserT and EphemeralPercent; non-terminals in
+ * this library do not override GP::Primitive::deparse.
+ *
+ * ioTree    The tree to deparse.
+ * ioCode    The expression is appended here.
+ *
+ */
+void SharedLibCompiler::appendExpression(Beagle::GP::Tree& ioTree, std::string& ioCode)
+{
+    // The number of arguments still to append, for each open non-terminal.
+    mOpenArguments.clear();
+    for(unsigned int i=0; i<ioTree.size(); ++i)
+    {
+        Beagle::GP::Primitive& lPrimitive= *ioTree[i].mPrimitive;
+        unsigned int lNrArguments= lPrimitive.getNumberArguments();
+        if (lNrArguments > 0)
+        {
+            ioCode+= lPrimitive.getName();
+            ioCode+= '(';
+            mOpenArguments.push_back(lNrArguments);
+            continue;
+        }
+        ioCode+= lPrimitive.deparse(mNoArguments);
+        while (!mOpenArguments.empty())
+        {
+            if (--mOpenArguments.back() > 0)
+            {
+                ioCode+= ',';
+                break;
+            }
+            ioCode+= ')';
+            mOpenArguments.pop_back();
+        }
+    }
 }
 
+/*!
+ * Deparse ioTree for rows of floats.
+ *
+ * In expression mode, see appendExpression. In SSA mode, nodes are visited from
+ * the end of the prefix array to its start, so that the temporaries of all children
+ * are known when visiting their parent; each non-terminal node is assigned a
+ * temporary in ioBody, in the order visited, and terminals are inlined.
+ *
+ * ioTree    The tree to deparse.
+ * ioBody    The temporaries are appended here, in SSA mode.
+ *
+ * Returns the expression computing the root of ioTree.
+ *
+ */
+std::string SharedLibCompiler::emitExpression(Beagle::GP::Tree& ioTree, std::string& ioBody)
+{
+    if (!mSSA)
+    {
+        std::string lExpression;
+        appendExpression(ioTree, lExpression);
+        return lExpression;
+    }
+    unsigned int lNrTemps= 0;
+    std::vector<std::string> lValues(ioTree.size());
+    std::vector<std::string> lArguments;
+    for(int i=ioTree.size()- 1; i>=0; --i)
+    {
+        lArguments.clear();
+        unsigned int lChild= i+ 1;
+        for(unsigned int j=0; j<ioTree[i].mPrimitive->getNumberArguments(); ++j)
+        {
+            lArguments.push_back(lValues[lChild]);
+            lChild+= ioTree[lChild].mSubTreeSize;
+        }
+        lValues[i]= ioTree[i].mPrimitive->deparse(lArguments);
+        if (!lArguments.empty())
+        {
+            lValues[i]= assign(lValues[i], ioTree[i].mPrimitive->getName(), lNrTemps, ioBody);
+        }
+    }
+    return lValues[0];
+}
+
+/*!
+ * Assign iExpression to a temporary, in SSA mode.
+ *
+ * Boolean primitives of the runtime return int, all others double;
+ * temporaries are declared accordingly, so that no value is converted.
+ *
+ */
+std::string SharedLibCompiler::assign(const std::string& iExpression, const std::string& iPrimitive, unsigned int& ioNrTemps, std::string& ioBody) const
+{
+    if (!mSSA) return iExpression;
+    bool lInt= (iPrimitive == "LT" || iPrimitive == "EQ" || iPrimitive == "AND" || iPrimitive == "OR" ||
+                iPrimitive == "NOT" || iPrimitive == "NAND" || iPrimitive == "NOR" || iPrimitive == "XOR");
+    char lName[16];
+    snprintf(lName, sizeof(lName), "t%u", ioNrTemps++);
+    appendf(ioBody, "    %s %s= ", lInt ? "int" : "double", lName);
+    ioBody+= iExpression;
+    ioBody+= ";\n";
+    return lName;
+}
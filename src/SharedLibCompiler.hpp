@@ -2,6 +2,12 @@
 #define SharedLibCompiler_hpp
 
 #include "beagle/GP.hpp"
+#include "DataSetBinaryClassification.hpp"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 
 /*!
  *  \class SharedLibCompiler beagle/GP/SharedLibCompiler.hpp "beagle/GP/SharedLibCompiler.hpp"
@@ -22,8 +28,15 @@ public:
     /*!
      *
      */
-    virtual ~SharedLibCompiler()
-    { }
+    virtual ~SharedLibCompiler();
+
+    /*!
+     * Set the number of columns and the tmp directory as the constructor does, and
+     * all other settings back to their defaults, and remove all individuals, for
+     * compiling the next library. Unlike a new compiler, the buffers keep the
+     * capacity of the libraries compiled before.
+     */
+    void reset(int iNrColumns, std::string iTmpDirectory);
     
     /*!
      * Add an individual to the library to compile.
@@ -46,6 +59,61 @@ public:
      */
     virtual int addIndividual(Beagle::GP::Individual& ioIndividual, int iGeneration, int iDeme, int iIndividual);
 
+    /*!
+     * Compile ioIndividual on its own into an object file, for linking into
+     * several libraries later on by addMember.
+     *
+     * The object defines a single function
+     *
+     *   int iFunctionName(float in[])
+     *
+     * ioIndividual      The individual to compile.
+     * iFunctionName     The name of the function representing ioIndividual.
+     * iObjectName       The object file will be named <iObjectName>.o, in the tmp directory.
+     *
+     * Returns the path to the object file.
+     *
+     */
+    virtual std::string compileMember(Beagle::GP::Individual& ioIndividual, std::string iFunctionName, std::string iObjectName);
+
+    /*!
+     * Add an individual compiled by compileMember to the library to compile.
+     *
+     * The object file is linked into the library, and a function
+     * apply_individual_GENERATION_DEME_INDEX, calling iFunctionName, is created.
+     *
+     * Returns the number of individuals added.
+     *
+     */
+    virtual int addMember(std::string iFunctionName, std::string iObjectPath, int iGeneration, int iDeme, int iIndividual);
+
+    /*!
+     * Add a fused kernel evaluating all individuals in ioMembers as a voting ensemble.
+     *
+     * The kernel has the signature
+     *
+     *   void ensemble_predict(const float* rows, int nrows, int stride, int weighted, int* out)
+     *
+     * and classifies nrows rows, stride floats apart, writing one prediction per row to out.
+     * With weighted == 0, the majority of all members decides; otherwise, each member's vote
+     * is weighted by iWeights (e.g. its MCC, negative weights count as 0).
+     * Subexpressions common to several members (or occurring repeatedly in one member)
+     * are evaluated once per row.
+     *
+     * Returns the number of distinct subexpressions evaluated per row.
+     *
+     */
+    virtual int addEnsemble(std::vector<Beagle::GP::Individual::Handle>& ioMembers, const std::vector<double>& iWeights);
+
+    /*!
+     * Add a kernel with the signature of addEnsemble, evaluating all individuals
+     * added so far as a voting ensemble by calling the function of each; e.g. the
+     * members linked by addMember, whose code then need not be compiled again.
+     * Subexpressions common to several members are not shared.
+     *
+     */
+    virtual void addLinkedEnsemble(const std::vector<double>& iWeights);
+
     /*!
      * iLibName        The name of the library to compile.
      *                 E.g. "g0_d0" for deme 0 in generation 0.
@@ -55,14 +123,212 @@ public:
      *
      * Returns the path to the newly compiled library.
      *
+     * Besides one function per individual, the library exports a table of all
+     * individuals, for use by tools without access to the Open BEAGLE population:
+     *
+     *   const int fgp_runtime_version;
+     *   const int fgp_fast_math;
+     *   const int fgp_code_bytes;
+     *   const int fgp_nr_columns;
+     *   const int fgp_nr_packed;
+     *   const int fgp_columns[];
+     *   const int fgp_nr_individuals;
+     *   int (* const fgp_individuals[])(float in[]);
+     *   const char* const fgp_individual_names[];
+     *
+     * Individuals read rows of fgp_nr_packed values; value i is column fgp_columns[i]
+     * of the data set, see setColumns. fgp_code_bytes is 0 for rows of floats, and
+     * the size of a level code for rows of codes, see setQuantization.
+     *
+     * and, if an ensemble has been added, 
+     *
+     *   const int fgp_nr_ensemble;
+     *   void ensemble_predict(const float* rows, int nrows, int stride, int weighted, int* out);
+     *
+     * Each source file generated is self-contained: the primitive runtime
+     * (see SharedLibRuntime.hpp) is copied into it.
+     *
      */
     virtual std::string compile(std::string iLibName);
+
+    /*!
+     * Compile libraries in memory, if iInMemory is true: compile streams the source
+     * to gcc over a pipe, gcc writes the library to a memfd_create descriptor, and
+     * the path returned is /proc/self/fd/N; nothing is written to the tmp directory,
+     * unless iKeepSource is true, in which case the source is written there as well.
+     * If memory files are not supported, libraries are compiled on disk.
+     *
+     * The descriptor must stay open until the library has been opened by dlopen;
+     * see takeLibraryFd.
+     */
+    void setInMemory(bool iInMemory, bool iKeepSource=false)
+    {
+        mInMemory= iInMemory;
+        mKeepSource= iKeepSource;
+    }
+
+    /*!
+     * Return the descriptor of the library compiled in memory last, -1 if none;
+     * the caller closes it once done with dlopen. Descriptors not taken are
+     * closed by the destructor.
+     */
+    int takeLibraryFd()
+    {
+        int lFd= mLibraryFd;
+        mLibraryFd= -1;
+        return lFd;
+    }
+
+    /*!
+     * Compile EXP, LOG, SIN, and COS to the fast approximations of the runtime,
+     * instead of calling libm, if iFastMath is true; see SharedLibRuntime.hpp.
+     */
+    void setFastMath(bool iFastMath)
+    {
+        mFastMath= iFastMath;
+    }
+
+    bool isFastMath() const
+    {
+        return mFastMath;
+    }
+
+    /*!
+     * Emit each individual as a sequence of three-address temporaries, one per
+     * non-terminal node, children before parents, if iSSA is true; otherwise, as
+     * a single nested expression. Both evaluate every node exactly once, as all
+     * primitives of the runtime are functions of their evaluated arguments; the
+     * nesting depth of the C code generated by SSA emission does not grow with the tree.
+     */
+    void setSSA(bool iSSA)
+    {
+        mSSA= iSSA;
+    }
+
+    bool isSSA() const
+    {
+        return mSSA;
+    }
+
+    /*!
+     * Compile individuals added by addIndividual for rows of level codes,
+     * as packed by SharedLibEvalOp from a quantized data set, instead of floats.
+     *
+     * The functions keep their signature, in[] is reinterpreted as codes
+     * of ioDataSet->getCodeBytes() bytes each. LT and EQ comparing a column
+     * to a constant compare codes to precomputed thresholds; elsewhere, INc
+     * is replaced by the lower bound of its level, looked up in a table.
+     *
+     * ioDataSet   The quantized data set, NULL for compiling for floats.
+     */
+    void setQuantization(Beagle::DataSetBinaryClassification::Handle ioDataSet)
+    {
+        mQuantization= ioDataSet;
+    }
+
+    /*!
+     * Compile individuals added by addIndividual for rows holding only the columns
+     * in iColumns, ascending, as packed by SharedLibEvalOp; INc is remapped to
+     * the index of c in iColumns. An empty list stands for all columns.
+     */
+    void setColumns(const std::vector<unsigned int>& iColumns)
+    {
+        mColumns= iColumns;
+    }
     
 protected:
 
+    /*!
+     * Write one temporary per distinct non-terminal subtree of ioTree to ioCode,
+     * reusing the temporaries in ioTemps, keyed by their expression.
+     * Returns the expression computing the root of ioTree.
+     */
+    std::string emitSharedSubtrees(Beagle::GP::Tree& ioTree, std::map<std::string, std::string>& ioTemps, std::ostream& ioCode);
+
+    /*!
+     * Append the nested expression computing ioTree to ioCode, walking the prefix
+     * array once; the expression equals GP::Tree::deparse, up to whitespace.
+     */
+    void appendExpression(Beagle::GP::Tree& ioTree, std::string& ioCode);
+
+    /*!
+     * Deparse ioTree for rows of floats. In SSA mode, the temporaries are appended
+     * to ioBody, see setSSA. Returns the expression computing the root of ioTree.
+     */
+    std::string emitExpression(Beagle::GP::Tree& ioTree, std::string& ioBody);
+
+    /*!
+     * Deparse ioTree for rows of level codes, see setQuantization; as emitExpression otherwise.
+     * Columns whose levels are looked up are added to mQuantizedColumns.
+     */
+    std::string emitQuantized(Beagle::GP::Tree& ioTree, std::string& ioBody);
+
+    /*!
+     * In SSA mode, append the temporary number ioNrTemps computing iExpression,
+     * the value of primitive iPrimitive, to ioBody, and return its name;
+     * otherwise, return iExpression.
+     */
+    std::string assign(const std::string& iExpression, const std::string& iPrimitive, unsigned int& ioNrTemps, std::string& ioBody) const;
+
+    /*!
+     * Return the index of column iColumn in the rows packed, see setColumns.
+     */
+    unsigned int getPackedIndex(unsigned int iColumn) const;
+
+    /*!
+     * Write includes and macros preceding the code of all individuals.
+     */
+    void writeHeader(std::ostream& ioOS) const;
+
+    /*!
+     * Write the tables of all individuals and the ensemble kernel following the code of all individuals.
+     */
+    void writeTables(std::ostream& ioOS) const;
+
+    /*!
+     * Set the ensemble kernel of iNrMembers individuals, see addEnsemble; iBody computes
+     * the vote mI of each member I, iVotes and iWeightedVotes sum the votes.
+     */
+    void buildEnsemble(unsigned int iNrMembers, const std::vector<double>& iWeights, const std::string& iBody,
+                       const std::string& iVotes, const std::string& iWeightedVotes, const std::string& iComment);
+
+    /*!
+     * Write the source of library iLibName to the tmp directory, compile it there,
+     * and return the path of the library.
+     */
+    std::string compileOnDisk(const std::string& iLibName);
+
+    /*!
+     * Compile library iLibName in memory, see setInMemory, and return its path;
+     * return an empty string if memory files are not supported.
+     */
+    std::string compileInMemory(const std::string& iLibName);
+
+    /*!
+     * Return the gcc command line compiling the source, '-' for stdin, to iPathLib.
+     */
+    std::string getCompileCommand(const std::string& iPathSource, const std::string& iPathLib) const;
+
     std::string mTmpDirectory;
-    std::vector<std::string> mIndividuals;
+    //! Code of all individuals added; cleared by compile, keeping its capacity, see reset.
+    std::string mCode;
+    std::vector<std::string> mNames;
+    std::vector<std::string> mFunctions;
+    std::vector<std::string> mObjects;
+    bool mFastMath;
+    bool mSSA;
+    bool mInMemory;
+    bool mKeepSource;
+    int mLibraryFd;
+    Beagle::DataSetBinaryClassification::Handle mQuantization;
+    std::set<unsigned int> mQuantizedColumns;
+    std::vector<unsigned int> mColumns;
+    std::string mEnsemble;
     int mNrColumns;
+    //! Arguments still to append for each open non-terminal, see appendExpression.
+    std::vector<unsigned int> mOpenArguments;
+    //! The (empty) arguments terminals are deparsed with.
+    std::vector<std::string> mNoArguments;
     
 };
 
@@ -4,6 +4,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <dlfcn.h>
+#include <link.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "SharedLibEvalOp.hpp"
 #include "DataSetBinaryClassification.hpp"
@@ -11,13 +14,131 @@
 using namespace Beagle;
 using namespace GP;
 
+namespace
+{
+
+/*!
+ * A share of the individuals SharedLibEvalOp::evaluateDeme applies to the training set, tile by tile.
+ */
+struct TileWorker
+{
+    const float* mSample;               //!< Training set; the replica on the node of mCpus, if any.
+    unsigned int mRowStride;            //!< Floats from one row to the next.
+    const unsigned int* mWeights;       //!< Weight of each row.
+    unsigned int mRanges[2][2];         //!< Positive and negative rows to classify, [begin, end).
+    unsigned int mTileRows;             //!< Rows per tile.
+    const SharedLibEvalOp::ApplyIndividual* mFunctions;  //!< All individuals to apply.
+    unsigned int mBegin;                //!< First individual of this worker's share.
+    unsigned int mEnd;                  //!< End of this worker's share.
+    unsigned int* mTruePositives;       //!< Weighted positive predictions among positive rows, per individual.
+    unsigned int* mFalsePositives;      //!< Weighted positive predictions among negative rows, per individual.
+    unsigned int* mMisses;              //!< Misclassifications of each row by this worker's share, NULL if not counted.
+    std::vector<int> mCpus;             //!< CPUs to pin the worker thread to, none if empty.
+};
+
+/*!
+ * Apply the worker's individuals to one tile of rows after the other.
+ * Misclassifications are counted by a loop of their own, only if requested,
+ * so the default loop reads the rows and weights and nothing else.
+ */
+void applyTiles(TileWorker& ioWorker)
+{
+    unsigned int* lMisses= ioWorker.mMisses;
+    for(unsigned int lClass=0; lClass<2; ++lClass)
+    {
+        unsigned int lBegin= ioWorker.mRanges[lClass][0];
+        unsigned int lEnd= ioWorker.mRanges[lClass][1];
+        unsigned int lPositiveClass= (lClass == 0);
+        unsigned int* lPredicted= (lClass == 0) ? ioWorker.mTruePositives : ioWorker.mFalsePositives;
+        for(unsigned int lTile=lBegin; lTile<lEnd; lTile+= ioWorker.mTileRows)
+        {
+            unsigned int lTileEnd= std::min(lEnd, lTile+ ioWorker.mTileRows);
+            for(unsigned int k=ioWorker.mBegin; k<ioWorker.mEnd; ++k)
+            {
+                SharedLibEvalOp::ApplyIndividual lApplyIndividual= ioWorker.mFunctions[k];
+                unsigned int lCount= 0;
+                float* lRow= const_cast<float*>(ioWorker.mSample)+ lTile* ioWorker.mRowStride;
+                if (lMisses == NULL)
+                {
+                    for(unsigned int i=lTile; i<lTileEnd; ++i, lRow+= ioWorker.mRowStride)
+                    {
+                        lCount+= (lApplyIndividual(lRow) != 0)* ioWorker.mWeights[i];
+                    }
+                }
+                else
+                {
+                    for(unsigned int i=lTile; i<lTileEnd; ++i, lRow+= ioWorker.mRowStride)
+                    {
+                        unsigned int lPositive= (lApplyIndividual(lRow) != 0);
+                        lCount+= lPositive* ioWorker.mWeights[i];
+                        lMisses[i]+= lPositive ^ lPositiveClass;
+                    }
+                }
+                lPredicted[k]+= lCount;
+            }
+        }
+    }
+}
+
+/*!
+ * Thread entry: pin the thread, if requested, then apply the worker's tiles.
+ */
+void* runTileWorker(void* ioWorker)
+{
+    TileWorker& lWorker= *static_cast<TileWorker*>(ioWorker);
+    if (!lWorker.mCpus.empty())
+    {
+        NumaTopology::pin(lWorker.mCpus);
+    }
+    applyTiles(lWorker);
+    return NULL;
+}
+
+/*!
+ * A copy of the training set to be allocated and written by a thread on a NUMA node.
+ */
+struct ReplicaJob
+{
+    const SharedLibEvalOp::SampleBlock* mSample;  //!< Training set to copy.
+    SharedLibEvalOp::SampleBlock* mReplica;       //!< Copy, empty before.
+    std::vector<int> mCpus;                       //!< CPUs of the node.
+};
+
+/*!
+ * Thread entry: pin the thread to the node, then copy the training set; the kernel
+ * places the pages of the copy on the node of the thread first writing them.
+ */
+void* copyReplica(void* ioJob)
+{
+    ReplicaJob& lJob= *static_cast<ReplicaJob*>(ioJob);
+    NumaTopology::pin(lJob.mCpus);
+    lJob.mReplica->assign(lJob.mSample->begin(), lJob.mSample->end());
+    return NULL;
+}
+
+}
+
 /*!
  *  \brief Construct a new evaluation operator for shared libraries.
+ *  \param inName Name of the operator.
  */
-SharedLibEvalOp::SharedLibEvalOp() :
-  Beagle::GP::EvaluationOp("SharedLibEvalOp")
+SharedLibEvalOp::SharedLibEvalOp(std::string inName) :
+  Beagle::GP::EvaluationOp(inName),
+  mSharedLibHandle(NULL),
+  mSharedLibHandleExact(NULL),
+  mGeneration(-1),
+  mDemeIndex(-1),
+  mTrainingSetSize(0),
+  mNrColumns(0),
+  mRowStride(0),
+  mNrSamplesPositive(0),
+  mNrSamplesNegative(0),
+  mCountMisses(false),
+  mWeighted(false),
+  mPerfMapFile(NULL),
+  mNrBitmapEvaluations(0),
+  mNrEvaluations(0)
 {
-  mSharedLibHandle = NULL;
 }
 
 /*!
@@ -29,6 +150,14 @@ SharedLibEvalOp::~SharedLibEvalOp()
     {
         dlclose(this->mSharedLibHandle);
     }
+    if (this->mSharedLibHandleExact)
+    {
+        dlclose(this->mSharedLibHandleExact);
+    }
+    if (mPerfMapFile != NULL)
+    {
+        fclose(mPerfMapFile);
+    }
 }
 
 
@@ -42,55 +171,21 @@ Fitness::Handle SharedLibEvalOp::evaluate(GP::Individual& inIndividual, GP::Cont
 {
     Beagle_StackTraceBeginM();
 
+    // Return the fitness computed by operate, if any.
+    unsigned int lIndex= ioContext.getIndividualIndex();
+    if (lIndex < mFitnesses.size() && mFitnesses[lIndex] != NULL)
+    {
+        return mFitnesses[lIndex];
+    }
+
     std::ostringstream lOSS;
     lOSS << "Evaluating individual " << ioContext.getIndividualIndex() << ", deme ";
     lOSS << ioContext.getDemeIndex() << ", generation " << ioContext.getGeneration(); 
     Beagle_LogDebugM(ioContext.getSystem().getLogger(), "evaluate", "Beagle::GP::SpamebaseEvalOp", lOSS.str());
 
-    GP::PrimitiveSuperSet::Handle lPrimitiveSuperSet= 
-        castHandleT<GP::PrimitiveSuperSet>(ioContext.getSystem().getComponent("GP-PrimitiveSuperSet"));
-    GP::PrimitiveSet::Handle lPrimitiveSet= (*lPrimitiveSuperSet)[0];
+    // Open the shared library and draw the training set, once per generation and deme.
+    prepare(ioContext);
 
-    // Get a handle on the shared library used for evaluation.
-    // TODO: Open shared lib only once per generation!
-    this->mTimer.reset();
-    if (this->mSharedLibHandle)
-    {
-        dlclose(this->mSharedLibHandle);
-        Beagle_LogDebugM(
-            ioContext.getSystem().getLogger(), "evaluate", "Beagle::GP::SpamebaseEvalOp", 
-            "Closed previously opened shared lib.");
-    }
-    if (!ioContext.getSystem().getRegister().isRegistered("icu.compiler.lib-path"))
-    {
-        throw Beagle_RunTimeExceptionM("Parameter icu.compiler.lib-path not found in registry; make sure to apply SharedLibCompilerOp before applying SharedLibEvalOp.");    
-    }
-    std::string lLibName= castHandleT<String>(ioContext.getSystem().getRegister()["icu.compiler.lib-path"])->getWrappedValue();
-    this->mSharedLibHandle= dlopen((const char*)lLibName.c_str(), RTLD_LAZY);
-    if (!this->mSharedLibHandle) 
-    {
-        throw Beagle_RunTimeExceptionM("Cannot open shared library "+ lLibName+ ": "+ dlerror()+ ".");
-    }
-    dlerror();
-
-    // Draw a sample from the data set to construct the training set.
-    
-    this->mTimer.reset();
-	// Get a handle on D, S, and L.
-    DataSetBinaryClassification::Handle lDataSet= castHandleT<DataSetBinaryClassification>(ioContext.getSystem().getComponent("DataSet"));
-    std::vector<unsigned int>* lIndexesPositives= lDataSet->getIndexesPositives();
-    std::vector<unsigned int>* lIndexesNegatives= lDataSet->getIndexesNegatives();
-    int lNrSamplesPositive= castHandleT<Int>(ioContext.getSystem().getRegister()["icu.trainingset.size-pos"])->getWrappedValue();
-    int lNrSamplesNegative= castHandleT<Int>(ioContext.getSystem().getRegister()["icu.trainingset.size-neg"])->getWrappedValue();
-    
-    // Shuffle both negative and positive indexes.
-    std::random_shuffle(lIndexesPositives->begin(), lIndexesPositives->end(), ioContext.getSystem().getRandomizer());
-    std::random_shuffle(lIndexesNegatives->begin(), lIndexesNegatives->end(), ioContext.getSystem().getRandomizer());
-    
-    // Nr of columns in each row in the dataset.
-    int lNrColumns= castHandleT<Int>(ioContext.getSystem().getRegister()["icu.dataset.columns"])->getWrappedValue();
-    
-    double lTimeInit= this->mTimer.getValue();
     this->mTimer.reset();
 
     // Evaluate sampled test cases
@@ -98,49 +193,8 @@ Fitness::Handle SharedLibEvalOp::evaluate(GP::Individual& inIndividual, GP::Cont
     unsigned int lTrueNegatives = 0;
     unsigned int lFalsePositives= 0;
     unsigned int lFalseNegatives= 0;
-    int (*apply_individual)(float[])= 0;
-    float lValues[lNrColumns];
-    std::vector<unsigned int>::iterator lLastIndex= lIndexesPositives->begin()+ lNrSamplesPositive;
-
-
-    // Positives.
-    for(std::vector<unsigned int>::const_iterator lIndex=lIndexesPositives->begin(); lIndex!=lLastIndex; ++lIndex)
-    {
-        const Beagle::Vector& lData = (*lDataSet)[*lIndex].second;
-        std::ostringstream lFunctionName;
-        lFunctionName << "apply_individual_";
-        lFunctionName << ioContext.getGeneration() << "_" << ioContext.getDemeIndex() << "_" << ioContext.getIndividualIndex();
-        apply_individual= (int(*)(float*))dlsym(this->mSharedLibHandle, lFunctionName.str().c_str());
-        char* lError= 0;
-        if ((lError = dlerror()) != NULL) {
-            throw Beagle_RunTimeExceptionM("Error loading function "+ lFunctionName.str()+ ": "+ lError+ ".");
-        }
-        for(unsigned int j=0; j<lData.size(); ++j) {
-            lValues[j]= Float(lData[j]);
-        }		
-        bool lResult= apply_individual(lValues);
-        (lResult == 1) ? lTruePositives++ : lFalseNegatives++;
-    }
-    // Negatives.
-    lLastIndex= lIndexesNegatives->begin()+ lNrSamplesNegative;
-    for(std::vector<unsigned int>::const_iterator lIndex=lIndexesNegatives->begin(); lIndex!=lLastIndex; ++lIndex)
-    {
-        const Beagle::Vector& lData = (*lDataSet)[*lIndex].second;
-        std::ostringstream lFunctionName;
-        lFunctionName << "apply_individual_";
-        lFunctionName << ioContext.getGeneration() << "_" << ioContext.getDemeIndex() << "_" << ioContext.getIndividualIndex();
-        apply_individual= (int(*)(float*))dlsym(this->mSharedLibHandle, lFunctionName.str().c_str());
-        char* lError= 0;
-        if ((lError = dlerror()) != NULL) {
-            throw Beagle_RunTimeExceptionM("Error loading function "+ lFunctionName.str()+ ": "+ lError+ ".");
-        }
-        for(unsigned int j=0; j<lData.size(); ++j) {
-            lValues[j]= Float(lData[j]);
-        }		
-        bool lResult= apply_individual(lValues);
-        (lResult == 0) ? lTrueNegatives++ : lFalsePositives++;
-    }
-
+    evaluateIndividual(inIndividual, ioContext, ioContext.getIndividualIndex(), mNrSamplesPositive, mNrSamplesNegative,
+                       lTruePositives, lFalsePositives, lTrueNegatives, lFalseNegatives);
 
     double lTimeEvaluate= this->mTimer.getValue();
 
@@ -169,6 +223,882 @@ Fitness::Handle SharedLibEvalOp::evaluate(GP::Individual& inIndividual, GP::Cont
     Beagle_StackTraceEndM("SharedLibEvalOp::evaluate(GP::Individual& inIndividual, GP::Context& ioContext)");
 }
 
+/*!
+ *  \brief Open the shared library of the current generation and deme, draw the training set.
+ *  \param ioContext Evolutionary context.
+ *
+ *  Nothing is done, if the library currently open has been compiled for the
+ *  generation and deme in ioContext.
+ */
+void SharedLibEvalOp::prepare(GP::Context& ioContext)
+{
+    Beagle_StackTraceBeginM();
+
+    if (!ioContext.getSystem().getRegister().isRegistered("icu.compiler.lib-path"))
+    {
+        throw Beagle_RunTimeExceptionM("Parameter icu.compiler.lib-path not found in registry; make sure to apply SharedLibCompilerOp before applying SharedLibEvalOp.");    
+    }
+    std::string lLibName= castHandleT<String>(ioContext.getSystem().getRegister()["icu.compiler.lib-path"])->getWrappedValue();
+    if (this->mSharedLibHandle && lLibName == mSharedLibPath &&
+        (int)ioContext.getGeneration() == mGeneration && (int)ioContext.getDemeIndex() == mDemeIndex)
+    {
+        return;
+    }
+
+    // Get a handle on the shared library used for evaluation.
+    this->mTimer.reset();
+    mCounters->begin(HardwareCounters::eOpen);
+    if (this->mSharedLibHandle)
+    {
+        dlclose(this->mSharedLibHandle);
+        this->mSharedLibHandle= NULL;
+        Beagle_LogDebugM(
+            ioContext.getSystem().getLogger(), "evaluate", "Beagle::GP::SpamebaseEvalOp", 
+            "Closed previously opened shared lib.");
+    }
+    this->mSharedLibHandle= dlopen((const char*)lLibName.c_str(), RTLD_LAZY);
+    if (!this->mSharedLibHandle) 
+    {
+        throw Beagle_RunTimeExceptionM("Cannot open shared library "+ lLibName+ ": "+ dlerror()+ ".");
+    }
+    dlerror();
+
+    // Open the library compiled in exact math mode, if fast math is to be verified.
+    if (this->mSharedLibHandleExact)
+    {
+        dlclose(this->mSharedLibHandleExact);
+        this->mSharedLibHandleExact= NULL;
+    }
+    if (ioContext.getSystem().getRegister().isRegistered("icu.compiler.lib-path-exact"))
+    {
+        std::string lLibNameExact= castHandleT<String>(ioContext.getSystem().getRegister()["icu.compiler.lib-path-exact"])->getWrappedValue();
+        if (!lLibNameExact.empty())
+        {
+            this->mSharedLibHandleExact= dlopen(lLibNameExact.c_str(), RTLD_LAZY);
+            if (!this->mSharedLibHandleExact)
+            {
+                throw Beagle_RunTimeExceptionM("Cannot open shared library "+ lLibNameExact+ ": "+ dlerror()+ ".");
+            }
+            dlerror();
+        }
+    }
+    mSharedLibPath= lLibName;
+    mGeneration= ioContext.getGeneration();
+    mDemeIndex= ioContext.getDemeIndex();
+    if (mPerfMap->getWrappedValue())
+    {
+        writePerfMap(ioContext);
+    }
+    double lTimeOpen= this->mTimer.getValue();
+    mCounters->end(HardwareCounters::eOpen);
+
+    // Draw a sample from the data set to construct the training set.
+    this->mTimer.reset();
+    mCounters->begin(HardwareCounters::eSample);
+    flushMisses(ioContext);
+    drawSample(ioContext);
+    double lTimeSample= this->mTimer.getValue();
+    mCounters->end(HardwareCounters::eSample);
+
+    std::ostringstream lOSS;
+    lOSS << "g" << mGeneration << " d" << mDemeIndex << ": opened " << lLibName;
+    lOSS << " in " << lTimeOpen << "s, sampled " << mNrSamplesPositive << " positive and ";
+    lOSS << mNrSamplesNegative << " negative rows in " << lTimeSample << "s.";
+    Beagle_LogDetailedM(ioContext.getSystem().getLogger(), "prepare", "Beagle::GP::SharedLibEvalOp", lOSS.str());
+
+    Beagle_StackTraceEndM("void SharedLibEvalOp::prepare(GP::Context& ioContext)");
+}
+
+/*!
+ *  \brief Write the functions of the library opened last to the perf map of this process.
+ *  \param ioContext Evolutionary context, providing generation and deme.
+ *
+ *  perf resolves samples in code it finds no symbols for, e.g. in libraries compiled in
+ *  memory or unloaded since, from /tmp/perf-<pid>.map: one line per symbol, holding its
+ *  start address and size in hex, and its name. Each function of fgp_individuals is
+ *  located by dladdr1, its size taken from its ELF symbol; the name carries the number
+ *  of nodes and the depth of the individual's tree. Libraries of later generations may be
+ *  mapped at the addresses of earlier ones; perf then attributes samples to the entry
+ *  written last.
+ */
+void SharedLibEvalOp::writePerfMap(GP::Context& ioContext)
+{
+    Beagle_StackTraceBeginM();
+
+    typedef int (*Function)(float in[]);
+    Function* lFunctions= (Function*)dlsym(this->mSharedLibHandle, "fgp_individuals");
+    if (lFunctions == NULL)
+    {
+        dlerror();
+        return;
+    }
+    if (mPerfMapFile == NULL)
+    {
+        char lPath[64];
+        snprintf(lPath, sizeof(lPath), "/tmp/perf-%d.map", (int)getpid());
+        mPerfMapFile= fopen(lPath, "a");
+        if (mPerfMapFile == NULL)
+        {
+            Beagle_LogInfoM(ioContext.getSystem().getLogger(), "writePerfMap", "Beagle::GP::SharedLibEvalOp",
+                std::string("Cannot open ")+ lPath+ ", perf map disabled.");
+            mPerfMap->getWrappedValue()= false;
+            return;
+        }
+    }
+
+    Beagle::Deme& lDeme= ioContext.getDeme();
+    unsigned int lNrWritten= 0;
+    for(unsigned int i=0; lFunctions[i] != NULL; ++i)
+    {
+        Dl_info lInfo;
+        const ElfW(Sym)* lSymbol= NULL;
+        if (dladdr1((void*)lFunctions[i], &lInfo, (void**)&lSymbol, RTLD_DL_SYMENT) == 0 || lSymbol == NULL || lSymbol->st_size == 0)
+        {
+            continue;
+        }
+        fprintf(mPerfMapFile, "%lx %lx apply_individual_%u_%u_%u", (unsigned long)lFunctions[i], (unsigned long)lSymbol->st_size,
+                ioContext.getGeneration(), ioContext.getDemeIndex(), i);
+        if (i < lDeme.size())
+        {
+            GP::Individual& lIndividual= castObjectT<GP::Individual&>(*lDeme[i]);
+            fprintf(mPerfMapFile, " nodes=%u depth=%u", lIndividual.getTotalNodes(), lIndividual.getMaxTreeDepth());
+        }
+        fputc('\n', mPerfMapFile);
+        lNrWritten++;
+    }
+    fflush(mPerfMapFile);
+
+    std::ostringstream lOSS;
+    lOSS << "g" << ioContext.getGeneration() << " d" << ioContext.getDemeIndex() << ": ";
+    lOSS << lNrWritten << " functions written to the perf map.";
+    Beagle_LogDebugM(ioContext.getSystem().getLogger(), "writePerfMap", "Beagle::GP::SharedLibEvalOp", lOSS.str());
+
+    Beagle_StackTraceEndM("void SharedLibEvalOp::writePerfMap(GP::Context&)");
+}
+
+/*!
+ *  \brief Draw a stratified sample from the data set, pack it into mSample.
+ *  \param ioContext Evolutionary context.
+ *
+ *  The number of positive and negative rows are taken from the parameters
+ *  icu.trainingset.size-pos and icu.trainingset.size-neg, as set by TrainingSetSamplingOp.
+ */
+void SharedLibEvalOp::drawSample(GP::Context& ioContext)
+{
+    Beagle_StackTraceBeginM();
+
+	// Get a handle on D, S, and L.
+    DataSetBinaryClassification::Handle lDataSet= castHandleT<DataSetBinaryClassification>(ioContext.getSystem().getComponent("DataSet"));
+    std::vector<unsigned int>* lIndexesPositives= lDataSet->getIndexesPositives();
+    std::vector<unsigned int>* lIndexesNegatives= lDataSet->getIndexesNegatives();
+    mNrSamplesPositive= castHandleT<Int>(ioContext.getSystem().getRegister()["icu.trainingset.size-pos"])->getWrappedValue();
+    mNrSamplesNegative= castHandleT<Int>(ioContext.getSystem().getRegister()["icu.trainingset.size-neg"])->getWrappedValue();
+    mNrSamplesPositive= std::min<unsigned int>(mNrSamplesPositive, lIndexesPositives->size());
+    mNrSamplesNegative= std::min<unsigned int>(mNrSamplesNegative, lIndexesNegatives->size());
+
+    // Shuffle both negative and positive indexes, unless TrainingSetSamplingOp has selected the training set.
+    if (!lDataSet->isPresampled())
+    {
+        std::random_shuffle(lIndexesPositives->begin(), lIndexesPositives->end(), ioContext.getSystem().getRandomizer());
+        std::random_shuffle(lIndexesNegatives->begin(), lIndexesNegatives->end(), ioContext.getSystem().getRandomizer());
+    }
+
+    // Nr of columns in each row in the dataset, and the columns packed into the training set.
+    mNrColumns= castHandleT<Int>(ioContext.getSystem().getRegister()["icu.dataset.columns"])->getWrappedValue();
+    std::vector<unsigned int> lColumns;
+    if (ioContext.getSystem().getRegister().isRegistered("icu.compiler.columns"))
+    {
+        UIntArray::Handle lPacked= castHandleT<UIntArray>(ioContext.getSystem().getRegister()["icu.compiler.columns"]);
+        lColumns.assign(lPacked->begin(), lPacked->end());
+    }
+    if (lColumns.empty())
+    {
+        for(unsigned int j=0; j<mNrColumns; ++j) lColumns.push_back(j);
+    }
+    unsigned int lNrPacked= lColumns.size();
+
+    // Pack the first mNrSamplesPositive positive and mNrSamplesNegative negative rows.
+    mSampleRows.assign(lIndexesPositives->begin(), lIndexesPositives->begin()+ mNrSamplesPositive);
+    mSampleRows.insert(mSampleRows.end(), lIndexesNegatives->begin(), lIndexesNegatives->begin()+ mNrSamplesNegative);
+    weighSample(lDataSet->size());
+    if (lDataSet->isQuantized())
+    {
+        // Pack level codes instead of floats, padding each row to a multiple of sizeof(float).
+        unsigned int lCodeBytes= lDataSet->getCodeBytes();
+        mRowStride= (lNrPacked* lCodeBytes+ sizeof(float)- 1)/ sizeof(float);
+        mSample.assign(mSampleRows.size()* mRowStride, 0.0f);
+        for(unsigned int i=0; i<mSampleRows.size(); ++i)
+        {
+            float* lRow= &mSample[0]+ i* mRowStride;
+            for(unsigned int j=0; j<lNrPacked; ++j)
+            {
+                if (lCodeBytes == 1) ((unsigned char*)lRow)[j]= lDataSet->getCode(mSampleRows[i], lColumns[j]);
+                else ((unsigned short*)lRow)[j]= lDataSet->getCode(mSampleRows[i], lColumns[j]);
+            }
+        }
+    }
+    else
+    {
+        mRowStride= lNrPacked;
+        mSample.resize(mSampleRows.size()* mRowStride);
+        SampleBlock::iterator lValue= mSample.begin();
+        for(unsigned int i=0; i<mSampleRows.size(); ++i)
+        {
+            const Beagle::Vector& lData = (*lDataSet)[mSampleRows[i]].second;
+            for(unsigned int j=0; j<lNrPacked; ++j, ++lValue) {
+                *lValue= (float)lData[lColumns[j]];
+            }
+        }
+    }
+
+    // Give each NUMA node a local copy of the training set.
+    replicateSample();
+
+    // Index the training set; bitmaps cached for the previous one are dropped.
+    if (mUseBitmapIndex->getWrappedValue())
+    {
+        mBitmapIndex.build(lDataSet, mSampleRows, mNrColumns);
+    }
+
+    // Reset misclassification counts.
+    mCountMisses= ioContext.getSystem().getRegister().isRegistered("icu.trainingset.mode") &&
+        castHandleT<String>(ioContext.getSystem().getRegister()["icu.trainingset.mode"])->getWrappedValue() == "dynamic";
+    if (mCountMisses)
+    {
+        unsigned int lNrRows= mNrSamplesPositive+ mNrSamplesNegative;
+        mMissBits.assign((lNrRows+ 63)/ 64, 0);
+        mMisses.assign(lNrRows, 0);
+        mEvaluationsPositive.assign(mNrSamplesPositive+ 1, 0);
+        mEvaluationsNegative.assign(mNrSamplesNegative+ 1, 0);
+    }
+
+    Beagle_StackTraceEndM("void SharedLibEvalOp::drawSample(GP::Context& ioContext)");
+}
+
+/*!
+ *  \brief Collapse rows drawn several times into one row of mSampleRows, weighted by the number of draws.
+ *  \param inNrRows Number of rows of the data set.
+ *
+ *  Identical rows read from the data file have been collapsed by the data set already,
+ *  they are indexed, and may be drawn, several times. Positive rows stay in front of negative rows,
+ *  both in order of first draw; mNrSamplesPositive and mNrSamplesNegative count distinct rows afterwards.
+ */
+void SharedLibEvalOp::weighSample(unsigned int inNrRows)
+{
+    Beagle_StackTraceBeginM();
+
+    // Both buffers, and mRowPositions, keep their capacity from one training set to the next.
+    mDrawnRows.swap(mSampleRows);
+    mSampleRows.clear();
+    mSampleWeights.clear();
+    if (mRowPositions.size() != inNrRows)
+    {
+        mRowPositions.assign(inNrRows, ~0U);
+    }
+    unsigned int lNrPositives= 0;
+    for(unsigned int i=0; i<mDrawnRows.size(); ++i)
+    {
+        // Rows of both classes never coincide, as labels are part of identity.
+        unsigned int& lPosition= mRowPositions[mDrawnRows[i]];
+        if (lPosition == ~0U)
+        {
+            lPosition= mSampleRows.size();
+            mSampleRows.push_back(mDrawnRows[i]);
+            mSampleWeights.push_back(1);
+            if (i < mNrSamplesPositive) lNrPositives++;
+        }
+        else
+        {
+            mSampleWeights[lPosition]++;
+        }
+    }
+    for(unsigned int i=0; i<mSampleRows.size(); ++i)
+    {
+        mRowPositions[mSampleRows[i]]= ~0U;
+    }
+    mNrSamplesPositive= lNrPositives;
+    mNrSamplesNegative= mSampleRows.size()- lNrPositives;
+    mWeighted= (mSampleRows.size() < mDrawnRows.size());
+
+    mSampleWeightSums.assign(1, 0);
+    for(unsigned int i=0; i<mSampleWeights.size(); ++i)
+    {
+        mSampleWeightSums.push_back(mSampleWeightSums.back()+ mSampleWeights[i]);
+    }
+
+    Beagle_StackTraceEndM("void SharedLibEvalOp::weighSample(unsigned int)");
+}
+
+/*!
+ *  \brief Look up the function evaluating an individual in the shared library.
+ *  \param ioContext Evolutionary context, providing generation and deme.
+ *  \param inIndividualIndex Index of the individual in the deme.
+ *  \return Pointer to apply_individual_GENERATION_DEME_INDIVIDUAL.
+ */
+SharedLibEvalOp::ApplyIndividual SharedLibEvalOp::getApplyIndividual(GP::Context& ioContext, unsigned int inIndividualIndex) const
+{
+    return getApplyIndividual(ioContext, inIndividualIndex, this->mSharedLibHandle);
+}
+
+/*!
+ *  \brief Look up the function evaluating an individual in the shared library inSharedLibHandle.
+ *  \param ioContext Evolutionary context, providing generation and deme.
+ *  \param inIndividualIndex Index of the individual in the deme.
+ *  \param inSharedLibHandle Handle on the library to look up the function in.
+ *  \return Pointer to apply_individual_GENERATION_DEME_INDIVIDUAL.
+ */
+SharedLibEvalOp::ApplyIndividual SharedLibEvalOp::getApplyIndividual(GP::Context& ioContext, unsigned int inIndividualIndex, void* inSharedLibHandle) const
+{
+    Beagle_StackTraceBeginM();
+
+    char lFunctionName[64];
+    snprintf(lFunctionName, sizeof(lFunctionName), "apply_individual_%u_%u_%u",
+             ioContext.getGeneration(), ioContext.getDemeIndex(), inIndividualIndex);
+    ApplyIndividual lApplyIndividual= (ApplyIndividual)dlsym(inSharedLibHandle, lFunctionName);
+    char* lError= 0;
+    if ((lError = dlerror()) != NULL) {
+        throw Beagle_RunTimeExceptionM("Error loading function "+ std::string(lFunctionName)+ ": "+ lError+ ".");
+    }
+    return lApplyIndividual;
+
+    Beagle_StackTraceEndM("SharedLibEvalOp::ApplyIndividual SharedLibEvalOp::getApplyIndividual(GP::Context&, unsigned int, void*) const");
+}
+
+/*!
+ *  \brief Classify rows of the training set, count the outcomes.
+ *  \param inApplyIndividual Function representing the individual.
+ *  \param inNrPositives Number of positive rows to classify, from the start of the positive rows.
+ *  \param inNrNegatives Number of negative rows to classify, from the start of the negative rows.
+ *
+ *  Taking the first rows of both classes keeps smaller samples stratified.
+ */
+void SharedLibEvalOp::evaluateSample(ApplyIndividual inApplyIndividual,
+                                     unsigned int inNrPositives,
+                                     unsigned int inNrNegatives,
+                                     unsigned int& outTruePositives,
+                                     unsigned int& outFalsePositives,
+                                     unsigned int& outTrueNegatives,
+                                     unsigned int& outFalseNegatives)
+{
+    outTruePositives= 0;
+    outFalsePositives= 0;
+    outTrueNegatives= 0;
+    outFalseNegatives= 0;
+    if (mSample.empty()) return;
+
+    // Each row counts as often as it has been drawn.
+    const unsigned int* lWeight= &mSampleWeights[0];
+    if (!mCountMisses)
+    {
+        // Positives.
+        float* lRow= &mSample[0];
+        for(unsigned int i=0; i<inNrPositives; ++i, lRow+= mRowStride)
+        {
+            outTruePositives+= (inApplyIndividual(lRow) != 0)* lWeight[i];
+        }
+        outFalseNegatives= getSampleWeight(0, inNrPositives)- outTruePositives;
+        // Negatives.
+        lRow= &mSample[0]+ mNrSamplesPositive* mRowStride;
+        for(unsigned int i=mNrSamplesPositive; i<mNrSamplesPositive+ inNrNegatives; ++i, lRow+= mRowStride)
+        {
+            outFalsePositives+= (inApplyIndividual(lRow) != 0)* lWeight[i];
+        }
+        outTrueNegatives= getSampleWeight(mNrSamplesPositive, mNrSamplesPositive+ inNrNegatives)- outFalsePositives;
+        return;
+    }
+
+    // Same as above, additionally set a bit for each row misclassified.
+    std::fill(mMissBits.begin(), mMissBits.end(), 0);
+    float* lRow= &mSample[0];
+    for(unsigned int i=0; i<inNrPositives; ++i, lRow+= mRowStride)
+    {
+        unsigned long lMiss= (inApplyIndividual(lRow) == 0);
+        outFalseNegatives+= lMiss* lWeight[i];
+        mMissBits[i/ 64]|= lMiss << (i% 64);
+    }
+    outTruePositives= getSampleWeight(0, inNrPositives)- outFalseNegatives;
+    lRow= &mSample[0]+ mNrSamplesPositive* mRowStride;
+    for(unsigned int i=mNrSamplesPositive; i<mNrSamplesPositive+ inNrNegatives; ++i, lRow+= mRowStride)
+    {
+        unsigned long lMiss= (inApplyIndividual(lRow) != 0);
+        outFalsePositives+= lMiss* lWeight[i];
+        mMissBits[i/ 64]|= lMiss << (i% 64);
+    }
+    outTrueNegatives= getSampleWeight(mNrSamplesPositive, mNrSamplesPositive+ inNrNegatives)- outFalsePositives;
+
+    foldMisses(inNrPositives, inNrNegatives);
+}
+
+/*!
+ *  \brief Fold the bitmap of misclassified rows into the per-row counts.
+ *  \param inNrPositives Number of positive rows classified.
+ *  \param inNrNegatives Number of negative rows classified.
+ */
+void SharedLibEvalOp::foldMisses(unsigned int inNrPositives, unsigned int inNrNegatives)
+{
+    for(unsigned int lWord=0; lWord<mMissBits.size(); ++lWord)
+    {
+        for(unsigned long lBits=mMissBits[lWord]; lBits!=0; lBits&= lBits- 1)
+        {
+            ++mMisses[lWord* 64+ __builtin_ctzl(lBits)];
+        }
+    }
+    ++mEvaluationsPositive[inNrPositives];
+    ++mEvaluationsNegative[inNrNegatives];
+}
+
+/*!
+ *  \brief Classify rows of the training set by an individual, count the outcomes.
+ *  \param inIndividual Individual to evaluate.
+ *  \param ioContext Evolutionary context.
+ *  \param inIndividualIndex Index of the individual in the deme.
+ *  \param inNrPositives Number of positive rows to classify, from the start of the positive rows.
+ *  \param inNrNegatives Number of negative rows to classify, from the start of the negative rows.
+ *
+ *  If the individual's tree can be evaluated from the bitmap index, the compiled
+ *  individual is not called at all; the counts are the same either way.
+ */
+void SharedLibEvalOp::evaluateIndividual(GP::Individual& inIndividual,
+                                         GP::Context& ioContext,
+                                         unsigned int inIndividualIndex,
+                                         unsigned int inNrPositives,
+                                         unsigned int inNrNegatives,
+                                         unsigned int& outTruePositives,
+                                         unsigned int& outFalsePositives,
+                                         unsigned int& outTrueNegatives,
+                                         unsigned int& outFalseNegatives)
+{
+    Beagle_StackTraceBeginM();
+
+    ++mNrEvaluations;
+    if (!evaluateBitmap(inIndividual, inNrPositives, inNrNegatives,
+                        outTruePositives, outFalsePositives, outTrueNegatives, outFalseNegatives))
+    {
+        evaluateSample(getApplyIndividual(ioContext, inIndividualIndex), inNrPositives, inNrNegatives,
+                       outTruePositives, outFalsePositives, outTrueNegatives, outFalseNegatives);
+    }
+
+    Beagle_StackTraceEndM("void SharedLibEvalOp::evaluateIndividual(GP::Individual&, GP::Context&, unsigned int, unsigned int, unsigned int, unsigned int&, unsigned int&, unsigned int&, unsigned int&)");
+}
+
+/*!
+ *  \brief Classify rows of the training set by an individual from the bitmap index, count the outcomes.
+ *  \param inIndividual Individual to evaluate.
+ *  \param inNrPositives Number of positive rows to classify, from the start of the positive rows.
+ *  \param inNrNegatives Number of negative rows to classify, from the start of the negative rows.
+ *  \return False, if the bitmap index is disabled or cannot evaluate the individual's tree.
+ */
+bool SharedLibEvalOp::evaluateBitmap(GP::Individual& inIndividual,
+                                     unsigned int inNrPositives,
+                                     unsigned int inNrNegatives,
+                                     unsigned int& outTruePositives,
+                                     unsigned int& outFalsePositives,
+                                     unsigned int& outTrueNegatives,
+                                     unsigned int& outFalseNegatives)
+{
+    Beagle_StackTraceBeginM();
+
+    if (!mUseBitmapIndex->getWrappedValue() || !mBitmapIndex.evaluate(*inIndividual[0], mPredictionBits))
+    {
+        return false;
+    }
+    ++mNrBitmapEvaluations;
+
+    if (mWeighted)
+    {
+        outTruePositives= ThresholdBitmapIndex::count(mPredictionBits, 0, inNrPositives, mSampleWeights);
+        outFalsePositives= ThresholdBitmapIndex::count(mPredictionBits, mNrSamplesPositive, mNrSamplesPositive+ inNrNegatives, mSampleWeights);
+    }
+    else
+    {
+        outTruePositives= ThresholdBitmapIndex::count(mPredictionBits, 0, inNrPositives);
+        outFalsePositives= ThresholdBitmapIndex::count(mPredictionBits, mNrSamplesPositive, mNrSamplesPositive+ inNrNegatives);
+    }
+    outFalseNegatives= getSampleWeight(0, inNrPositives)- outTruePositives;
+    outTrueNegatives= getSampleWeight(mNrSamplesPositive, mNrSamplesPositive+ inNrNegatives)- outFalsePositives;
+
+    if (mCountMisses)
+    {
+        // Positive rows classified negative, negative rows classified positive.
+        unsigned int lEndPositives= inNrPositives;
+        unsigned int lEndNegatives= mNrSamplesPositive+ inNrNegatives;
+        for(unsigned int lWord=0; lWord<mMissBits.size(); ++lWord)
+        {
+            unsigned long lPositives= 0;
+            unsigned long lNegatives= 0;
+            for(unsigned int lBit=0; lBit<64; ++lBit)
+            {
+                unsigned int lRow= lWord* 64+ lBit;
+                lPositives|= (unsigned long)(lRow < lEndPositives) << lBit;
+                lNegatives|= (unsigned long)(lRow >= mNrSamplesPositive && lRow < lEndNegatives) << lBit;
+            }
+            mMissBits[lWord]= (~mPredictionBits[lWord] & lPositives) | (mPredictionBits[lWord] & lNegatives);
+        }
+        foldMisses(inNrPositives, inNrNegatives);
+    }
+    return true;
+
+    Beagle_StackTraceEndM("bool SharedLibEvalOp::evaluateBitmap(GP::Individual&, unsigned int, unsigned int, unsigned int&, unsigned int&, unsigned int&, unsigned int&)");
+}
+
+/*!
+ *  \brief Score individuals of a deme population-major, tile by tile of the training set.
+ *  \param ioDeme Deme holding the individuals.
+ *  \param ioContext Evolutionary context.
+ *  \param inIndexes Indexes of the individuals to score.
+ *  \param inNrPositives Number of positive rows to classify, from the start of the positive rows.
+ *  \param inNrNegatives Number of negative rows to classify, from the start of the negative rows.
+ *
+ *  Individuals the bitmap index can evaluate are scored from it. All others are applied
+ *  to one tile of rows after the other, so that the training set streams from memory once
+ *  per deme instead of once per individual; icu.eval.threads threads share the individuals.
+ *  The counts are the same as evaluateIndividual's.
+ */
+void SharedLibEvalOp::evaluateDeme(Beagle::Deme& ioDeme,
+                                   GP::Context& ioContext,
+                                   const std::vector<unsigned int>& inIndexes,
+                                   unsigned int inNrPositives,
+                                   unsigned int inNrNegatives)
+{
+    Beagle_StackTraceBeginM();
+
+    if (mFitnesses.size() < ioDeme.size())
+    {
+        mFitnesses.resize(ioDeme.size());
+    }
+    if (mFitnessTable->size() != ioDeme.size())
+    {
+        mFitnessTable->resize(ioDeme.size());
+    }
+    unsigned int lTileRows= getTileRows();
+    std::vector<unsigned int> lTiled;
+    for(unsigned int k=0; k<inIndexes.size(); ++k)
+    {
+        GP::Individual& lIndividual= castObjectT<GP::Individual&>(*ioDeme[inIndexes[k]]);
+        unsigned int lTruePositives, lFalsePositives, lTrueNegatives, lFalseNegatives;
+        if (lTileRows == 0)
+        {
+            evaluateIndividual(lIndividual, ioContext, inIndexes[k], inNrPositives, inNrNegatives,
+                               lTruePositives, lFalsePositives, lTrueNegatives, lFalseNegatives);
+        }
+        else
+        {
+            ++mNrEvaluations;
+            if (!evaluateBitmap(lIndividual, inNrPositives, inNrNegatives,
+                                lTruePositives, lFalsePositives, lTrueNegatives, lFalseNegatives))
+            {
+                lTiled.push_back(inIndexes[k]);
+                continue;
+            }
+        }
+        FitnessMCC::Handle lFitness= new FitnessMCC(lTruePositives, lFalsePositives, lTrueNegatives, lFalseNegatives);
+        mFitnessTable->setCounts(inIndexes[k], lTruePositives, lFalsePositives, lTrueNegatives, lFalseNegatives,
+                                 lFitness->getValue());
+        mFitnesses[inIndexes[k]]= lFitness;
+    }
+    if (lTiled.empty()) return;
+
+    std::vector<ApplyIndividual> lFunctions(lTiled.size());
+    for(unsigned int k=0; k<lTiled.size(); ++k)
+    {
+        lFunctions[k]= getApplyIndividual(ioContext, lTiled[k]);
+    }
+
+    // Rows classified positive, weighted, among positive and among negative rows.
+    std::vector<unsigned int> lTruePositives(lTiled.size(), 0);
+    std::vector<unsigned int> lFalsePositives(lTiled.size(), 0);
+
+    // Share the individuals among the workers; with NUMA placement, worker w runs on
+    // a core of node w modulo the number of nodes, and reads that node's replica.
+    unsigned int lNrWorkers= std::min<unsigned int>(getNrThreads(), lTiled.size());
+    bool lPin= mNuma->getWrappedValue() && lNrWorkers > 1;
+    unsigned int lNrNodes= mTopology.getNrNodes();
+    std::vector<TileWorker> lWorkers(lNrWorkers);
+    unsigned int lNrRows= mNrSamplesPositive+ mNrSamplesNegative;
+    if (mCountMisses) mWorkerMisses.assign((unsigned long)lNrWorkers* lNrRows, 0);
+    else mWorkerMisses.clear();
+    for(unsigned int w=0; w<lNrWorkers; ++w)
+    {
+        TileWorker& lWorker= lWorkers[w];
+        unsigned int lNode= w% lNrNodes;
+        lWorker.mSample= mSample.empty() ? NULL : (mReplicas.empty() ? &mSample[0] : &mReplicas[lNode][0]);
+        lWorker.mRowStride= mRowStride;
+        lWorker.mWeights= mSampleWeights.empty() ? NULL : &mSampleWeights[0];
+        lWorker.mRanges[0][0]= 0;
+        lWorker.mRanges[0][1]= inNrPositives;
+        lWorker.mRanges[1][0]= mNrSamplesPositive;
+        lWorker.mRanges[1][1]= mNrSamplesPositive+ inNrNegatives;
+        lWorker.mTileRows= lTileRows;
+        lWorker.mFunctions= &lFunctions[0];
+        lWorker.mBegin= (unsigned long)w* lTiled.size()/ lNrWorkers;
+        lWorker.mEnd= (unsigned long)(w+ 1)* lTiled.size()/ lNrWorkers;
+        lWorker.mTruePositives= &lTruePositives[0];
+        lWorker.mFalsePositives= &lFalsePositives[0];
+        lWorker.mMisses= mWorkerMisses.empty() ? NULL : &mWorkerMisses[0]+ (unsigned long)w* lNrRows;
+        if (lPin)
+        {
+            const std::vector<int>& lCpus= mTopology.getCpus(lNode);
+            lWorker.mCpus.assign(1, lCpus[(w/ lNrNodes)% lCpus.size()]);
+        }
+    }
+    if (lNrWorkers == 1)
+    {
+        applyTiles(lWorkers[0]);
+    }
+    else
+    {
+        // A worker whose thread cannot be started runs in this thread.
+        std::vector<pthread_t> lThreads(lNrWorkers);
+        std::vector<bool> lStarted(lNrWorkers, false);
+        for(unsigned int w=0; w<lNrWorkers; ++w)
+        {
+            lStarted[w]= (pthread_create(&lThreads[w], NULL, runTileWorker, &lWorkers[w]) == 0);
+        }
+        for(unsigned int w=0; w<lNrWorkers; ++w)
+        {
+            if (lStarted[w]) pthread_join(lThreads[w], NULL);
+            else applyTiles(lWorkers[w]);
+        }
+    }
+
+    // Sum the misclassifications in worker order.
+    if (mCountMisses)
+    {
+        for(unsigned int w=0; w<lNrWorkers; ++w)
+        {
+            for(unsigned int i=0; i<lNrRows; ++i)
+            {
+                mMisses[i]+= lWorkers[w].mMisses[i];
+            }
+        }
+    }
+
+    unsigned int lWeightPositives= getSampleWeight(0, inNrPositives);
+    unsigned int lWeightNegatives= getSampleWeight(mNrSamplesPositive, mNrSamplesPositive+ inNrNegatives);
+    for(unsigned int k=0; k<lTiled.size(); ++k)
+    {
+        unsigned int lTrueNegatives= lWeightNegatives- lFalsePositives[k];
+        unsigned int lFalseNegatives= lWeightPositives- lTruePositives[k];
+        FitnessMCC::Handle lFitness= new FitnessMCC(lTruePositives[k], lFalsePositives[k], lTrueNegatives, lFalseNegatives);
+        mFitnessTable->setCounts(lTiled[k], lTruePositives[k], lFalsePositives[k], lTrueNegatives, lFalseNegatives,
+                                 lFitness->getValue());
+        mFitnesses[lTiled[k]]= lFitness;
+    }
+    if (mCountMisses)
+    {
+        mEvaluationsPositive[inNrPositives]+= lTiled.size();
+        mEvaluationsNegative[inNrNegatives]+= lTiled.size();
+    }
+
+    Beagle_StackTraceEndM("void SharedLibEvalOp::evaluateDeme(Deme&, GP::Context&, const std::vector<unsigned int>&, unsigned int, unsigned int)");
+}
+
+/*!
+ *  \brief Return the number of rows per tile for evaluateDeme.
+ *  \return Rows per tile, 0 if tiling is disabled.
+ *
+ *  If icu.eval.tile-rows is 0, a tile, with the weight and miss count of each row
+ *  (the latter in dynamic mode only), fills half the L2 cache, leaving the rest to the compiled individuals.
+ */
+unsigned int SharedLibEvalOp::getTileRows() const
+{
+    int lTileRows= mTileRows->getWrappedValue();
+    if (lTileRows < 0) return 0;
+    if (lTileRows > 0) return lTileRows;
+
+    long lCacheBytes= 256* 1024;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    if (sysconf(_SC_LEVEL2_CACHE_SIZE) > 0)
+    {
+        lCacheBytes= sysconf(_SC_LEVEL2_CACHE_SIZE);
+    }
+#endif
+    unsigned int lRowBytes= mRowStride* sizeof(float)+ 2* sizeof(unsigned int);
+    return std::max<unsigned int>(64, lCacheBytes/ 2/ lRowBytes);
+}
+
+/*!
+ *  \brief Return the number of threads for evaluateDeme, one per CPU if icu.eval.threads is 0.
+ */
+unsigned int SharedLibEvalOp::getNrThreads() const
+{
+    int lNrThreads= mNrThreads->getWrappedValue();
+    return (lNrThreads > 0) ? lNrThreads : mTopology.getNrCpus();
+}
+
+/*!
+ *  \brief Copy the training set onto each NUMA node, if several threads evaluate on several nodes.
+ *
+ *  Each copy is allocated and written by a thread pinned to its node, so that its pages are
+ *  local to the workers evaluateDeme runs there. If a thread cannot be started, the copy
+ *  is made by the calling thread instead, and may be remote.
+ */
+void SharedLibEvalOp::replicateSample()
+{
+    Beagle_StackTraceBeginM();
+
+    mReplicas.clear();
+    unsigned int lNrNodes= mTopology.getNrNodes();
+    if (!mNuma->getWrappedValue() || getNrThreads() < 2 || lNrNodes < 2 || mSample.empty()) return;
+
+    mReplicas.resize(lNrNodes);
+    std::vector<ReplicaJob> lJobs(lNrNodes);
+    std::vector<pthread_t> lThreads(lNrNodes);
+    std::vector<bool> lStarted(lNrNodes, false);
+    for(unsigned int n=0; n<lNrNodes; ++n)
+    {
+        lJobs[n].mSample= &mSample;
+        lJobs[n].mReplica= &mReplicas[n];
+        lJobs[n].mCpus= mTopology.getCpus(n);
+        lStarted[n]= (pthread_create(&lThreads[n], NULL, copyReplica, &lJobs[n]) == 0);
+    }
+    for(unsigned int n=0; n<lNrNodes; ++n)
+    {
+        if (lStarted[n]) pthread_join(lThreads[n], NULL);
+        else mReplicas[n]= mSample;
+    }
+
+    Beagle_StackTraceEndM("void SharedLibEvalOp::replicateSample()");
+}
+
+/*!
+ *  \brief Add the misclassification counts to the data set, reset the counts.
+ *  \param ioContext Evolutionary context.
+ */
+void SharedLibEvalOp::flushMisses(GP::Context& ioContext)
+{
+    Beagle_StackTraceBeginM();
+
+    if (!mCountMisses || mSampleRows.empty()) return;
+    DataSetBinaryClassification::Handle lDataSet= castHandleT<DataSetBinaryClassification>(ioContext.getSystem().getComponent("DataSet"));
+
+    // Row i has been classified by all evaluations on more than i rows of its class.
+    unsigned int lTrials= 0;
+    for(unsigned int i=mNrSamplesPositive; i>0; --i)
+    {
+        lTrials+= mEvaluationsPositive[i];
+        lDataSet->addMisses(mSampleRows[i- 1], mMisses[i- 1], lTrials);
+    }
+    lTrials= 0;
+    for(unsigned int i=mNrSamplesNegative; i>0; --i)
+    {
+        lTrials+= mEvaluationsNegative[i];
+        lDataSet->addMisses(mSampleRows[mNrSamplesPositive+ i- 1], mMisses[mNrSamplesPositive+ i- 1], lTrials);
+    }
+    std::fill(mMisses.begin(), mMisses.end(), 0);
+    std::fill(mEvaluationsPositive.begin(), mEvaluationsPositive.end(), 0);
+    std::fill(mEvaluationsNegative.begin(), mEvaluationsNegative.end(), 0);
+
+    Beagle_StackTraceEndM("void SharedLibEvalOp::flushMisses(GP::Context& ioContext)");
+}
+
+/*!
+ *  \brief Compare the predictions of the fast and the exact library on the training set.
+ *  \param ioDeme Deme evaluated.
+ *  \param ioContext Evolutionary context.
+ */
+void SharedLibEvalOp::verifyFastMath(Beagle::Deme& ioDeme, GP::Context& ioContext)
+{
+    Beagle_StackTraceBeginM();
+
+    unsigned int lNrRows= mNrSamplesPositive+ mNrSamplesNegative;
+    unsigned long lNrDiffering= 0;
+    unsigned int lNrIndividualsDiffering= 0;
+    for(unsigned int i=0; i<ioDeme.size() && lNrRows>0; ++i)
+    {
+        ApplyIndividual lFast= getApplyIndividual(ioContext, i, this->mSharedLibHandle);
+        ApplyIndividual lExact= getApplyIndividual(ioContext, i, this->mSharedLibHandleExact);
+        unsigned int lDiffering= 0;
+        float* lRow= &mSample[0];
+        for(unsigned int j=0; j<lNrRows; ++j, lRow+= mRowStride)
+        {
+            lDiffering+= ((lFast(lRow) != 0) != (lExact(lRow) != 0))* mSampleWeights[j];
+        }
+        lNrDiffering+= lDiffering;
+        lNrIndividualsDiffering+= (lDiffering > 0);
+    }
+
+    std::ostringstream lOSS;
+    lOSS << "g" << ioContext.getGeneration() << " d" << ioContext.getDemeIndex() << ", fast math: ";
+    lOSS << lNrDiffering << " of " << (unsigned long)ioDeme.size()* getSampleWeight(0, lNrRows) << " predictions differ from exact math, ";
+    lOSS << "in " << lNrIndividualsDiffering << " of " << ioDeme.size() << " individuals.";
+    Beagle_LogInfoM(ioContext.getSystem().getLogger(), "verifyFastMath", "Beagle::GP::SharedLibEvalOp", lOSS.str());
+
+    Beagle_StackTraceEndM("void SharedLibEvalOp::verifyFastMath(Deme&, GP::Context&)");
+}
+
+/*!
+ *  \brief Evaluate the individuals of a deme.
+ *  \param ioDeme Deme to evaluate.
+ *  \param ioContext Evolutionary context.
+ *
+ *  Misclassification counts are handed to the data set right after the deme
+ *  has been evaluated, so that TrainingSetSamplingOp can use them in the next generation.
+ */
+void SharedLibEvalOp::operate(Beagle::Deme& ioDeme, Beagle::Context& ioContext)
+{
+    Beagle_StackTraceBeginM();
+
+    // Score all individuals with invalid fitness, not scored yet, population-major.
+    GP::Context& lContext= castObjectT<GP::Context&>(ioContext);
+    std::vector<unsigned int> lIndexes;
+    for(unsigned int i=0; i<ioDeme.size(); ++i)
+    {
+        if (((ioDeme[i]->getFitness() == NULL) || (ioDeme[i]->getFitness()->isValid() == false)) &&
+            (i >= mFitnesses.size() || mFitnesses[i] == NULL))
+        {
+            lIndexes.push_back(i);
+        }
+    }
+    if (!lIndexes.empty())
+    {
+        prepare(lContext);
+        this->mTimer.reset();
+        mCounters->begin(HardwareCounters::eEvaluate);
+        evaluateDeme(ioDeme, lContext, lIndexes, mNrSamplesPositive, mNrSamplesNegative);
+        mCounters->end(HardwareCounters::eEvaluate);
+        std::ostringstream lOSS;
+        lOSS << "g" << ioContext.getGeneration() << " d" << ioContext.getDemeIndex() << ": scored ";
+        lOSS << lIndexes.size() << " individuals in " << this->mTimer.getValue() << "s, ";
+        lOSS << getTileRows() << " rows per tile.";
+        Beagle_LogDetailedM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::SharedLibEvalOp", lOSS.str());
+    }
+
+    // Let EvaluationOp assign the fitness computed above, update the hall of fame and statistics.
+    Beagle::GP::EvaluationOp::operate(ioDeme, ioContext);
+
+    // Complete the fitness table with the individuals that have not been scored above, stamp it.
+    mFitnessTable->resize(ioDeme.size());
+    for(unsigned int i=0; i<ioDeme.size(); ++i)
+    {
+        GP::Individual& lIndividual= castObjectT<GP::Individual&>(*ioDeme[i]);
+        if ((i >= mFitnesses.size() || mFitnesses[i] == NULL) && (lIndividual.getFitness() != NULL))
+        {
+            mFitnessTable->setFitness(i, castObjectT<const FitnessMCC&>(*lIndividual.getFitness()));
+        }
+        mFitnessTable->setIndividual(i, lIndividual);
+    }
+    mFitnessTable->stamp(ioContext.getGeneration(), ioContext.getDemeIndex());
+    mFitnesses.clear();
+    flushMisses(lContext);
+    if (mNrEvaluations > 0)
+    {
+        std::ostringstream lOSS;
+        lOSS << "g" << ioContext.getGeneration() << " d" << ioContext.getDemeIndex() << ": ";
+        lOSS << mNrBitmapEvaluations << " of " << mNrEvaluations << " evaluations from the bitmap index, ";
+        lOSS << mBitmapIndex.getNrBitmaps() << " comparison bitmaps cached.";
+        Beagle_LogDetailedM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::SharedLibEvalOp", lOSS.str());
+        mNrBitmapEvaluations= 0;
+        mNrEvaluations= 0;
+    }
+    if (this->mSharedLibHandleExact)
+    {
+        verifyFastMath(ioDeme, lContext);
+    }
+
+    Beagle_StackTraceEndM("void SharedLibEvalOp::operate(Deme&, Context&)");
+}
+
 /*!
  *
  */
@@ -177,10 +1107,43 @@ void SharedLibEvalOp::init(Beagle::System& ioSystem)
     Beagle_StackTraceBeginM();
 
     Beagle::GP::EvaluationOp::init(ioSystem);
-    
+
+    // Share the fitness table with StatsCalcFitnessMCCOp through the system, if GPMain added one.
+    mFitnessTable= castHandleT<FitnessTable>(ioSystem.getComponent("FitnessTable"));
+    if (mFitnessTable == NULL)
+    {
+        mFitnessTable= new FitnessTable;
+    }
+
+    // Count hardware events per phase, if asked to; the counters are shared with the compile and statistics operators.
+    mCounters= castHandleT<HardwareCounters>(ioSystem.getComponent("HardwareCounters"));
+    if (mCounters == NULL)
+    {
+        mCounters= new HardwareCounters;
+    }
+    if (mHardwareCounters->getWrappedValue() && !mCounters->isOpen())
+    {
+        std::string lErrors;
+        if (!mCounters->open(lErrors))
+        {
+            Beagle_LogInfoM(ioSystem.getLogger(), "init", "Beagle::GP::SharedLibEvalOp",
+                "Hardware counters not available ("+ lErrors+ "), see /proc/sys/kernel/perf_event_paranoid; not counting.");
+        }
+        else if (!lErrors.empty())
+        {
+            Beagle_LogInfoM(ioSystem.getLogger(), "init", "Beagle::GP::SharedLibEvalOp",
+                "Some hardware counters not available, not counting them: "+ lErrors+ ".");
+        }
+    }
+
     std::ostringstream lOSS;
     lOSS << "Training set size: " << mTrainingSetSize;
 	Beagle_LogInfoM(ioSystem.getLogger(), "init", "Beagle::GP::SharedLibEvalOp", lOSS.str());
+
+    std::ostringstream lTopology;
+    lTopology << "NUMA topology: " << mTopology.getNrNodes() << " node(s), " << mTopology.getNrCpus() << " CPU(s); ";
+    lTopology << "evaluating with " << getNrThreads() << " thread(s).";
+    Beagle_LogInfoM(ioSystem.getLogger(), "init", "Beagle::GP::SharedLibEvalOp", lTopology.str());
 	    
     Beagle_StackTraceEndM("void SharedLibEvalOp::init(System& ioSystem)");
 }
@@ -207,6 +1170,103 @@ void SharedLibEvalOp::registerParams(Beagle::System& ioSystem)
         ioSystem.getRegister().insertEntry("icu.trainingset.size", new Int(30000), lDescription);
     }
     mTrainingSetSize= castHandleT<Int>(ioSystem.getRegister()["icu.trainingset.size"])->getWrappedValue();
+
+    // 'icu.eval.bitmap-index', evaluate trees of column-vs-constant comparisons on bitmaps.
+    {
+        std::ostringstream lOSS;
+        lOSS << "Evaluate individuals whose trees combine comparisons of a column and a constant ";
+        lOSS << "by boolean operators only on bitmaps, from a sorted index of the training set, ";
+        lOSS << "instead of calling the compiled individual for each row.";
+        Register::Description lDescription(
+            "Bitmap index",
+            "Bool",
+            "1",
+            lOSS.str()
+        );
+        mUseBitmapIndex= castHandleT<Bool>(
+            ioSystem.getRegister().insertEntry("icu.eval.bitmap-index", new Bool(true), lDescription));
+    }
+
+    // 'icu.eval.tile-rows', rows per tile for population-major evaluation.
+    {
+        std::ostringstream lOSS;
+        lOSS << "Number of training set rows each individual of the deme is applied to, ";
+        lOSS << "before moving on to the next rows; 0 sizes tiles to half the L2 cache, ";
+        lOSS << "a negative value evaluates individuals one by one on the whole training set.";
+        Register::Description lDescription(
+            "Rows per tile",
+            "Integer",
+            "0",
+            lOSS.str()
+        );
+        mTileRows= castHandleT<Int>(
+            ioSystem.getRegister().insertEntry("icu.eval.tile-rows", new Int(0), lDescription));
+    }
+
+    // 'icu.eval.threads', threads applying individuals to tiles.
+    {
+        std::ostringstream lOSS;
+        lOSS << "Number of threads applying the compiled individuals of a deme to tiles of the ";
+        lOSS << "training set, each thread taking a share of the individuals; 0 starts one thread per CPU. ";
+        lOSS << "Only applies if tiling is enabled (icu.eval.tile-rows not negative).";
+        Register::Description lDescription(
+            "Evaluation threads",
+            "Integer",
+            "1",
+            lOSS.str()
+        );
+        mNrThreads= castHandleT<Int>(
+            ioSystem.getRegister().insertEntry("icu.eval.threads", new Int(1), lDescription));
+    }
+
+    // 'icu.eval.perf-map', symbols of the compiled individuals for perf.
+    {
+        std::ostringstream lOSS;
+        lOSS << "Append the address range of each compiled individual to /tmp/perf-<pid>.map when opening ";
+        lOSS << "a library, named apply_individual_GENERATION_DEME_INDIVIDUAL along with the number of nodes ";
+        lOSS << "and the depth of its tree, so that perf report attributes samples to individuals.";
+        Register::Description lDescription(
+            "Write perf map",
+            "Bool",
+            "0",
+            lOSS.str()
+        );
+        mPerfMap= castHandleT<Bool>(
+            ioSystem.getRegister().insertEntry("icu.eval.perf-map", new Bool(false), lDescription));
+    }
+
+    // 'icu.eval.hw-counters', hardware events per phase.
+    {
+        std::ostringstream lOSS;
+        lOSS << "Count cycles, instructions, branch misses, last level cache misses, and data TLB misses ";
+        lOSS << "by perf_event_open while compiling, opening libraries, sampling, and evaluating; ";
+        lOSS << "the counts are added to the statistics of each deme as hw-PHASE-EVENT. ";
+        lOSS << "Events the kernel does not permit are left out.";
+        Register::Description lDescription(
+            "Hardware counters",
+            "Bool",
+            "0",
+            lOSS.str()
+        );
+        mHardwareCounters= castHandleT<Bool>(
+            ioSystem.getRegister().insertEntry("icu.eval.hw-counters", new Bool(false), lDescription));
+    }
+
+    // 'icu.eval.numa', NUMA aware placement of evaluation threads and training set.
+    {
+        std::ostringstream lOSS;
+        lOSS << "If evaluating with several threads, pin each thread to a core, round robin over the ";
+        lOSS << "NUMA nodes listed in /sys/devices/system/node, and give each node a copy of the ";
+        lOSS << "training set in local memory.";
+        Register::Description lDescription(
+            "NUMA placement",
+            "Bool",
+            "1",
+            lOSS.str()
+        );
+        mNuma= castHandleT<Bool>(
+            ioSystem.getRegister().insertEntry("icu.eval.numa", new Bool(true), lDescription));
+    }
     
     Beagle_StackTraceEndM("void SharedLibEvalOp::registerParams(System&)");
 }
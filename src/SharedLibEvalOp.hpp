@@ -3,8 +3,14 @@
 
 #include "beagle/GP.hpp"
 #include "FitnessMCC.hpp"
+#include "FitnessTable.hpp"
+#include "HardwareCounters.hpp"
 #include "StatsCalcFitnessMCCOp.hpp"
+#include "ThresholdBitmapIndex.hpp"
+#include "NumaTopology.hpp"
+#include "HugePageAllocator.hpp"
 
+#include <cstdio>
 #include <string>
 #include <vector>
 
@@ -22,6 +28,19 @@ namespace GP
  *  \class SharedLibEvalOp SharedLibEvalOp.hpp "SharedLibEvalOp.hpp"
  *  \brief Shared library evaluation operator.
  *  \ingroup Spambase
+ *
+ *  The shared library compiled by SharedLibCompileOp is opened, and the training set
+ *  is drawn from the data set, once for each library, i.e. once per generation and deme.
+ *  The rows of the training set are packed into a contiguous block of floats,
+ *  positive rows first, followed by negative rows; all individuals of the deme
+ *  are evaluated on the same block.
+ *
+ *  operate scores the deme population-major: the block is cut into tiles of rows
+ *  sized to the L2 cache (icu.eval.tile-rows), and every individual is applied
+ *  to a tile while it is cache-resident, before moving on to the next tile.
+ *  With several threads (icu.eval.threads), each takes a share of the individuals;
+ *  on NUMA machines (icu.eval.numa), threads are pinned round robin to the nodes,
+ *  and read a copy of the training set local to their node.
  */
 class SharedLibEvalOp : public Beagle::GP::EvaluationOp
 {
@@ -35,12 +54,24 @@ public:
 	//!< SharedLibEvalOp bag type.
 	typedef Beagle::ContainerT<SharedLibEvalOp,Beagle::GP::EvaluationOp::Bag> Bag;
 
-	SharedLibEvalOp();
+	//! Signature of the functions generated by SharedLibCompiler::addIndividual.
+	typedef int (*ApplyIndividual)(float[]);
+
+	//! Packed training set, backed by huge pages where available (icu.memory.huge-pages).
+	typedef std::vector< float, HugePageAllocator<float> > SampleBlock;
+
+	explicit SharedLibEvalOp(std::string inName="SharedLibEvalOp");
 	virtual ~SharedLibEvalOp();
 
 	virtual Beagle::Fitness::Handle evaluate(Beagle::GP::Individual& inIndividual,
 	        Beagle::GP::Context& ioContext);
 
+	/*!
+	 * Evaluate the deme, then pass the misclassification counts
+	 * collected for dynamic subset selection on to the data set.
+	 */
+	virtual void operate(Beagle::Deme& ioDeme, Beagle::Context& ioContext);
+
 	/*!
 	 *
 	 */
@@ -50,17 +81,239 @@ public:
 	 *
 	 */
 	virtual void registerParams(Beagle::System& ioSystem);
-	    
+
 protected:
 
+    /*!
+     * Open the shared library compiled for the current generation and deme
+     * and draw the training set, unless both have been done already.
+     */
+    virtual void prepare(Beagle::GP::Context& ioContext);
+
+    /*!
+     * Draw a stratified sample from the data set and pack it into mSample.
+     */
+    virtual void drawSample(Beagle::GP::Context& ioContext);
+
+    /*!
+     * Collapse rows drawn more than once into weighted rows.
+     */
+    void weighSample(unsigned int inNrRows);
+
+    /*!
+     * Return the total weight of rows [inBegin, inEnd) of the training set.
+     */
+    unsigned int getSampleWeight(unsigned int inBegin, unsigned int inEnd) const
+    {
+        return mSampleWeightSums[inEnd]- mSampleWeightSums[inBegin];
+    }
+
+    /*!
+     * Look up the function generated for individual inIndividualIndex
+     * of the current generation and deme in the shared library.
+     */
+    ApplyIndividual getApplyIndividual(Beagle::GP::Context& ioContext, unsigned int inIndividualIndex) const;
+    ApplyIndividual getApplyIndividual(Beagle::GP::Context& ioContext, unsigned int inIndividualIndex, void* inSharedLibHandle) const;
+
+    /*!
+     * Classify the first inNrPositives positive and the first inNrNegatives negative
+     * rows of the training set, count true/false positives/negatives.
+     * If dynamic subset selection is enabled, misclassified rows are counted as well.
+     */
+    void evaluateSample(ApplyIndividual inApplyIndividual,
+                        unsigned int inNrPositives,
+                        unsigned int inNrNegatives,
+                        unsigned int& outTruePositives,
+                        unsigned int& outFalsePositives,
+                        unsigned int& outTrueNegatives,
+                        unsigned int& outFalseNegatives);
+
+    /*!
+     * Classify the first inNrPositives positive and the first inNrNegatives negative rows
+     * of the training set by individual inIndividualIndex of the deme, as evaluateSample does;
+     * from the bitmap index, if icu.eval.bitmap-index is set and the individual's tree allows.
+     */
+    void evaluateIndividual(Beagle::GP::Individual& inIndividual,
+                            Beagle::GP::Context& ioContext,
+                            unsigned int inIndividualIndex,
+                            unsigned int inNrPositives,
+                            unsigned int inNrNegatives,
+                            unsigned int& outTruePositives,
+                            unsigned int& outFalsePositives,
+                            unsigned int& outTrueNegatives,
+                            unsigned int& outFalseNegatives);
+
+    /*!
+     * Count true/false positives/negatives as evaluateIndividual does, from the bitmap index;
+     * false, if icu.eval.bitmap-index is not set or the individual's tree does not allow.
+     */
+    bool evaluateBitmap(Beagle::GP::Individual& inIndividual,
+                        unsigned int inNrPositives,
+                        unsigned int inNrNegatives,
+                        unsigned int& outTruePositives,
+                        unsigned int& outFalsePositives,
+                        unsigned int& outTrueNegatives,
+                        unsigned int& outFalseNegatives);
+
+    /*!
+     * Score individuals inIndexes of the deme on the first inNrPositives positive and the first
+     * inNrNegatives negative rows of the training set, tile by tile; store their fitness in mFitnesses.
+     */
+    void evaluateDeme(Beagle::Deme& ioDeme,
+                      Beagle::GP::Context& ioContext,
+                      const std::vector<unsigned int>& inIndexes,
+                      unsigned int inNrPositives,
+                      unsigned int inNrNegatives);
+
+    /*!
+     * Return the number of rows per tile for evaluateDeme, 0 if individuals are to be evaluated one by one.
+     */
+    unsigned int getTileRows() const;
+
+    /*!
+     * Return the number of threads for evaluateDeme.
+     */
+    unsigned int getNrThreads() const;
+
+    /*!
+     * Copy mSample into mReplicas, one copy local to each NUMA node, if needed.
+     */
+    void replicateSample();
+
+    /*!
+     * Add the rows set in mMissBits to the misclassification counts.
+     */
+    void foldMisses(unsigned int inNrPositives, unsigned int inNrNegatives);
+
+    /*!
+     * Add the misclassification counts collected since the training set
+     * has been drawn to the data set, reset the counts.
+     */
+    void flushMisses(Beagle::GP::Context& ioContext);
+
+    /*!
+     * Count the predictions on the training set differing between the library
+     * compiled in fast math mode and the one compiled in exact mode, log the counts.
+     */
+    void verifyFastMath(Beagle::Deme& ioDeme, Beagle::GP::Context& ioContext);
+
+    /*!
+     * Append the address range of each individual's function in the library opened last to
+     * /tmp/perf-<pid>.map, named after the individual, with its tree size and depth (icu.eval.perf-map).
+     */
+    void writePerfMap(Beagle::GP::Context& ioContext);
+
     //! PACC::Timer for profiling. The ioContext's execution timer cannot be used, as it is reset internally.
     PACC::Timer mTimer;
-    
+
     //! A handle on the shared lib for evaluating individuals.
     void* mSharedLibHandle;
-        
-    //! The number of rows in the training set.    
+
+    //! A handle on the same individuals compiled in exact math mode, NULL unless verifying fast math.
+    void* mSharedLibHandleExact;
+
+    //! The path of the shared lib mSharedLibHandle refers to.
+    std::string mSharedLibPath;
+
+    //! The generation and deme the shared lib and the training set have been prepared for.
+    int mGeneration;
+    int mDemeIndex;
+
+    //! The number of rows in the training set.
     int mTrainingSetSize;
+
+    //! The number of columns in each row of the training set.
+    unsigned int mNrColumns;
+
+    //! The number of floats from one row of mSample to the next.
+    unsigned int mRowStride;
+
+    //! The training set, positive rows first. Each row holds the columns in icu.compiler.columns
+    //! (all mNrColumns, if empty) as floats or, if the data set is quantized, as level codes
+    //! padded to mRowStride floats.
+    SampleBlock mSample;
+
+    //! The number of positive and negative rows in mSample.
+    unsigned int mNrSamplesPositive;
+    unsigned int mNrSamplesNegative;
+
+    //! Whether misclassifications are counted for dynamic subset selection (icu.trainingset.mode).
+    bool mCountMisses;
+
+    //! The data set row of each row in mSample.
+    std::vector<unsigned int> mSampleRows;
+
+    //! The number of times each row in mSample has been drawn, and the prefix sums thereof.
+    std::vector<unsigned int> mSampleWeights;
+    std::vector<unsigned int> mSampleWeightSums;
+
+    //! Scratch for weighSample: the rows as drawn, and the position in mSampleRows
+    //! of each data set row, ~0 if not drawn.
+    std::vector<unsigned int> mDrawnRows;
+    std::vector<unsigned int> mRowPositions;
+
+    //! Scratch for evaluateDeme: misclassifications of each row, per thread.
+    std::vector<unsigned int> mWorkerMisses;
+
+    //! Whether any row in mSample has been drawn more than once.
+    bool mWeighted;
+
+    //! Bitmap of the rows in mSample misclassified by the individual evaluated last.
+    std::vector<unsigned long> mMissBits;
+
+    //! Number of individuals misclassifying each row in mSample.
+    std::vector<unsigned int> mMisses;
+
+    //! Number of evaluations on the first n positive/negative rows, indexed by n.
+    std::vector<unsigned int> mEvaluationsPositive;
+    std::vector<unsigned int> mEvaluationsNegative;
+
+    //! Whether individuals are evaluated from mBitmapIndex where possible (icu.eval.bitmap-index).
+    Beagle::Bool::Handle mUseBitmapIndex;
+
+    //! Index of the training set, answering comparisons of a column and a constant as bitmaps.
+    ThresholdBitmapIndex mBitmapIndex;
+
+    //! Bitmap of the rows classified positive by the individual evaluated last from mBitmapIndex.
+    ThresholdBitmapIndex::Bitmap mPredictionBits;
+
+    //! Rows per tile in evaluateDeme (icu.eval.tile-rows); 0 sizes tiles to the L2 cache, negative disables tiling.
+    Beagle::Int::Handle mTileRows;
+
+    //! Threads applying individuals to tiles (icu.eval.threads), 0 for one per CPU.
+    Beagle::Int::Handle mNrThreads;
+
+    //! Whether threads are pinned and the training set replicated per NUMA node (icu.eval.numa).
+    Beagle::Bool::Handle mNuma;
+
+    //! Whether the functions of each library opened are written to /tmp/perf-<pid>.map (icu.eval.perf-map).
+    Beagle::Bool::Handle mPerfMap;
+
+    //! The perf map of this process, opened on first use; NULL if not open.
+    FILE* mPerfMapFile;
+
+    //! NUMA nodes and CPUs of this machine.
+    NumaTopology mTopology;
+
+    //! Per NUMA node, a copy of mSample in node-local memory; empty, unless replicated.
+    std::vector<SampleBlock> mReplicas;
+
+    //! Fitness computed by operate for each individual of the deme, NULL if none.
+    std::vector<Beagle::Fitness::Handle> mFitnesses;
+
+    //! Counts and tree sizes of the deme evaluated last, column by column; the system's "FitnessTable"
+    //! component if there is one, read by StatsCalcFitnessMCCOp.
+    FitnessTable::Handle mFitnessTable;
+
+    //! Whether hardware events are counted per phase (icu.eval.hw-counters).
+    Beagle::Bool::Handle mHardwareCounters;
+
+    //! Hardware counters; the system's "HardwareCounters" component if there is one, read by StatsCalcFitnessMCCOp.
+    HardwareCounters::Handle mCounters;
+
+    //! Number of individuals evaluated from mBitmapIndex, and in total, since the training set has been drawn.
+    unsigned int mNrBitmapEvaluations;
+    unsigned int mNrEvaluations;
 };
 
 }
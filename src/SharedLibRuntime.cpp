@@ -0,0 +1,160 @@
+#include "SharedLibRuntime.hpp"
+
+/*!
+ * The primitive runtime, see SharedLibRuntime.hpp.
+ *
+ * Semantics follow the OpenBEAGLE primitives evaluated by the interpreter;
+ * LOG is protected like DIV, returning 0 for arguments close to 0.
+ */
+const char* const SharedLibRuntime=
+    "/* Primitive runtime of the GP engine, version FGP_RUNTIME_VERSION.\n"
+    " *\n"
+    " * Every primitive is a static inline function of its evaluated arguments.\n"
+    " * Protected operations select between precomputed values instead of\n"
+    " * branching, so that the compiler can if-convert and vectorize them.\n"
+    " * Booleans are ints holding 0 or 1, all other values are doubles.\n"
+    " */\n"
+    "#include <math.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "/* Select a if c is 1, b if c is 0, by masking bits rather than branching. */\n"
+    "static inline double fgp_select(int c, double a, double b)\n"
+    "{\n"
+    "    unsigned long long m= -(unsigned long long)c, x, y;\n"
+    "    memcpy(&x, &a, sizeof(x));\n"
+    "    memcpy(&y, &b, sizeof(y));\n"
+    "    x= (x & m) | (y & ~m);\n"
+    "    memcpy(&a, &x, sizeof(a));\n"
+    "    return a;\n"
+    "}\n"
+    "\n"
+    "#undef TRUE\n"
+    "#undef FALSE\n"
+    "\n"
+    "#ifdef FGP_FAST_MATH\n"
+    "/* Fast approximations of libm, replacing EXP, LOG, SIN, and COS.\n"
+    " * Straight-line polynomial code, free of calls, that the compiler can\n"
+    " * inline and vectorize. Maximum errors measured against libm:\n"
+    " *   fgp_exp     relative 3e-10 for |x| <= 708; saturates at exp(-708), exp(709)\n"
+    " *   fgp_log     absolute 2e-11* max(1, |log x|) for finite normal x > 0\n"
+    " *   fgp_sincos  absolute 7e-12 for |x| <= 1e5; accuracy degrades beyond\n"
+    " * Predictions may still differ from exact mode where a comparison is decided\n"
+    " * by less than these errors, see icu.compiler.math-verify.\n"
+    " */\n"
+    "\n"
+    "/* Round x to the nearest integer, returned as double and, in *n, as integer. */\n"
+    "static inline double fgp_round(double x, long long* n)\n"
+    "{\n"
+    "    const double lMagic= 6755399441055744.0; /* 1.5* 2^52 */\n"
+    "    double t= x+ lMagic;\n"
+    "    long long b;\n"
+    "    memcpy(&b, &t, sizeof(b));\n"
+    "    *n= b- 0x4338000000000000LL;\n"
+    "    return t- lMagic;\n"
+    "}\n"
+    "\n"
+    "static inline double fgp_exp(double x)\n"
+    "{\n"
+    "    long long n;\n"
+    "    double k, r, p, s;\n"
+    "    unsigned long long b;\n"
+    "    x= fgp_select(x < -708.0, -708.0, x);\n"
+    "    x= fgp_select(x > 709.0, 709.0, x);\n"
+    "    k= fgp_round(x* 1.4426950408889634, &n);\n"
+    "    r= x- k* 6.93147180369123816490e-01- k* 1.90821492927058770002e-10;\n"
+    "    p= 1.0+ r* (1.0+ r* (1.0/ 2+ r* (1.0/ 6+ r* (1.0/ 24+ r* (1.0/ 120+ r* (1.0/ 720+ r* (1.0/ 5040+ r* (1.0/ 40320))))))));\n"
+    "    b= (unsigned long long)(n+ 1023) << 52;\n"
+    "    memcpy(&s, &b, sizeof(s));\n"
+    "    return p* s;\n"
+    "}\n"
+    "\n"
+    "static inline double fgp_log(double x)\n"
+    "{\n"
+    "    unsigned long long b, eb;\n"
+    "    double e, m, f, f2;\n"
+    "    int p;\n"
+    "    memcpy(&b, &x, sizeof(b));\n"
+    "    /* The biased exponent, converted to double by way of the bits of 2^52+ exponent. */\n"
+    "    eb= 0x4330000000000000ULL | (b >> 52);\n"
+    "    memcpy(&e, &eb, sizeof(e));\n"
+    "    e-= 4503599627371519.0; /* 2^52+ 1023 */\n"
+    "    b= (b & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;\n"
+    "    memcpy(&m, &b, sizeof(m));\n"
+    "    p= m > 1.4142135623730951;\n"
+    "    m= fgp_select(p, m* 0.5, m);\n"
+    "    e+= p;\n"
+    "    f= (m- 1.0)/ (m+ 1.0);\n"
+    "    f2= f* f;\n"
+    "    return e* 0.6931471805599453+ 2.0* f* (1.0+ f2* (1.0/ 3+ f2* (1.0/ 5+ f2* (1.0/ 7+ f2* (1.0/ 9+ f2* (1.0/ 11))))));\n"
+    "}\n"
+    "\n"
+    "/* sin(x+ inQuadrant* pi/2), after reducing x to [-pi/4, pi/4]. */\n"
+    "static inline double fgp_sincos(double x, int inQuadrant)\n"
+    "{\n"
+    "    long long n;\n"
+    "    double k, r, r2, s, c, v;\n"
+    "    unsigned long long b, sign;\n"
+    "    k= fgp_round(x* 0.63661977236758134, &n);\n"
+    "    r= x- k* 1.57079632673412561417e+00- k* 6.07710050650619224932e-11;\n"
+    "    r2= r* r;\n"
+    "    s= r* (1.0- r2* (1.0/ 6- r2* (1.0/ 120- r2* (1.0/ 5040- r2* (1.0/ 362880- r2* (1.0/ 39916800))))));\n"
+    "    c= 1.0- r2* (1.0/ 2- r2* (1.0/ 24- r2* (1.0/ 720- r2* (1.0/ 40320- r2* (1.0/ 3628800- r2* (1.0/ 479001600))))));\n"
+    "    n+= inQuadrant;\n"
+    "    v= fgp_select((int)(n & 1), c, s);\n"
+    "    sign= (unsigned long long)(n & 2) << 62;\n"
+    "    memcpy(&b, &v, sizeof(b));\n"
+    "    b^= sign;\n"
+    "    memcpy(&v, &b, sizeof(v));\n"
+    "    return v;\n"
+    "}\n"
+    "#endif\n"
+    "\n"
+    "/* Arithmetic. */\n"
+    "static inline double ADD(double a, double b) { return a+ b; }\n"
+    "static inline double SUB(double a, double b) { return a- b; }\n"
+    "static inline double MUL(double a, double b) { return a* b; }\n"
+    "\n"
+    "/* Protected division, as in OpenBEAGLE: 1 if |b| < 0.001. */\n"
+    "static inline double DIV(double a, double b)\n"
+    "{\n"
+    "    int p= fabs(b) < 0.001;\n"
+    "    return fgp_select(p, 1.0, a/ fgp_select(p, 1.0, b));\n"
+    "}\n"
+    "\n"
+    "/* Protected logarithm of |a|: 0 if |a| < 0.001. */\n"
+    "static inline double LOG(double a)\n"
+    "{\n"
+    "    double x= fabs(a);\n"
+    "    int p= x < 0.001;\n"
+    "#ifdef FGP_FAST_MATH\n"
+    "    return fgp_select(p, 0.0, fgp_log(fgp_select(p, 1.0, x)));\n"
+    "#else\n"
+    "    return fgp_select(p, 0.0, log(fgp_select(p, 1.0, x)));\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "#ifdef FGP_FAST_MATH\n"
+    "static inline double EXP(double a) { return fgp_exp(a); }\n"
+    "static inline double SIN(double a) { return fgp_sincos(a, 0); }\n"
+    "static inline double COS(double a) { return fgp_sincos(a, 1); }\n"
+    "#else\n"
+    "static inline double EXP(double a) { return exp(a); }\n"
+    "static inline double SIN(double a) { return sin(a); }\n"
+    "static inline double COS(double a) { return cos(a); }\n"
+    "#endif\n"
+    "\n"
+    "/* Comparisons, conditional, constants. */\n"
+    "static inline int LT(double a, double b) { return a < b; }\n"
+    "static inline int EQ(double a, double b) { return a == b; }\n"
+    "static inline double IF(int c, double a, double b) { return fgp_select(c, a, b); }\n"
+    "static inline double EPR(double v) { return v; }\n"
+    "\n"
+    "/* Boolean operations. */\n"
+    "static inline int AND(int a, int b) { return a & b; }\n"
+    "static inline int OR(int a, int b) { return a | b; }\n"
+    "static inline int NOT(int a) { return a ^ 1; }\n"
+    "static inline int NAND(int a, int b) { return (a & b) ^ 1; }\n"
+    "static inline int NOR(int a, int b) { return (a | b) ^ 1; }\n"
+    "static inline int XOR(int a, int b) { return a ^ b; }\n"
+    "static inline int TRUE(void) { return 1; }\n"
+    "static inline int FALSE(void) { return 0; }\n";
@@ -0,0 +1,22 @@
+#ifndef SharedLibRuntime_hpp
+#define SharedLibRuntime_hpp
+
+/*!
+ * Version of the primitive runtime, see SharedLibRuntime.
+ * Increase whenever the semantics of a primitive change;
+ * libraries compiled with differing versions do not score alike.
+ */
+#define FGP_RUNTIME_VERSION 1
+
+/*!
+ * C source defining every primitive of the GP engine (see GPMain.cpp)
+ * as a static inline function, written without branches.
+ *
+ * SharedLibCompiler copies the runtime into each source file it generates,
+ * libraries do not depend on any file outside the tmp directory.
+ * If FGP_FAST_MATH is defined, EXP, LOG, SIN, and COS are computed by
+ * polynomial approximations instead of libm; error bounds are listed in the runtime.
+ */
+extern const char* const SharedLibRuntime;
+
+#endif // SharedLibRuntime_hpp
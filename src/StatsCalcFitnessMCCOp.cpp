@@ -1,12 +1,241 @@
 #include <cmath>
 #include <sstream>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "beagle/GP.hpp"
 #include "FitnessMCC.hpp"
+#include "FitnessTable.hpp"
+#include "HardwareCounters.hpp"
 #include "StatsCalcFitnessMCCOp.hpp"
 
 using namespace Beagle;
 
+namespace
+{
+
+//! Number of individuals reduced at once; chunks are merged in order, whatever the number of threads.
+const unsigned int gChunkSize= 4096;
+
+//! Number of measures, and the ID of each in the statistics.
+const unsigned int gNrMeasures= 11;
+const char* const gMeasureIDs[gNrMeasures]= {
+	"mcc",
+	"true-positives",
+	"false-positives",
+	"true-negatives",
+	"false-negatives",
+	"true-positives-relative",
+	"false-positives-relative",
+	"true-negatives-relative",
+	"false-negatives-relative",
+	"treedepth",
+	"treesize"
+};
+
+/*!
+ * Count, mean, sum of squared deviations from the mean, min, and max of a measure,
+ * updated value by value (Welford) and merged pairwise (Chan et al.).
+ */
+struct Moments
+{
+	Moments() :
+		mCount(0.0), mMean(0.0), mM2(0.0), mMin(0.0), mMax(0.0)
+	{ }
+
+	inline void add(double inValue)
+	{
+		mCount+= 1.0;
+		double lDelta= inValue- mMean;
+		mMean+= lDelta/ mCount;
+		mM2+= lDelta* (inValue- mMean);
+		mMin= (mCount == 1.0) ? inValue : minOf(mMin, inValue);
+		mMax= (mCount == 1.0) ? inValue : maxOf(mMax, inValue);
+	}
+
+	void merge(const Moments& inOther)
+	{
+		if (inOther.mCount == 0.0) return;
+		if (mCount == 0.0)
+		{
+			*this= inOther;
+			return;
+		}
+		double lCount= mCount+ inOther.mCount;
+		double lDelta= inOther.mMean- mMean;
+		mMean+= lDelta* inOther.mCount/ lCount;
+		mM2+= inOther.mM2+ lDelta* lDelta* mCount* inOther.mCount/ lCount;
+		mCount= lCount;
+		mMin= minOf(mMin, inOther.mMin);
+		mMax= maxOf(mMax, inOther.mMax);
+	}
+
+	//! Return the sample standard deviation, 0 for less than two values.
+	inline double getStd() const
+	{
+		return (mCount > 1.0) ? std::sqrt(mM2/ (mCount- 1.0)) : 0.0;
+	}
+
+	double mCount;
+	double mMean;
+	double mM2;
+	double mMin;
+	double mMax;
+};
+
+/*!
+ * Histogram of values mapped to bins, mergeable by adding counts;
+ * quantiles are read as the bin holding the value of the nearest rank.
+ */
+struct QuantileSketch
+{
+	QuantileSketch() :
+		mTotal(0)
+	{ }
+
+	inline void add(unsigned int inBin)
+	{
+		if (inBin >= mCounts.size()) mCounts.resize(inBin+ 1, 0);
+		++mCounts[inBin];
+		++mTotal;
+	}
+
+	void merge(const QuantileSketch& inOther)
+	{
+		if (inOther.mCounts.size() > mCounts.size()) mCounts.resize(inOther.mCounts.size(), 0);
+		for(unsigned int i=0; i<inOther.mCounts.size(); ++i)
+		{
+			mCounts[i]+= inOther.mCounts[i];
+		}
+		mTotal+= inOther.mTotal;
+	}
+
+	//! Return the bin of the inQuantile quantile, 0 if empty.
+	unsigned int getBin(double inQuantile) const
+	{
+		unsigned long lRank= (unsigned long)std::ceil(inQuantile* mTotal);
+		if (lRank == 0) lRank= 1;
+		unsigned long lSum= 0;
+		for(unsigned int i=0; i<mCounts.size(); ++i)
+		{
+			lSum+= mCounts[i];
+			if (lSum >= lRank) return i;
+		}
+		return 0;
+	}
+
+	std::vector<unsigned int> mCounts;
+	unsigned long mTotal;
+};
+
+//! MCC in [-1,1] is binned linearly, 1024 bins per unit.
+const double gMCCBinsPerUnit= 1024.0;
+
+inline unsigned int getMCCBin(double inMCC)
+{
+	if (!(inMCC > -1.0)) inMCC= -1.0;
+	if (inMCC > 1.0) inMCC= 1.0;
+	return (unsigned int)((inMCC+ 1.0)* gMCCBinsPerUnit);
+}
+
+inline double getMCCValue(unsigned int inBin)
+{
+	return minOf(1.0, (inBin+ 0.5)/ gMCCBinsPerUnit- 1.0);
+}
+
+/*!
+ * Tree sizes below 128 have a bin each; above, each power of two
+ * is split into 64 bins, i.e. sizes are binned within 1/64 of their value.
+ */
+inline unsigned int getSizeBin(unsigned int inSize)
+{
+	if (inSize < 128) return inSize;
+	unsigned int lExponent= 7;
+	while ((inSize >> (lExponent+ 1)) != 0) ++lExponent;
+	return 128+ (lExponent- 7)* 64+ (inSize >> (lExponent- 6))- 64;
+}
+
+inline double getSizeValue(unsigned int inBin)
+{
+	if (inBin < 128) return inBin;
+	unsigned int lExponent= 7+ (inBin- 128)/ 64;
+	unsigned int lLower= ((inBin- 128)% 64+ 64) << (lExponent- 6);
+	unsigned int lWidth= 1u << (lExponent- 6);
+	return lLower+ (lWidth- 1)/ 2.0;
+}
+
+/*!
+ * Moments of all measures, and sketches of MCC and tree size, of a chunk of the deme.
+ */
+struct StatsChunk
+{
+	Moments mMoments[gNrMeasures];
+	QuantileSketch mMCC;
+	QuantileSketch mSize;
+};
+
+/*!
+ * Reduce rows [inBegin, inEnd) of a fitness table into outChunk;
+ * relative counts are computed as FitnessMCC::setFitness does.
+ */
+void reduceChunk(const GP::FitnessTable& inTable, unsigned int inBegin, unsigned int inEnd, StatsChunk& outChunk)
+{
+	const float* lMCC=          &inTable.getMCC()[0];
+	const unsigned int* lTP=    &inTable.getTruePositives()[0];
+	const unsigned int* lFP=    &inTable.getFalsePositives()[0];
+	const unsigned int* lTN=    &inTable.getTrueNegatives()[0];
+	const unsigned int* lFN=    &inTable.getFalseNegatives()[0];
+	const unsigned int* lDepth= &inTable.getTreeDepths()[0];
+	const unsigned int* lSize=  &inTable.getTreeSizes()[0];
+	Moments* lMoments= outChunk.mMoments;
+	for(unsigned int i=inBegin; i<inEnd; ++i)
+	{
+		lMoments[0].add(lMCC[i]);
+		lMoments[1].add(lTP[i]);
+		lMoments[2].add(lFP[i]);
+		lMoments[3].add(lTN[i]);
+		lMoments[4].add(lFN[i]);
+		lMoments[5].add((float)lTP[i]/ (lTP[i]+ lFN[i]));
+		lMoments[6].add((float)lFP[i]/ (lTN[i]+ lFP[i]));
+		lMoments[7].add((float)lTN[i]/ (lTN[i]+ lFP[i]));
+		lMoments[8].add((float)lFN[i]/ (lTP[i]+ lFN[i]));
+		lMoments[9].add(lDepth[i]);
+		lMoments[10].add(lSize[i]);
+		outChunk.mMCC.add(getMCCBin(lMCC[i]));
+		outChunk.mSize.add(getSizeBin(lSize[i]));
+	}
+}
+
+/*!
+ * Chunks reduced by one thread: mFirst, mFirst+ mStride, ...
+ */
+struct StatsJob
+{
+	const GP::FitnessTable* mTable;
+	std::vector<StatsChunk>* mChunks;
+	unsigned int mFirst;
+	unsigned int mStride;
+};
+
+void runStatsJob(StatsJob& ioJob)
+{
+	unsigned int lSize= ioJob.mTable->size();
+	for(unsigned int c=ioJob.mFirst; c<ioJob.mChunks->size(); c+=ioJob.mStride)
+	{
+		unsigned int lBegin= c* gChunkSize;
+		unsigned int lEnd= minOf<unsigned int>(lSize, lBegin+ gChunkSize);
+		reduceChunk(*ioJob.mTable, lBegin, lEnd, (*ioJob.mChunks)[c]);
+	}
+}
+
+void* runStatsThread(void* inJob)
+{
+	runStatsJob(*static_cast<StatsJob*>(inJob));
+	return NULL;
+}
+
+}
+
 
 /*!
  *  \brief Construct a calculate stats operator.
@@ -17,6 +246,48 @@ GP::StatsCalcFitnessMCCOp::StatsCalcFitnessMCCOp(std::string inName) :
 { }
 
 
+/*!
+ *  \brief Register the parameters of the operator.
+ *  \param ioSystem System of the evolution.
+ */
+void GP::StatsCalcFitnessMCCOp::registerParams(Beagle::System& ioSystem)
+{
+	Beagle_StackTraceBeginM();
+
+	StatsCalculateOp::registerParams(ioSystem);
+
+	// 'icu.stats.threads', threads reducing a deme.
+	{
+		std::ostringstream lOSS;
+		lOSS << "Number of threads computing the statistics of a deme, each reducing chunks of ";
+		lOSS << gChunkSize << " individuals; 0 starts one thread per CPU. ";
+		lOSS << "The statistics do not depend on the number of threads.";
+		Register::Description lDescription(
+		    "Statistics threads",
+		    "Integer",
+		    "1",
+		    lOSS.str()
+		);
+		mNrThreads= castHandleT<Int>(
+		    ioSystem.getRegister().insertEntry("icu.stats.threads", new Int(1), lDescription));
+	}
+
+	Beagle_StackTraceEndM("void GP::StatsCalcFitnessMCCOp::registerParams(Beagle::System&)");
+}
+
+
+/*!
+ *  \brief Return the number of threads computing statistics, one per CPU if icu.stats.threads is 0.
+ */
+unsigned int GP::StatsCalcFitnessMCCOp::getNrThreads() const
+{
+	int lNrThreads= mNrThreads->getWrappedValue();
+	if (lNrThreads > 0) return lNrThreads;
+	long lNrCpus= sysconf(_SC_NPROCESSORS_ONLN);
+	return (lNrCpus > 0) ? lNrCpus : 1;
+}
+
+
 /*!
  *  \brief Calculate MCC statistics of a given deme.
  *  \param outStats  Evaluated statistics.
@@ -36,6 +307,11 @@ GP::StatsCalcFitnessMCCOp::StatsCalcFitnessMCCOp(std::string inName) :
  *    + treedepth
  *    + treesize
  *
+ *  Averages and standard deviations are computed in a single pass (Welford), over the
+ *  fitness table filled by the evaluation operator. The median and 90th percentile of
+ *  MCC and tree size are added as items mcc-median, mcc-p90, treesize-median and
+ *  treesize-p90; they are read from histograms, MCC within 1/1024, tree size within 1/64.
+ *  All statistics of an empty deme are 0.
  */
 void GP::StatsCalcFitnessMCCOp::calculateStatsDeme(Beagle::Stats& outStats,
         Beagle::Deme& ioDeme,
@@ -48,425 +324,93 @@ void GP::StatsCalcFitnessMCCOp::calculateStatsDeme(Beagle::Stats& outStats,
 	outStats.addItem("processed", ioContext.getProcessedDeme());
 	outStats.addItem("total-processed", ioContext.getTotalProcessedDeme());
 
-//std::cerr << ioDeme.size() << std::endl;
-
-	if(ioDeme.size() == 0) {
-	    /*
-	     * The deme does not contain any individuals.
-	     * Set all statistics to 0.0.
-	     */
-		outStats.setGenerationValues(std::string("deme")+uint2str(ioContext.getDemeIndex()),
-		                             ioContext.getGeneration(), 0, true);
-
-		outStats.resize(11);
-		outStats[0].mID = "mcc";
-		outStats[0].mAvg = 0.0;
-		outStats[0].mStd = 0.0;
-		outStats[0].mMax = 0.0;
-		outStats[0].mMin = 0.0;
-
-		outStats[1].mID = "true-positives";
-		outStats[1].mAvg = 0.0;
-		outStats[1].mStd = 0.0;
-		outStats[1].mMax = 0.0;
-		outStats[1].mMin = 0.0;
-
-		outStats[2].mID = "false-positives";
-		outStats[2].mAvg = 0.0;
-		outStats[2].mStd = 0.0;
-		outStats[2].mMax = 0.0;
-		outStats[2].mMin = 0.0;
-
-		outStats[3].mID = "true-negatives";
-		outStats[3].mAvg = 0.0;
-		outStats[3].mStd = 0.0;
-		outStats[3].mMax = 0.0;
-		outStats[3].mMin = 0.0;
-
-		outStats[4].mID = "false-negatives";
-		outStats[4].mAvg = 0.0;
-		outStats[4].mStd = 0.0;
-		outStats[4].mMax = 0.0;
-		outStats[4].mMin = 0.0;
-
-		outStats[5].mID = "true-positives-relative";
-		outStats[5].mAvg = 0.0;
-		outStats[5].mStd = 0.0;
-		outStats[5].mMax = 0.0;
-		outStats[5].mMin = 0.0;
-
-		outStats[6].mID = "false-positives-relative";
-		outStats[6].mAvg = 0.0;
-		outStats[6].mStd = 0.0;
-		outStats[6].mMax = 0.0;
-		outStats[6].mMin = 0.0;
-
-		outStats[7].mID = "true-negatives-relative";
-		outStats[7].mAvg = 0.0;
-		outStats[7].mStd = 0.0;
-		outStats[7].mMax = 0.0;
-		outStats[7].mMin = 0.0;
-
-		outStats[8].mID = "false-negatives-relative";
-		outStats[8].mAvg = 0.0;
-		outStats[8].mStd = 0.0;
-		outStats[8].mMax = 0.0;
-		outStats[8].mMin = 0.0;
-
-		outStats[9].mID = "treedepth";
-		outStats[9].mAvg = 0.0;
-		outStats[9].mStd = 0.0;
-		outStats[9].mMax = 0.0;
-		outStats[9].mMin = 0.0;
-
-		outStats[10].mID = "treesize";
-		outStats[10].mAvg = 0.0;
-		outStats[10].mStd = 0.0;
-		outStats[10].mMax = 0.0;
-		outStats[10].mMin = 0.0;
-		return;
+	// Read the fitness table filled by the evaluation operator; if it does not hold this deme, fill a table from the deme.
+	GP::FitnessTable::Handle lTable= castHandleT<GP::FitnessTable>(ioContext.getSystem().getComponent("FitnessTable"));
+	if ((lTable == NULL) || !lTable->isCurrent(ioDeme, ioContext.getGeneration(), ioContext.getDemeIndex()))
+	{
+		lTable= new GP::FitnessTable;
+		lTable->fill(ioDeme);
 	}
 
-	const GP::Individual::Handle lFirstIndiv= castHandleT<GP::Individual>(ioDeme[0]);
-	const GP::FitnessMCC::Handle lFirstIndivFitness= castHandleT<GP::FitnessMCC>(lFirstIndiv->getFitness());
-
-	if(ioDeme.size() == 1) {
-	    /*
-	     * The deme contains a single individual.
-	     * No need to compute average values.
-	     */
-		outStats.setGenerationValues(std::string("deme")+uint2str(ioContext.getDemeIndex()),
-		                             ioContext.getGeneration(), 1, true);
-
-std::cerr << lFirstIndivFitness->getTruePositives() << "/" << lFirstIndivFitness->getFalsePositives() << "/";
-std::cerr << lFirstIndivFitness->getFalseNegatives() << "/" << lFirstIndivFitness->getTrueNegatives() << std::endl;
-std::cerr << lFirstIndivFitness->getTruePositivesRel() << "/" << lFirstIndivFitness->getFalsePositivesRel() << "/";
-std::cerr << lFirstIndivFitness->getFalseNegativesRel() << "/" << lFirstIndivFitness->getTrueNegativesRel() << std::endl;
-std::cerr << std::endl;
-
-		outStats.resize(11);
-		outStats[0].mID = "mcc";
-		outStats[0].mAvg = lFirstIndivFitness->getValue();
-		outStats[0].mStd = 0.0;
-		outStats[0].mMax = lFirstIndivFitness->getValue();
-		outStats[0].mMin = lFirstIndivFitness->getValue();
-
-		outStats[1].mID = "true-positives";
-		outStats[1].mAvg = lFirstIndivFitness->getTruePositives();
-		outStats[1].mStd = 0.0;
-		outStats[1].mMax = lFirstIndivFitness->getTruePositives();
-		outStats[1].mMin = lFirstIndivFitness->getTruePositives();
-
-		outStats[2].mID = "false-positives";
-		outStats[2].mAvg = lFirstIndivFitness->getFalsePositives();
-		outStats[2].mStd = 0.0;
-		outStats[2].mMax = lFirstIndivFitness->getFalsePositives();
-		outStats[2].mMin = lFirstIndivFitness->getFalsePositives();
-
-		outStats[3].mID = "true-negatives";
-		outStats[3].mAvg = lFirstIndivFitness->getTrueNegatives();
-		outStats[3].mStd = 0.0;
-		outStats[3].mMax = lFirstIndivFitness->getTrueNegatives();
-		outStats[3].mMin = lFirstIndivFitness->getTrueNegatives();
-
-		outStats[4].mID = "false-negatives";
-		outStats[4].mAvg = lFirstIndivFitness->getFalseNegatives();
-		outStats[4].mStd = 0.0;
-		outStats[4].mMax = lFirstIndivFitness->getFalseNegatives();
-		outStats[4].mMin = lFirstIndivFitness->getFalseNegatives();
-
-		outStats[5].mID = "true-positives-relative";
-		outStats[5].mAvg = lFirstIndivFitness->getTruePositivesRel();
-		outStats[5].mStd = 0.0;
-		outStats[5].mMax = lFirstIndivFitness->getTruePositivesRel();
-		outStats[5].mMin = lFirstIndivFitness->getTruePositivesRel();
-
-		outStats[6].mID = "false-positives-relative";
-		outStats[6].mAvg = lFirstIndivFitness->getFalsePositivesRel();
-		outStats[6].mStd = 0.0;
-		outStats[6].mMax = lFirstIndivFitness->getFalsePositivesRel();
-		outStats[6].mMin = lFirstIndivFitness->getFalsePositivesRel();
-
-		outStats[7].mID = "true-negatives-relative";
-		outStats[7].mAvg = lFirstIndivFitness->getTrueNegativesRel();
-		outStats[7].mStd = 0.0;
-		outStats[7].mMax = lFirstIndivFitness->getTrueNegativesRel();
-		outStats[7].mMin = lFirstIndivFitness->getTrueNegativesRel();
-
-		outStats[8].mID = "false-negatives-relative";
-		outStats[8].mAvg = lFirstIndivFitness->getFalseNegativesRel();
-		outStats[8].mStd = 0.0;
-		outStats[8].mMax = lFirstIndivFitness->getFalseNegativesRel();
-		outStats[8].mMin = lFirstIndivFitness->getFalseNegativesRel();
-
-		outStats[9].mID = "treedepth";
-		outStats[9].mAvg = lFirstIndiv->getMaxTreeDepth();
-		outStats[9].mStd = 0.0;
-		outStats[9].mMax = outStats[5].mAvg;
-		outStats[9].mMin = outStats[5].mAvg;
-
-		outStats[10].mID = "treesize";
-		outStats[10].mAvg = lFirstIndiv->getTotalNodes();
-		outStats[10].mStd = 0.0;
-		outStats[10].mMax = outStats[6].mAvg;
-		outStats[10].mMin = outStats[6].mAvg;
-		return;
+	// Reduce the chunks, round robin over the threads; a job whose thread cannot be started runs in this thread.
+	unsigned int lNrChunks= (lTable->size()+ gChunkSize- 1)/ gChunkSize;
+	std::vector<StatsChunk> lChunks(lNrChunks);
+	unsigned int lNrThreads= maxOf<unsigned int>(1, minOf<unsigned int>(getNrThreads(), lNrChunks));
+	std::vector<StatsJob> lJobs(lNrThreads);
+	for(unsigned int t=0; t<lNrThreads; ++t)
+	{
+		lJobs[t].mTable= lTable.getPointer();
+		lJobs[t].mChunks= &lChunks;
+		lJobs[t].mFirst= t;
+		lJobs[t].mStride= lNrThreads;
 	}
-	
-	/*
-	 * Compute AVG, STD, MIN, and MAX over all individuals in the deme 
-	 * for each of the 11 measures (mcc, tp, fp, tn, fn, tpr, fpr, 
-	 * tnr, fnr, treesize, treedepth).
-	 */
-	// MCC
-	double lMCCSum=         (double)lFirstIndivFitness->getValue();
-	double lMCCPow2Sum=     pow2Of<double>(lMCCSum);
-	double lMCCMax=         lMCCSum;
-	double lMCCMin=         lMCCSum;
-	// True positives
-	double lTPSum=          (double)lFirstIndivFitness->getTruePositives();
-	double lTPPow2Sum=      pow2Of<double>(lTPSum);
-	double lTPMax=          lTPSum;
-	double lTPMin=          lTPSum;
-	// False positives
-	double lFPSum=          (double)lFirstIndivFitness->getFalsePositives();
-	double lFPPow2Sum=      pow2Of<double>(lFPSum);
-	double lFPMax=          lFPSum;
-	double lFPMin=          lFPSum;
-	// True negatives
-	double lTNSum=          (double)lFirstIndivFitness->getTrueNegatives();
-	double lTNPow2Sum=      pow2Of<double>(lTNSum);
-	double lTNMax=          lTNSum;
-	double lTNMin=          lTNSum;
-	// False negatives
-	double lFNSum=          (double)lFirstIndivFitness->getFalseNegatives();
-	double lFNPow2Sum=      pow2Of<double>(lFNSum);
-	double lFNMax=          lFNSum;
-	double lFNMin=          lFNSum;
-	// True positives, relative
-	double lTPRSum=         (double)lFirstIndivFitness->getTruePositivesRel();
-	double lTPRPow2Sum=     pow2Of<double>(lTPRSum);
-	double lTPRMax=         lTPRSum;
-	double lTPRMin=         lTPRSum;
-	// False positives, relative
-	double lFPRSum=         (double)lFirstIndivFitness->getFalsePositivesRel();
-	double lFPRPow2Sum=     pow2Of<double>(lFPRSum);
-	double lFPRMax=         lFPRSum;
-	double lFPRMin=         lFPRSum;
-	// True negatives, relative
-	double lTNRSum=         (double)lFirstIndivFitness->getTrueNegativesRel();
-	double lTNRPow2Sum=     pow2Of<double>(lTNRSum);
-	double lTNRMax=         lTNRSum;
-	double lTNRMin=         lTNRSum;
-	// False negatives, relative
-	double lFNRSum=         (double)lFirstIndivFitness->getFalseNegativesRel();
-	double lFNRPow2Sum=     pow2Of<double>(lFNRSum);
-	double lFNRMax=         lFNRSum;
-	double lFNRMin=         lFNRSum;
-	// Tree depth
-	double lDepthMax=       lFirstIndiv->getMaxTreeDepth();
-	double lDepthMin=       lDepthMax;
-	double lDepthSum=       (double)lDepthMax;
-	double lDepthPow2Sum=   pow2Of<double>(lDepthSum);
-	// Tree size
-	double lSizeMax=        lFirstIndiv->getTotalNodes();
-	double lSizeMin=        lSizeMax;
-	double lSizeSum=        (double)lSizeMax;
-	double lSizePow2Sum=    pow2Of<double>(lSizeSum);
-    
-    // Cummulate values.
-std::cerr << ioDeme.size() << " individuals in deme." << std::endl;
-
-	for(unsigned int i=1; i<ioDeme.size(); i++) 
+	if (lNrThreads == 1)
 	{
-		const GP::Individual::Handle lIndiv= castHandleT<GP::Individual>(ioDeme[i]);
-		const GP::FitnessMCC::Handle lIndivFitness= castHandleT<GP::FitnessMCC>(lIndiv->getFitness());
-		double lValue= 0.0;
-
-//if (lIndivFitness->getTruePositives()+ lIndivFitness->getFalsePositives()+ lIndivFitness->getFalseNegatives()+ lIndivFitness->getTrueNegativesRel() == 0)
-//{
-//std::cerr << i << " / " << ioDeme.size() << ", ";
-//std::cerr << lIndivFitness->getTruePositives() << "/" << lIndivFitness->getFalsePositives() << "/";
-//std::cerr << lIndivFitness->getFalseNegatives() << "/" << lIndivFitness->getTrueNegatives() << std::endl;
-//std::cerr << lIndivFitness->getTruePositivesRel() << "/" << lIndivFitness->getFalsePositivesRel() << "/";
-//std::cerr << lIndivFitness->getFalseNegativesRel() << "/" << lIndivFitness->getTrueNegativesRel() << std::endl;
-//std::cerr << std::endl;
-//}
-
-		// MCC
-		lValue=         lIndivFitness->getValue();
-		lMCCSum+=       lValue;
-		lMCCPow2Sum+=   pow2Of<double>(lValue);
-		lMCCMax=        maxOf(lMCCMax, lValue);
-		lMCCMin=        minOf(lMCCMin, lValue);
-		// True positives
-		lValue=         lIndivFitness->getTruePositives();
-		lTPSum+=        lValue;
-		lTPPow2Sum+=    pow2Of<double>(lValue);
-		lTPMax=         maxOf(lTPMax, lValue);
-		lTPMin=         minOf(lTPMin, lValue);
-		// False positives
-		lValue=         lIndivFitness->getFalsePositives();
-		lFPSum+=        lValue;
-		lFPPow2Sum+=    pow2Of<double>(lValue);
-		lFPMax=         maxOf(lFPMax, lValue);
-		lFPMin=         minOf(lFPMin, lValue);
-		// True negatives
-		lValue=         lIndivFitness->getTrueNegatives();
-		lTNSum+=        lValue;
-		lTNPow2Sum+=    pow2Of<double>(lValue);
-		lTNMax=         maxOf(lTNMax, lValue);
-		lTNMin=         minOf(lTNMin, lValue);
-		// False negatives
-		lValue=         lIndivFitness->getFalseNegatives();
-		lFNSum+=        lValue;
-		lFNPow2Sum+=    pow2Of<double>(lValue);
-		lFNMax=         maxOf(lFNMax, lValue);
-		lFNMin=         minOf(lFNMin, lValue);
-		// True positives, relative
-		lValue=         lIndivFitness->getTruePositivesRel();
-		lTPRSum+=       lValue;
-		lTPRPow2Sum+=   pow2Of<double>(lValue);
-		lTPRMax=        maxOf(lTPRMax, lValue);
-		lTPRMin=        minOf(lTPRMin, lValue);
-		// False positives, relative
-		lValue=         (double)lIndivFitness->getFalsePositivesRel();
-		lFPRSum+=       lValue;
-		lFPRPow2Sum+=   pow2Of<double>(lValue);
-		lFPRMax=        maxOf(lFPRMax, lValue);
-		lFPRMin=        minOf(lFPRMin, lValue);
-		// True negatives, relative
-		lValue+=        (double)lIndivFitness->getTrueNegativesRel();
-		lTNRSum+=       lValue;
-		lTNRPow2Sum+=   pow2Of<double>(lValue);
-		lTNRMax=        maxOf(lTNRMax, lValue);
-		lTNRMin=        minOf(lTNRMin, lValue);
-		// False negatives, relative
-		lValue+=        (double)lIndivFitness->getFalseNegativesRel();
-		lFNRSum+=       lValue;
-		lFNRPow2Sum+=   pow2Of<double>(lValue);
-		lFNRMax=        maxOf(lFNRMax, lValue);
-		lFNRMin=        minOf(lFNRMin, lValue);
-        // Tree depth		
-        lValue=         lIndiv->getMaxTreeDepth();
-		lDepthSum+=     lValue;
-		lDepthPow2Sum+= pow2Of<double>(lValue);
-		lDepthMax=      maxOf(lDepthMax, lValue);
-		lDepthMin=      minOf(lDepthMin, lValue);
-		// Tree size
-        lValue=         lIndiv->getTotalNodes();
-		lSizeSum+=      lValue;
-		lSizePow2Sum+=  pow2Of<double>(lValue);
-		lSizeMax=       maxOf(lSizeMax, lValue);
-		lSizeMin=       minOf(lSizeMin, lValue);
+		runStatsJob(lJobs[0]);
+	}
+	else
+	{
+		std::vector<pthread_t> lThreads(lNrThreads);
+		std::vector<bool> lStarted(lNrThreads, false);
+		for(unsigned int t=0; t<lNrThreads; ++t)
+		{
+			lStarted[t]= (pthread_create(&lThreads[t], NULL, runStatsThread, &lJobs[t]) == 0);
+		}
+		for(unsigned int t=0; t<lNrThreads; ++t)
+		{
+			if (lStarted[t]) pthread_join(lThreads[t], NULL);
+			else runStatsJob(lJobs[t]);
+		}
+	}
+
+	// Merge in chunk order.
+	StatsChunk lTotal;
+	for(unsigned int c=0; c<lNrChunks; ++c)
+	{
+		for(unsigned int m=0; m<gNrMeasures; ++m)
+		{
+			lTotal.mMoments[m].merge(lChunks[c].mMoments[m]);
+		}
+		lTotal.mMCC.merge(lChunks[c].mMCC);
+		lTotal.mSize.merge(lChunks[c].mSize);
 	}
 
-	// Compute average and standard error.
-	double lDemeSize= ioDeme.size();
-	// MCC
-	float lMCCAverage= lMCCSum/ lDemeSize;
-	float lMCCStdError= sqrt((lMCCPow2Sum- (pow2Of<double>(lMCCSum)/ lDemeSize))/ (lDemeSize- 1));
-	// True positives
-	float lTPAverage= lTPSum/ lDemeSize;
-	float lTPStdError= sqrt((lTPPow2Sum- (pow2Of<double>(lTPSum)/ lDemeSize))/ (lDemeSize- 1));
-	// False positives
-	float lFPAverage= lFPSum/ lDemeSize;
-	float lFPStdError= sqrt((lFPPow2Sum- (pow2Of<double>(lFPSum)/ lDemeSize))/ (lDemeSize- 1));
-	// True negatives
-	float lTNAverage= lTNSum/ lDemeSize;
-	float lTNStdError= sqrt((lTNPow2Sum- (pow2Of<double>(lTNSum)/ lDemeSize))/ (lDemeSize- 1));
-	// False negatives
-	float lFNAverage= lFNSum/ lDemeSize;
-	float lFNStdError= sqrt((lFNPow2Sum- (pow2Of<double>(lFNSum)/ lDemeSize))/ (lDemeSize- 1));
-	// True positives, relative
-	float lTPRAverage= lTPRSum/ lDemeSize;
-	float lTPRStdError= sqrt((lTPRPow2Sum- (pow2Of<double>(lTPRSum)/ lDemeSize))/ (lDemeSize- 1));
-	// False positives, relative
-	float lFPRAverage= lFPRSum/ lDemeSize;
-	float lFPRStdError= sqrt((lFPRPow2Sum- (pow2Of<double>(lFPRSum)/ lDemeSize))/ (lDemeSize- 1));
-	// True negatives, relative
-	float lTNRAverage= lTNRSum/ lDemeSize;
-	float lTNRStdError= sqrt((lTNRPow2Sum- (pow2Of<double>(lTNRSum)/ lDemeSize))/ (lDemeSize- 1));
-	// False negatives, relative
-	float lFNRAverage= lFNRSum/ lDemeSize;
-	float lFNRStdError= sqrt((lFNRPow2Sum- (pow2Of<double>(lFNRSum)/ lDemeSize))/ (lDemeSize- 1));
-	// Tree size
-	float lSizeAverage= lSizeSum/ lDemeSize;
-	float lSizeStdError= sqrt((lSizePow2Sum- (pow2Of<double>(lSizeSum)/ lDemeSize))/ (lDemeSize- 1));
-	// Tree depth
-	float lDepthAverage= lDepthSum/ lDemeSize;
-	float lDepthStdError= sqrt((lDepthPow2Sum- (pow2Of<double>(lDepthSum)/ lDemeSize))/ (lDemeSize- 1));
-	
 	outStats.setGenerationValues(std::string("deme")+uint2str(ioContext.getDemeIndex()),
 	                             ioContext.getGeneration(), ioDeme.size(), true);
 
-	outStats.resize(11);
-	outStats[0].mID = "mcc";
-	outStats[0].mAvg = lMCCAverage;
-	outStats[0].mStd = lMCCStdError;
-	outStats[0].mMax = lMCCMax;
-	outStats[0].mMin = lMCCMin;
-
-	outStats[1].mID = "true-positives";
-	outStats[1].mAvg = lTPAverage;
-	outStats[1].mStd = lTPStdError;
-	outStats[1].mMax = (unsigned int)lTPMax;
-	outStats[1].mMin = (unsigned int)lTPMin;
-
-	outStats[2].mID = "false-positives";
-	outStats[2].mAvg = lFPAverage;
-	outStats[2].mStd = lFPStdError;
-	outStats[2].mMax = (unsigned int)lFPMax;
-	outStats[2].mMin = (unsigned int)lFPMin;
-
-	outStats[3].mID = "true-negatives";
-	outStats[3].mAvg = lTNAverage;
-	outStats[3].mStd = lTNStdError;
-	outStats[3].mMax = (unsigned int)lTNMax;
-	outStats[3].mMin = (unsigned int)lTNMin;
-
-	outStats[4].mID = "false-negatives";
-	outStats[4].mAvg = lFNAverage;
-	outStats[4].mStd = lFNStdError;
-	outStats[4].mMax = (unsigned int)lFNMax;
-	outStats[4].mMin = (unsigned int)lFNMin;
-
-	outStats[5].mID = "true-positives-relative";
-	outStats[5].mAvg = lTPRAverage;
-	outStats[5].mStd = lTPRStdError;
-	outStats[5].mMax = lTPRMax;
-	outStats[5].mMin = lTPRMin;
-
-	outStats[6].mID = "false-positives-relative";
-	outStats[6].mAvg = lFPRAverage;
-	outStats[6].mStd = lFPRStdError;
-	outStats[6].mMax = lFPRMax;
-	outStats[6].mMin = lFPRMin;
-
-	outStats[7].mID = "true-negatives-relative";
-	outStats[7].mAvg = lTNRAverage;
-	outStats[7].mStd = lTNRStdError;
-	outStats[7].mMax = lTNRMax;
-	outStats[7].mMin = lTNRMin;
-
-	outStats[8].mID = "false-negatives-relative";
-	outStats[8].mAvg = lFNRAverage;
-	outStats[8].mStd = lFNRStdError;
-	outStats[8].mMax = lFNRMax;
-	outStats[8].mMin = lFNRMin;
-
-	outStats[9].mID = "treedepth";
-	outStats[9].mAvg = lDepthAverage;
-	outStats[9].mStd = lDepthStdError;
-	outStats[9].mMax = (unsigned int)lDepthMax;
-	outStats[9].mMin = (unsigned int)lDepthMin;
-
-	outStats[10].mID = "treesize";
-	outStats[10].mAvg = lSizeAverage;
-	outStats[10].mStd = lSizeStdError;
-	outStats[10].mMax =(unsigned int) lSizeMax;
-	outStats[10].mMin =(unsigned int) lSizeMin;
-	
+	outStats.resize(gNrMeasures);
+	for(unsigned int m=0; m<gNrMeasures; ++m)
+	{
+		outStats[m].mID = gMeasureIDs[m];
+		outStats[m].mAvg = lTotal.mMoments[m].mMean;
+		outStats[m].mStd = lTotal.mMoments[m].getStd();
+		outStats[m].mMax = lTotal.mMoments[m].mMax;
+		outStats[m].mMin = lTotal.mMoments[m].mMin;
+	}
+
+	bool lEmpty= (lTotal.mMCC.mTotal == 0);
+	outStats.addItem("mcc-median", lEmpty ? 0.0 : getMCCValue(lTotal.mMCC.getBin(0.5)));
+	outStats.addItem("mcc-p90", lEmpty ? 0.0 : getMCCValue(lTotal.mMCC.getBin(0.9)));
+	outStats.addItem("treesize-median", lEmpty ? 0.0 : getSizeValue(lTotal.mSize.getBin(0.5)));
+	outStats.addItem("treesize-p90", lEmpty ? 0.0 : getSizeValue(lTotal.mSize.getBin(0.9)));
+
+	// Hardware events counted since the statistics of the previous deme, per phase.
+	GP::HardwareCounters::Handle lCounters= castHandleT<GP::HardwareCounters>(ioContext.getSystem().getComponent("HardwareCounters"));
+	if ((lCounters != NULL) && lCounters->isOpen())
+	{
+		for(unsigned int p=0; p<GP::HardwareCounters::eNrPhases; ++p)
+		{
+			for(unsigned int e=0; e<GP::HardwareCounters::eNrEvents; ++e)
+			{
+				GP::HardwareCounters::Event lEvent= (GP::HardwareCounters::Event)e;
+				if (!lCounters->isAvailable(lEvent)) continue;
+				GP::HardwareCounters::Phase lPhase= (GP::HardwareCounters::Phase)p;
+				outStats.addItem(std::string("hw-")+ GP::HardwareCounters::getPhaseName(lPhase)+ "-"+ GP::HardwareCounters::getEventName(lEvent),
+				                 (double)lCounters->getTotal(lPhase, lEvent));
+			}
+		}
+		lCounters->reset();
+	}
+
 	Beagle_StackTraceEndM("void GP::StatsCalcFitnessMCCOp::calculateStatsDeme(Beagle::Stats& outStats, Beagle::Deme& ioDeme, Beagle::Context& ioContext) const");
 }
-
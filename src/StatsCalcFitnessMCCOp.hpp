@@ -11,6 +11,7 @@
 #include "beagle/Container.hpp"
 #include "beagle/ContainerT.hpp"
 #include "beagle/WrapperT.hpp"
+#include "beagle/Int.hpp"
 #include "beagle/Operator.hpp"
 #include "beagle/Stats.hpp"
 #include "beagle/Vivarium.hpp"
@@ -28,6 +29,10 @@ namespace GP
  *     "beagle/GP/StatsCalcFitnessMCCOp.hpp"
  *  \brief Calculate MCC statistics of a GP deme, for a generation, operator class.
  *  \ingroup GPF
+ *
+ *  The deme is reduced in chunks of a fixed number of individuals, spread over
+ *  icu.stats.threads threads; the chunks are merged in order, so that the statistics
+ *  do not depend on the number of threads.
  */
 class StatsCalcFitnessMCCOp : public StatsCalculateOp
 {
@@ -48,10 +53,17 @@ public:
 	virtual ~StatsCalcFitnessMCCOp()
 	{ }
 
+	virtual void registerParams(Beagle::System& ioSystem);
 	virtual void calculateStatsDeme(Beagle::Stats& outStats,
 	                                Beagle::Deme& ioDeme,
 	                                Beagle::Context& ioContext) const;
 
+protected:
+
+	unsigned int getNrThreads() const;
+
+	Int::Handle mNrThreads;   //!< Threads reducing a deme (icu.stats.threads), 0 for one per CPU.
+
 };
 
 }
@@ -0,0 +1,304 @@
+#include "ThresholdBitmapIndex.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+/*!
+ * Construct an empty index.
+ */
+ThresholdBitmapIndex::ThresholdBitmapIndex() :
+    mDataSet(NULL)
+{
+}
+
+/*!
+ * Index rows inRows of ioDataSet; columns are sorted lazily, see sortColumn.
+ */
+void ThresholdBitmapIndex::build(Beagle::DataSetBinaryClassification::Handle ioDataSet, const std::vector<unsigned int>& inRows, unsigned int inNrColumns)
+{
+    mDataSet= ioDataSet;
+    mRows= inRows;
+    mValues.assign(inNrColumns, std::vector<double>());
+    mOrder.assign(inNrColumns, std::vector<unsigned int>());
+    mSorted.assign(inNrColumns, false);
+    mSparse.assign(inNrColumns, false);
+    mZeroValues.assign(inNrColumns, 0.0);
+    mCache.clear();
+
+    // Sparse columns are walked by data set row; map those to training set rows.
+    mPositions.clear();
+    for(unsigned int j=0; j<inNrColumns; ++j)
+    {
+        if (!mDataSet->isSparse(j)) continue;
+        mPositions.assign(mDataSet->size(), ~0U);
+        for(unsigned int i=0; i<mRows.size(); ++i)
+        {
+            mPositions[mRows[i]]= i;
+        }
+        break;
+    }
+}
+
+/*!
+ * Sort the rows of the training set by their values in column inColumn.
+ */
+void ThresholdBitmapIndex::sortColumn(unsigned int inColumn)
+{
+    mSorted[inColumn]= true;
+    if (mDataSet->isSparse(inColumn))
+    {
+        sortSparseColumn(inColumn);
+        return;
+    }
+    std::vector< std::pair<double, unsigned int> > lPairs(mRows.size());
+    bool lQuantized= mDataSet->isQuantized();
+    for(unsigned int i=0; i<mRows.size(); ++i)
+    {
+        double lValue= lQuantized ?
+            mDataSet->getLevels(inColumn)[mDataSet->getCode(mRows[i], inColumn)] :
+            (float)(*mDataSet)[mRows[i]].second[inColumn];
+        lPairs[i]= std::make_pair(lValue, i);
+    }
+    std::sort(lPairs.begin(), lPairs.end());
+    mValues[inColumn].resize(lPairs.size());
+    mOrder[inColumn].resize(lPairs.size());
+    for(unsigned int i=0; i<lPairs.size(); ++i)
+    {
+        mValues[inColumn][i]= lPairs[i].first;
+        mOrder[inColumn][i]= lPairs[i].second;
+    }
+}
+
+/*!
+ * Sort the rows of the training set holding a nonzero value in sparse column inColumn by that value.
+ */
+void ThresholdBitmapIndex::sortSparseColumn(unsigned int inColumn)
+{
+    mSparse[inColumn]= true;
+    bool lQuantized= mDataSet->isQuantized();
+    const std::vector<unsigned int>& lRows= mDataSet->getNonZeroRows(inColumn);
+    const std::vector<float>& lValues= mDataSet->getNonZeroValues(inColumn);
+    std::vector< std::pair<double, unsigned int> > lPairs;
+    for(unsigned int k=0; k<lRows.size(); ++k)
+    {
+        unsigned int lRow= mPositions[lRows[k]];
+        if (lRow == ~0U) continue;
+        double lValue= lQuantized ?
+            mDataSet->getLevels(inColumn)[mDataSet->getCode(lRows[k], inColumn)] :
+            lValues[k];
+        lPairs.push_back(std::make_pair(lValue, lRow));
+    }
+    std::sort(lPairs.begin(), lPairs.end());
+    mValues[inColumn].resize(lPairs.size());
+    mOrder[inColumn].resize(lPairs.size());
+    for(unsigned int i=0; i<lPairs.size(); ++i)
+    {
+        mValues[inColumn][i]= lPairs[i].first;
+        mOrder[inColumn][i]= lPairs[i].second;
+    }
+
+    // Zero is indexed as the lower bound of its level, as any other value.
+    mZeroValues[inColumn]= 0.0;
+    if (lQuantized)
+    {
+        unsigned int lLevel= mDataSet->countLevelsNotAbove(inColumn, 0.0);
+        mZeroValues[inColumn]= mDataSet->getLevels(inColumn)[(lLevel > 0) ? lLevel- 1 : 0];
+    }
+}
+
+/*!
+ * Return the bitmap of the rows satisfying "INc < k", "k < INc", or "INc == k",
+ * computing and caching it if necessary.
+ */
+const ThresholdBitmapIndex::Bitmap& ThresholdBitmapIndex::getBitmap(unsigned int inColumn, Comparison inComparison, double inConstant)
+{
+    std::pair< std::pair<unsigned int, int>, double > lKey(std::make_pair(inColumn, (int)inComparison), inConstant);
+    std::map< std::pair< std::pair<unsigned int, int>, double >, Bitmap >::iterator lCached= mCache.find(lKey);
+    if (lCached != mCache.end())
+    {
+        return lCached->second;
+    }
+
+    if (!mSorted[inColumn])
+    {
+        sortColumn(inColumn);
+    }
+    const std::vector<double>& lValues= mValues[inColumn];
+    std::vector<double>::const_iterator lBegin= lValues.begin();
+    std::vector<double>::const_iterator lEnd= lValues.end();
+    if (inComparison == eLess)
+    {
+        lEnd= std::lower_bound(lValues.begin(), lValues.end(), inConstant);
+    }
+    else if (inComparison == eGreater)
+    {
+        lBegin= std::upper_bound(lValues.begin(), lValues.end(), inConstant);
+    }
+    else
+    {
+        lBegin= std::lower_bound(lValues.begin(), lValues.end(), inConstant);
+        lEnd= std::upper_bound(lBegin, lValues.end(), inConstant);
+    }
+
+    Bitmap& lBitmap= mCache[lKey];
+    const std::vector<unsigned int>& lOrder= mOrder[inColumn];
+    unsigned int lFirst= lBegin- lValues.begin();
+    unsigned int lLast= lEnd- lValues.begin();
+    if (mSparse[inColumn])
+    {
+        double lZero= mZeroValues[inColumn];
+        bool lZeroHolds= (inComparison == eLess) ? (lZero < inConstant) :
+                         (inComparison == eGreater) ? (inConstant < lZero) : (lZero == inConstant);
+        if (lZeroHolds)
+        {
+            // Set all rows, then clear the nonzero rows outside [lFirst, lLast).
+            lBitmap.assign((mRows.size()+ 63)/ 64, ~0UL);
+            for(unsigned int i=0; i<lFirst; ++i)
+            {
+                lBitmap[lOrder[i]/ 64]&= ~(1UL << (lOrder[i]% 64));
+            }
+            for(unsigned int i=lLast; i<lOrder.size(); ++i)
+            {
+                lBitmap[lOrder[i]/ 64]&= ~(1UL << (lOrder[i]% 64));
+            }
+            return lBitmap;
+        }
+    }
+    lBitmap.assign((mRows.size()+ 63)/ 64, 0);
+    for(unsigned int i=lFirst; i<lLast; ++i)
+    {
+        lBitmap[lOrder[i]/ 64]|= 1UL << (lOrder[i]% 64);
+    }
+    return lBitmap;
+}
+
+/*!
+ * Return the column of node inNode, if it is a column token INc, -1 otherwise.
+ */
+int ThresholdBitmapIndex::getColumn(Beagle::GP::Tree& ioTree, unsigned int inNode)
+{
+    const std::string& lName= ioTree[inNode].mPrimitive->getName();
+    if (lName.size() > 2 && lName.compare(0, 2, "IN") == 0 && ioTree[inNode].mPrimitive->getNumberArguments() == 0)
+    {
+        return atoi(lName.c_str()+ 2);
+    }
+    return -1;
+}
+
+/*!
+ * Get the value of node inNode, if it is an EPR constant.
+ *
+ * The value is read back from the deparsed node, so that it equals
+ * the constant in the code compiled by SharedLibCompiler.
+ */
+bool ThresholdBitmapIndex::getConstant(Beagle::GP::Tree& ioTree, unsigned int inNode, double& outConstant)
+{
+    if (ioTree[inNode].mPrimitive->getName() != "EPR") return false;
+    std::vector<std::string> lArguments;
+    std::string lValue= ioTree[inNode].mPrimitive->deparse(lArguments);
+    outConstant= strtod(lValue.c_str()+ lValue.find('(')+ 1, NULL);
+    return true;
+}
+
+/*!
+ * Evaluate the subtree rooted at inNode into outBitmap, false if not possible.
+ */
+bool ThresholdBitmapIndex::evaluateNode(Beagle::GP::Tree& ioTree, unsigned int inNode, Bitmap& outBitmap)
+{
+    const std::string& lName= ioTree[inNode].mPrimitive->getName();
+    unsigned int lFirst= inNode+ 1;
+    unsigned int lSecond= lFirst+ ((lFirst < ioTree.size()) ? ioTree[lFirst].mSubTreeSize : 0);
+
+    if (lName == "TRUE" || lName == "FALSE")
+    {
+        outBitmap.assign((mRows.size()+ 63)/ 64, (lName == "TRUE") ? ~0UL : 0UL);
+        return true;
+    }
+    if (lName == "NOT")
+    {
+        if (!evaluateNode(ioTree, lFirst, outBitmap)) return false;
+        for(unsigned int i=0; i<outBitmap.size(); ++i) outBitmap[i]= ~outBitmap[i];
+        return true;
+    }
+    if (lName == "LT" || lName == "EQ")
+    {
+        double lConstant;
+        int lColumn= getColumn(ioTree, lFirst);
+        if (lColumn >= 0 && getConstant(ioTree, lSecond, lConstant))
+        {
+            outBitmap= getBitmap(lColumn, (lName == "LT") ? eLess : eEqual, lConstant);
+            return true;
+        }
+        lColumn= getColumn(ioTree, lSecond);
+        if (lColumn >= 0 && getConstant(ioTree, lFirst, lConstant))
+        {
+            outBitmap= getBitmap(lColumn, (lName == "LT") ? eGreater : eEqual, lConstant);
+            return true;
+        }
+        return false;
+    }
+    if (lName == "AND" || lName == "OR" || lName == "XOR" || lName == "NAND" || lName == "NOR")
+    {
+        Bitmap lRight;
+        if (!evaluateNode(ioTree, lFirst, outBitmap) || !evaluateNode(ioTree, lSecond, lRight)) return false;
+        for(unsigned int i=0; i<outBitmap.size(); ++i)
+        {
+            if (lName == "AND")       outBitmap[i]&= lRight[i];
+            else if (lName == "OR")   outBitmap[i]|= lRight[i];
+            else if (lName == "XOR")  outBitmap[i]^= lRight[i];
+            else if (lName == "NAND") outBitmap[i]= ~(outBitmap[i] & lRight[i]);
+            else                      outBitmap[i]= ~(outBitmap[i] | lRight[i]);
+        }
+        return true;
+    }
+    return false;
+}
+
+/*!
+ * Evaluate ioTree on all rows of the training set into outBitmap.
+ * Bits beyond the last row are undefined.
+ */
+bool ThresholdBitmapIndex::evaluate(Beagle::GP::Tree& ioTree, Bitmap& outBitmap)
+{
+    if (ioTree.size() == 0 || mRows.empty()) return false;
+    return evaluateNode(ioTree, 0, outBitmap);
+}
+
+/*!
+ * Count the bits set in inBitmap in rows [inBegin, inEnd).
+ */
+unsigned int ThresholdBitmapIndex::count(const Bitmap& inBitmap, unsigned int inBegin, unsigned int inEnd)
+{
+    unsigned int lCount= 0;
+    while (inBegin < inEnd && inBegin% 64 != 0)
+    {
+        lCount+= (inBitmap[inBegin/ 64] >> (inBegin% 64)) & 1UL;
+        ++inBegin;
+    }
+    for(; inBegin+ 64 <= inEnd; inBegin+= 64)
+    {
+        lCount+= __builtin_popcountl(inBitmap[inBegin/ 64]);
+    }
+    if (inBegin < inEnd)
+    {
+        lCount+= __builtin_popcountl(inBitmap[inBegin/ 64] & ((1UL << (inEnd- inBegin))- 1));
+    }
+    return lCount;
+}
+
+/*!
+ * Sum inWeights of the rows set in inBitmap in rows [inBegin, inEnd).
+ */
+unsigned int ThresholdBitmapIndex::count(const Bitmap& inBitmap, unsigned int inBegin, unsigned int inEnd, const std::vector<unsigned int>& inWeights)
+{
+    unsigned int lCount= 0;
+    for(unsigned int lWord=inBegin/ 64; lWord*64<inEnd; ++lWord)
+    {
+        for(unsigned long lBits=inBitmap[lWord]; lBits!=0; lBits&= lBits- 1)
+        {
+            unsigned int lRow= lWord* 64+ __builtin_ctzl(lBits);
+            if (lRow >= inBegin && lRow < inEnd) lCount+= inWeights[lRow];
+        }
+    }
+    return lCount;
+}
@@ -0,0 +1,108 @@
+#ifndef ThresholdBitmapIndex_hpp
+#define ThresholdBitmapIndex_hpp
+
+#include "beagle/GP.hpp"
+#include "DataSetBinaryClassification.hpp"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+/*!
+ *  \class ThresholdBitmapIndex ThresholdBitmapIndex.hpp "ThresholdBitmapIndex.hpp"
+ *  \brief Sorted per-column index over the training set, answering column-vs-constant comparisons as row bitmaps.
+ *
+ *  For each column, the rows of the training set are sorted by value once, when the column
+ *  is first compared; the rows for which "INc < k" holds are then a prefix of that order,
+ *  found by binary search. Bitmaps are cached per (column, comparison, constant), and shared
+ *  by all individuals evaluated on the same training set.
+ *
+ *  Trees whose boolean skeleton (AND, OR, NOT, NAND, NOR, XOR, TRUE, FALSE) only has
+ *  LT or EQ of a column and an EPR constant as leaves are evaluated on bitmaps entirely,
+ *  without calling the compiled individual; bit i of a bitmap stands for row i of the training set.
+ *
+ *  Columns the data set stores sparsely (see DataSetBinaryClassification::sparsify) are indexed
+ *  by their nonzero rows only: a comparison holds or fails for all zero rows alike,
+ *  so a bitmap is filled for those at once, and only the nonzero rows are visited.
+ */
+class ThresholdBitmapIndex
+{
+
+public:
+
+    typedef std::vector<unsigned long> Bitmap;
+
+    ThresholdBitmapIndex();
+
+    /*!
+     * Index rows inRows of ioDataSet, drop all cached bitmaps.
+     *
+     * If ioDataSet is quantized, rows are indexed by the lower bound of
+     * their levels, matching the code SharedLibCompiler generates for level codes.
+     *
+     * ioDataSet    The data set.
+     * inRows       The data set row of each row of the training set.
+     * inNrColumns  The number of columns of each row.
+     */
+    void build(Beagle::DataSetBinaryClassification::Handle ioDataSet, const std::vector<unsigned int>& inRows, unsigned int inNrColumns);
+
+    /*!
+     * Evaluate ioTree on all rows of the training set into outBitmap.
+     *
+     * Returns false, leaving outBitmap undefined, if ioTree contains nodes
+     * that cannot be evaluated on bitmaps.
+     */
+    bool evaluate(Beagle::GP::Tree& ioTree, Bitmap& outBitmap);
+
+    //! Return the number of rows indexed.
+    unsigned int getNrRows() const
+    {
+        return mRows.size();
+    }
+
+    //! Return the number of bitmaps cached.
+    unsigned int getNrBitmaps() const
+    {
+        return mCache.size();
+    }
+
+    //! Count the bits set in inBitmap in rows [inBegin, inEnd).
+    static unsigned int count(const Bitmap& inBitmap, unsigned int inBegin, unsigned int inEnd);
+
+    //! Sum inWeights of the rows set in inBitmap in rows [inBegin, inEnd).
+    static unsigned int count(const Bitmap& inBitmap, unsigned int inBegin, unsigned int inEnd, const std::vector<unsigned int>& inWeights);
+
+protected:
+
+    enum Comparison { eLess, eGreater, eEqual };
+
+    bool evaluateNode(Beagle::GP::Tree& ioTree, unsigned int inNode, Bitmap& outBitmap);
+    const Bitmap& getBitmap(unsigned int inColumn, Comparison inComparison, double inConstant);
+    void sortColumn(unsigned int inColumn);
+    void sortSparseColumn(unsigned int inColumn);
+    static int getColumn(Beagle::GP::Tree& ioTree, unsigned int inNode);
+    static bool getConstant(Beagle::GP::Tree& ioTree, unsigned int inNode, double& outConstant);
+
+    Beagle::DataSetBinaryClassification::Handle mDataSet;
+    std::vector<unsigned int> mRows;
+
+    //! Per column, the indexed values in ascending order and the training set row of each;
+    //! only the rows holding a nonzero value, if the column is sparse.
+    std::vector< std::vector<double> > mValues;
+    std::vector< std::vector<unsigned int> > mOrder;
+
+    //! Per column, whether it has been sorted, and whether it is sparse.
+    std::vector<bool> mSorted;
+    std::vector<bool> mSparse;
+
+    //! Per sparse column, the value indexed for rows holding zero.
+    std::vector<double> mZeroValues;
+
+    //! The training set row of each data set row, ~0 for rows not in the training set;
+    //! empty, unless the data set has sparse columns.
+    std::vector<unsigned int> mPositions;
+
+    std::map< std::pair< std::pair<unsigned int, int>, double >, Bitmap > mCache;
+};
+
+#endif // ThresholdBitmapIndex_hpp
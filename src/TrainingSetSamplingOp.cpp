@@ -2,6 +2,9 @@
 #include "TrainingSetSamplingOp.hpp"
 #include "DataSetBinaryClassification.hpp"
 
+#include <cmath>
+#include <algorithm>
+
 using namespace Beagle;
 using namespace GP;
 
@@ -14,16 +17,28 @@ using namespace GP;
  *
  * inMaxRatioDatasetName (icu.trainigset.max-ratio-dataset)
  *
+ * inModeName (icu.trainingset.mode)
+ *
+ * inDifficultyExponentName (icu.trainingset.dss-difficulty-exp)
+ *
+ * inAgeExponentName (icu.trainingset.dss-age-exp)
+ *
  */
 TrainingSetSamplingOp::TrainingSetSamplingOp(
 	std::string inTrainingsetSizeName, 
 	std::string inMinRatioName, 
-	std::string inMaxRatioName) 
+	std::string inMaxRatioName,
+	std::string inModeName,
+	std::string inDifficultyExponentName,
+	std::string inAgeExponentName) 
 	:
 	Operator("TrainingSetSamplingOp"),
 	mTrainingSetSizeName(inTrainingsetSizeName),
 	mMinRatioName(inMinRatioName),
-	mMaxRatioName(inMaxRatioName)
+	mMaxRatioName(inMaxRatioName),
+	mModeName(inModeName),
+	mDifficultyExponentName(inDifficultyExponentName),
+	mAgeExponentName(inAgeExponentName)
 {
 }
 
@@ -74,6 +89,40 @@ void TrainingSetSamplingOp::registerParams(Beagle::System& ioSystem)
 		mMaxRatio= castHandleT<Float>(
 			ioSystem.getRegister().insertEntry(mMaxRatioName, new Float(0.10), lDescription));
 	}
+
+	{
+		Register::Description lDescription(
+		    "Training set sampling mode",
+		    "String",
+		    "stratified",
+		    "Either 'stratified', evaluators draw a random stratified training set, or 'dynamic', "
+		    "rows are selected by dynamic subset selection, weighted by their difficulty and age."
+		);
+		mMode= castHandleT<String>(
+			ioSystem.getRegister().insertEntry(mModeName, new String("stratified"), lDescription));
+	}
+
+	{
+		Register::Description lDescription(
+		    "Difficulty exponent of dynamic subset selection",
+		    "Float",
+		    "1.0",
+		    "The exponent applied to the misclassification frequency of a row when weighting rows."
+		);
+		mDifficultyExponent= castHandleT<Float>(
+			ioSystem.getRegister().insertEntry(mDifficultyExponentName, new Float(1.0), lDescription));
+	}
+
+	{
+		Register::Description lDescription(
+		    "Age exponent of dynamic subset selection",
+		    "Float",
+		    "0.5",
+		    "The exponent applied to the number of generations since a row has last been selected when weighting rows."
+		);
+		mAgeExponent= castHandleT<Float>(
+			ioSystem.getRegister().insertEntry(mAgeExponentName, new Float(0.5), lDescription));
+	}
 	
 	Beagle_StackTraceEndM("void TrainingSetSamplingOp::registerParams(Beagle::Systeme& ioSystem)");
 }
@@ -99,15 +148,17 @@ void TrainingSetSamplingOp::operate(Beagle::Deme& ioDeme, Beagle::Context& ioCon
     DataSetBinaryClassification::Handle lD= castHandleT<DataSetBinaryClassification>(ioContext.getSystem().getComponent("DataSet"));
     std::vector<unsigned int>* lIndexesPos= lD->getIndexesPositives();
     std::vector<unsigned int>* lIndexesNeg= lD->getIndexesNegatives();
+    // Count rows as read; identical rows are held once in D, but indexed as often as read.
+    unsigned int lSizeD= lIndexesPos->size()+ lIndexesNeg->size();
     Beagle_LogInfoM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::TrainingSetSamplingOp", 
-        "Data set: "+ int2str(lD->size())+ " rows, training set: "+ int2str(lSizeT)+ " rows.");
+        "Data set: "+ int2str(lSizeD)+ " rows, training set: "+ int2str(lSizeT)+ " rows.");
 
     // Abort, if |D| < |T|.
-    if (lD->size() < lSizeT)
+    if (lSizeD < lSizeT)
     {
         throw Beagle_RunTimeExceptionM("The size of the training set is set to "+ 
             int2str(lSizeT)+ ", but the data set contains only "+ 
-            int2str(lD->size())+ " samples.");
+            int2str(lSizeD)+ " samples.");
     }
     
     // Stratified sampling.
@@ -119,10 +170,10 @@ void TrainingSetSamplingOp::operate(Beagle::Deme& ioDeme, Beagle::Context& ioCon
     // Building T will fail, if S is too small compared to L, or mMinRatio is too high, or mMaxRatioDataset is too low.
     
     // Determine the ratio of positives/negatives in D.
-    float lRatioPosD= (float)lIndexesPos->size()/ lD->size();
-    float lRatioNegD= (float)lIndexesNeg->size()/ lD->size();
-    int lSizePosD= round(lD->size()* lRatioPosD);
-    int lSizeNegD= round(lD->size()* lRatioNegD);
+    float lRatioPosD= (float)lIndexesPos->size()/ lSizeD;
+    float lRatioNegD= (float)lIndexesNeg->size()/ lSizeD;
+    int lSizePosD= round(lSizeD* lRatioPosD);
+    int lSizeNegD= round(lSizeD* lRatioNegD);
     Beagle_LogInfoM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::TrainingSetSamplingOp", 
         "Data set: "+ int2str(lSizePosD)+ "("+ dbl2str(lRatioPosD*100, 2)+ " %) positive, "+ 
         int2str(lSizeNegD)+ "("+ dbl2str(lRatioNegD*100, 2)+ " %) negative.");
@@ -219,7 +270,10 @@ void TrainingSetSamplingOp::operate(Beagle::Deme& ioDeme, Beagle::Context& ioCon
 		    "0",
 		    "The number of positive smaples from the data set to go into the training set."
 		);
-		ioContext.getSystem().getRegister().insertEntry("icu.trainingset.size-pos", new Int(lSizePosT), lDescription);
+		if (ioContext.getSystem().getRegister().isRegistered("icu.trainingset.size-pos"))
+			ioContext.getSystem().getRegister().modifyEntry("icu.trainingset.size-pos", new Int(lSizePosT));
+		else
+			ioContext.getSystem().getRegister().insertEntry("icu.trainingset.size-pos", new Int(lSizePosT), lDescription);
 	}
 
 	{
@@ -230,11 +284,77 @@ void TrainingSetSamplingOp::operate(Beagle::Deme& ioDeme, Beagle::Context& ioCon
 		    "0",
 		    "The number of negative smaples from the data set to go into the training set."
 		);
-		ioContext.getSystem().getRegister().insertEntry("icu.trainingset.size-neg", new Int(lSizeNegT), lDescription);
+		if (ioContext.getSystem().getRegister().isRegistered("icu.trainingset.size-neg"))
+			ioContext.getSystem().getRegister().modifyEntry("icu.trainingset.size-neg", new Int(lSizeNegT));
+		else
+			ioContext.getSystem().getRegister().insertEntry("icu.trainingset.size-neg", new Int(lSizeNegT), lDescription);
 	}
 
     Beagle_LogInfoM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::TrainingSetSamplingOp", 
         "Training set: "+ int2str(lSizePosT)+ " positive, "+ int2str(lSizeNegT)+ " negative.");
 
+    // Dynamic subset selection: select the rows of the training set.
+    Beagle_ValidateParameterM(mMode->getWrappedValue() == "stratified" || mMode->getWrappedValue() == "dynamic",
+        mModeName, "either 'stratified' or 'dynamic'");
+    if (mMode->getWrappedValue() == "dynamic")
+    {
+        selectRows(*lIndexesPos, std::min<unsigned int>(lSizePosT, lIndexesPos->size()), ioContext);
+        selectRows(*lIndexesNeg, std::min<unsigned int>(lSizeNegT, lIndexesNeg->size()), ioContext);
+        lD->setPresampled(true);
+        Beagle_LogDetailedM(ioContext.getSystem().getLogger(), "operate", "Beagle::GP::TrainingSetSamplingOp", 
+            "Training set selected by dynamic subset selection.");
+    }
+    else
+    {
+        lD->setPresampled(false);
+    }
+}
+
+/*!
+ * Move inSize rows to the front of ioIndexes, drawn without replacement
+ * in proportion to their weights D(r)^d + A(r)^a (Efraimidis & Spirakis).
+ * Ages of the rows selected are reset, all other rows age by one generation.
+ * A row ages at most once per generation, however often it is read and
+ * however many demes are sampled; being selected by any deme resets it.
+ */
+void TrainingSetSamplingOp::selectRows(std::vector<unsigned int>& ioIndexes, unsigned int inSize, Beagle::Context& ioContext)
+{
+	Beagle_StackTraceBeginM();
+
+    DataSetBinaryClassification::Handle lD= castHandleT<DataSetBinaryClassification>(ioContext.getSystem().getComponent("DataSet"));
+    float lDifficultyExponent= mDifficultyExponent->getWrappedValue();
+    float lAgeExponent= mAgeExponent->getWrappedValue();
+    unsigned int lStamp= ioContext.getGeneration()+ 1;
+    if (mAgedGenerations.size() != lD->size()) mAgedGenerations.assign(lD->size(), 0);
+
+    // Key each row by -log(u)/ w, u uniform in (0,1); the rows with the smallest keys form the sample.
+    std::vector< std::pair<double,unsigned int> > lKeys(ioIndexes.size());
+    for(unsigned int i=0; i<ioIndexes.size(); ++i)
+    {
+        unsigned int lRow= ioIndexes[i];
+        double lWeight= pow(lD->getDifficulty(lRow), lDifficultyExponent)+ pow((double)lD->getAge(lRow), lAgeExponent);
+        double lUniform= ioContext.getSystem().getRandomizer().rollUniform(1e-12, 1.);
+        lKeys[i].first= (lWeight > 0.0) ? -log(lUniform)/ lWeight : HUGE_VAL;
+        lKeys[i].second= lRow;
+    }
+    std::nth_element(lKeys.begin(), lKeys.begin()+ inSize, lKeys.end());
+    // Reset the rows selected first: rows read several times may have been selected and passed over; selection wins.
+    for(unsigned int i=0; i<inSize; ++i)
+    {
+        lD->setAge(lKeys[i].second, 0);
+        mAgedGenerations[lKeys[i].second]= lStamp;
+    }
+    for(unsigned int i=0; i<ioIndexes.size(); ++i)
+    {
+        unsigned int lRow= lKeys[i].second;
+        ioIndexes[i]= lRow;
+        if (mAgedGenerations[lRow] == lStamp) continue;
+        lD->setAge(lRow, lD->getAge(lRow)+ 1);
+        mAgedGenerations[lRow]= lStamp;
+    }
+    // Keep the training set in random order, so that prefixes remain unbiased samples.
+    std::random_shuffle(ioIndexes.begin(), ioIndexes.begin()+ inSize, ioContext.getSystem().getRandomizer());
+
+	Beagle_StackTraceEndM("void TrainingSetSamplingOp::selectRows(std::vector<unsigned int>&, unsigned int, Beagle::Context&)");
 }
 
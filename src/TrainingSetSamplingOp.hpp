@@ -21,6 +21,12 @@ namespace GP
  * The ratio of samples to include from the smaller subset can be controlled (upper/lower bound), 
  * while asserting that no more than a maximum percentage of this sample is included into the training set.
  *
+ * In dynamic mode, the operator selects the rows of the training set as well, and should be
+ * applied once per generation. Following dynamic subset selection (Gathercole & Ross), each row r
+ * is weighted by D(r)^d + A(r)^a, where D(r) is the fraction of individuals misclassifying r,
+ * as counted by SharedLibEvalOp, and A(r) the number of generations since r has last been selected.
+ * Rows are drawn without replacement in proportion to their weights, separately for both classes.
+ *
  */
 class TrainingSetSamplingOp : public Beagle::Operator
 {
@@ -48,11 +54,24 @@ public:
 	 *   The maximum ratio of samples from the smaller subset to include in 
 	 *   the training set. Lies in (0,1), defaults to 0.10 (10 %).
 	 *
+	 * inModeName (icu.trainingset.mode)
+	 *   Either "stratified", evaluators draw a random training set, 
+	 *   or "dynamic", rows are selected by dynamic subset selection. Defaults to "stratified".
+	 *
+	 * inDifficultyExponentName (icu.trainingset.dss-difficulty-exp)
+	 *   The exponent d applied to the difficulty of a row. Defaults to 1.0.
+	 *
+	 * inAgeExponentName (icu.trainingset.dss-age-exp)
+	 *   The exponent a applied to the age of a row. Defaults to 0.5.
+	 *
 	 */
 	explicit TrainingSetSamplingOp(
 		std::string inTrainingsetSizeName="icu.trainingset.size",	
 		std::string inMinRatioName="icu.trainingset.min-ratio",
-		std::string inMaxRatioName="icu.trainingset.max-ratio"
+		std::string inMaxRatioName="icu.trainingset.max-ratio",
+		std::string inModeName="icu.trainingset.mode",
+		std::string inDifficultyExponentName="icu.trainingset.dss-difficulty-exp",
+		std::string inAgeExponentName="icu.trainingset.dss-age-exp"
 	);
 	virtual ~TrainingSetSamplingOp()
 	{
@@ -69,13 +88,27 @@ public:
 
 protected:
 
+	/*!
+	 * Move inSize rows, drawn in proportion to their DSS weights, to the front of ioIndexes.
+	 */
+	void selectRows(std::vector<unsigned int>& ioIndexes, unsigned int inSize, Beagle::Context& ioContext);
+
 	std::string mTrainingSetSizeName;
 	std::string mMinRatioName;
 	std::string mMaxRatioName;
+	std::string mModeName;
+	std::string mDifficultyExponentName;
+	std::string mAgeExponentName;
 
 	Int::Handle mTrainingSetSize;
 	Float::Handle mMinRatio;
 	Float::Handle mMaxRatio;
+	String::Handle mMode;
+	Float::Handle mDifficultyExponent;
+	Float::Handle mAgeExponent;
+
+	//! Generation, plus one, in which each row of the data set has last been aged or selected; 0 for never.
+	std::vector<unsigned int> mAgedGenerations;
 	
 };
 
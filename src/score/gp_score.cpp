@@ -0,0 +1,435 @@
+/*
+ * gp_score: score records with the individuals of a shared library
+ * compiled by SharedLibCompiler, e.g. libhof_g<gen>_d<deme>.so.
+ *
+ * gp_score does not depend on Open BEAGLE; it only needs the table of
+ * individuals exported by each library (fgp_nr_columns, fgp_nr_individuals,
+ * fgp_individuals, fgp_individual_names).
+ *
+ * Libraries compiled for pruned columns read rows holding only the columns
+ * they reference (fgp_nr_packed, fgp_columns); gp_score gathers these
+ * columns from each record. Libraries compiled for level codes of a
+ * quantized data set (fgp_code_bytes not 0) cannot score raw records and
+ * are rejected.
+ *
+ * Usage:
+ *
+ *   gp_score -l LIB -i INPUT [-o OUTPUT] [-f csv|bin] [-c COLUMNS]
+ *            [-n INDEX | -a | -e majority|weighted] [-t THREADS] [-b BATCH]
+ *
+ *   -l LIB      Shared library to load.
+ *   -i INPUT    Input file, mapped into memory (required).
+ *   -o OUTPUT   Output file, defaults to STDOUT.
+ *   -f FORMAT   'csv' (default): comma separated values, one record per line;
+ *               a trailing field beyond COLUMNS (the class) is ignored.
+ *               'bin': COLUMNS native 32 bit floats per record.
+ *   -c COLUMNS  Number of columns per record, defaults to fgp_nr_columns.
+ *   -n INDEX    Score with individual INDEX of the library (default 0).
+ *   -a          Score with all individuals of the library; one prediction per
+ *               individual is written per record, separated by commas.
+ *   -e VOTE     Score with the ensemble kernel of the library (ensemble_predict),
+ *               by 'majority' vote or by votes 'weighted' by each member's MCC.
+ *   -t THREADS  Number of threads, defaults to the number of CPUs online.
+ *   -b BATCH    Number of records scored per batch (default 4096).
+ *
+ * Predictions (0/1) are written one record per line, in input order;
+ * the throughput in records/s is reported on STDERR.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace
+{
+
+typedef int (*ApplyIndividual)(float[]);
+typedef void (*EnsemblePredict)(const float*, int, int, int, int*);
+
+/*!
+ * Everything shared by the scoring threads.
+ */
+struct ScoreJob
+{
+    const char* mData;                      //!< Input, mapped into memory.
+    size_t mSize;                           //!< Size of the input in bytes.
+    bool mBinary;                           //!< Input format.
+    unsigned int mNrColumns;                //!< Columns per record.
+    std::vector<int> mColumns;              //!< Columns gathered into the rows scored, empty for all.
+    std::vector<size_t> mOffsets;           //!< Start of each record (CSV only).
+    size_t mNrRecords;                      //!< Number of records in the input.
+    std::vector<ApplyIndividual> mIndividuals;  //!< Individuals to score with.
+    EnsemblePredict mEnsemble;              //!< Ensemble kernel to score with, instead of mIndividuals.
+    int mWeighted;                          //!< Whether the ensemble votes are weighted.
+    unsigned int mBatchSize;                //!< Records per batch.
+    size_t mNextBatch;                      //!< Next batch to score, shared by all threads.
+    std::vector<char> mPredictions;         //!< mNrRecords x mIndividuals.size() predictions.
+    volatile bool mError;                   //!< Set, if a record could not be parsed.
+    size_t mErrorRecord;                    //!< Record that could not be parsed.
+};
+
+/*!
+ * Return the current time in seconds.
+ */
+double now()
+{
+    struct timeval lTime;
+    gettimeofday(&lTime, NULL);
+    return lTime.tv_sec+ lTime.tv_usec* 1e-6;
+}
+
+/*!
+ * Parse CSV record inRecord into ioValues; return false on malformed records.
+ */
+bool parseRecord(const ScoreJob& inJob, size_t inRecord, float* ioValues)
+{
+    const char* lPos= inJob.mData+ inJob.mOffsets[inRecord];
+    const char* lEnd= inJob.mData+ ((inRecord+ 1 < inJob.mNrRecords) ? inJob.mOffsets[inRecord+ 1] : inJob.mSize);
+    for(unsigned int j=0; j<inJob.mNrColumns; ++j)
+    {
+        // Fields are separated by commas and optional blanks; skip the separator.
+        while (lPos < lEnd && (*lPos == ' ' || *lPos == '\t')) ++lPos;
+        if (lPos >= lEnd) return false;
+        char* lFieldEnd= 0;
+        ioValues[j]= strtof(lPos, &lFieldEnd);
+        if (lFieldEnd == lPos || lFieldEnd > lEnd) return false;
+        lPos= lFieldEnd;
+        while (lPos < lEnd && (*lPos == ' ' || *lPos == '\t')) ++lPos;
+        if (j+ 1 < inJob.mNrColumns)
+        {
+            if (lPos >= lEnd || *lPos != ',') return false;
+            ++lPos;
+        }
+    }
+    return true;
+}
+
+/*!
+ * Scoring thread: score batches until all records have been scored.
+ */
+void* scoreBatches(void* ioJob)
+{
+    ScoreJob& lJob= *static_cast<ScoreJob*>(ioJob);
+    std::vector<float> lValues(lJob.mBatchSize* lJob.mNrColumns);
+    std::vector<float> lPacked(lJob.mBatchSize* lJob.mColumns.size());
+    const unsigned int lStride= lJob.mColumns.empty() ? lJob.mNrColumns : lJob.mColumns.size();
+    std::vector<int> lVotes(lJob.mEnsemble ? lJob.mBatchSize : 0);
+    const size_t lNrIndividuals= lJob.mEnsemble ? 1 : lJob.mIndividuals.size();
+    const size_t lNrBatches= (lJob.mNrRecords+ lJob.mBatchSize- 1)/ lJob.mBatchSize;
+
+    for(;;)
+    {
+        size_t lBatch= __sync_fetch_and_add(&lJob.mNextBatch, 1);
+        if (lBatch >= lNrBatches || lJob.mError) break;
+        size_t lFirst= lBatch* lJob.mBatchSize;
+        size_t lCount= std::min<size_t>(lJob.mBatchSize, lJob.mNrRecords- lFirst);
+
+        // Get the values of all records in the batch.
+        float* lRows;
+        if (lJob.mBinary)
+        {
+            // Binary records are scored in place; individuals do not modify their input.
+            lRows= (float*)(lJob.mData+ lFirst* lJob.mNrColumns* sizeof(float));
+        }
+        else
+        {
+            lRows= &lValues[0];
+            for(size_t i=0; i<lCount; ++i)
+            {
+                if (!parseRecord(lJob, lFirst+ i, lRows+ i* lJob.mNrColumns))
+                {
+                    lJob.mErrorRecord= lFirst+ i;
+                    lJob.mError= true;
+                    return NULL;
+                }
+            }
+        }
+
+        // Gather the columns the individuals read.
+        if (!lJob.mColumns.empty())
+        {
+            for(size_t i=0; i<lCount; ++i)
+            {
+                const float* lRecord= lRows+ i* lJob.mNrColumns;
+                float* lRow= &lPacked[i* lStride];
+                for(unsigned int j=0; j<lStride; ++j)
+                {
+                    lRow[j]= lRecord[lJob.mColumns[j]];
+                }
+            }
+            lRows= &lPacked[0];
+        }
+
+        // Score the batch with one individual at a time, keeping the batch in cache.
+        char* lPredictions= &lJob.mPredictions[lFirst* lNrIndividuals];
+        if (lJob.mEnsemble)
+        {
+            lJob.mEnsemble(lRows, lCount, lStride, lJob.mWeighted, &lVotes[0]);
+            for(size_t i=0; i<lCount; ++i)
+            {
+                lPredictions[i]= lVotes[i] ? '1' : '0';
+            }
+            continue;
+        }
+        for(size_t k=0; k<lNrIndividuals; ++k)
+        {
+            ApplyIndividual lApplyIndividual= lJob.mIndividuals[k];
+            float* lRow= lRows;
+            for(size_t i=0; i<lCount; ++i, lRow+= lStride)
+            {
+                lPredictions[i* lNrIndividuals+ k]= (lApplyIndividual(lRow) != 0) ? '1' : '0';
+            }
+        }
+    }
+    return NULL;
+}
+
+void usage(const char* inProgram)
+{
+    fprintf(stderr,
+        "Usage: %s -l LIB -i INPUT [-o OUTPUT] [-f csv|bin] [-c COLUMNS] [-n INDEX | -a | -e majority|weighted] [-t THREADS] [-b BATCH]\n",
+        inProgram);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    std::string lLibPath, lInputPath, lOutputPath, lFormat("csv"), lVote;
+    int lNrColumns= -1;
+    int lIndex= 0;
+    bool lAll= false;
+    long lNrThreads= sysconf(_SC_NPROCESSORS_ONLN);
+    int lBatchSize= 4096;
+
+    int lOption;
+    while ((lOption= getopt(argc, argv, "l:i:o:f:c:n:ae:t:b:h")) != -1)
+    {
+        switch (lOption)
+        {
+            case 'l': lLibPath= optarg; break;
+            case 'i': lInputPath= optarg; break;
+            case 'o': lOutputPath= optarg; break;
+            case 'f': lFormat= optarg; break;
+            case 'c': lNrColumns= atoi(optarg); break;
+            case 'n': lIndex= atoi(optarg); break;
+            case 'a': lAll= true; break;
+            case 'e': lVote= optarg; break;
+            case 't': lNrThreads= atol(optarg); break;
+            case 'b': lBatchSize= atoi(optarg); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (lLibPath.empty() || lInputPath.empty() || (lFormat != "csv" && lFormat != "bin") ||
+        (!lVote.empty() && lVote != "majority" && lVote != "weighted") ||
+        lNrThreads < 1 || lBatchSize < 1)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Load the library and its table of individuals.
+    // A path without '/' would be looked up in the library search path only.
+    if (lLibPath.find('/') == std::string::npos) lLibPath= "./"+ lLibPath;
+    void* lLib= dlopen(lLibPath.c_str(), RTLD_NOW);
+    if (!lLib)
+    {
+        fprintf(stderr, "Cannot open shared library %s: %s.\n", lLibPath.c_str(), dlerror());
+        return 1;
+    }
+    const int* lLibNrColumns= (const int*)dlsym(lLib, "fgp_nr_columns");
+    const int* lLibNrIndividuals= (const int*)dlsym(lLib, "fgp_nr_individuals");
+    ApplyIndividual* lLibIndividuals= (ApplyIndividual*)dlsym(lLib, "fgp_individuals");
+    const char* const* lLibNames= (const char* const*)dlsym(lLib, "fgp_individual_names");
+    if (!lLibNrColumns || !lLibNrIndividuals || !lLibIndividuals || !lLibNames)
+    {
+        fprintf(stderr, "%s does not export a table of individuals.\n", lLibPath.c_str());
+        return 1;
+    }
+    const int* lLibCodeBytes= (const int*)dlsym(lLib, "fgp_code_bytes");
+    if (lLibCodeBytes && *lLibCodeBytes != 0)
+    {
+        fprintf(stderr, "%s has been compiled for level codes of a quantized data set, not for records of values.\n", lLibPath.c_str());
+        return 1;
+    }
+    if (lNrColumns < 0) lNrColumns= *lLibNrColumns;
+    if (lNrColumns < *lLibNrColumns)
+    {
+        fprintf(stderr, "Individuals expect %d columns, got %d.\n", *lLibNrColumns, lNrColumns);
+        return 1;
+    }
+
+    ScoreJob lJob;
+    lJob.mBinary= (lFormat == "bin");
+    lJob.mNrColumns= lNrColumns;
+
+    // Libraries compiled for pruned columns read only the columns they reference, in fgp_columns order.
+    const int* lLibNrPacked= (const int*)dlsym(lLib, "fgp_nr_packed");
+    const int* lLibColumns= (const int*)dlsym(lLib, "fgp_columns");
+    if (lLibNrPacked && lLibColumns)
+    {
+        bool lIdentity= true;
+        for(int j=0; j<*lLibNrPacked; ++j)
+        {
+            if (lLibColumns[j] < 0 || lLibColumns[j] >= lNrColumns)
+            {
+                fprintf(stderr, "Individuals read column %d, records hold %d columns.\n", lLibColumns[j], lNrColumns);
+                return 1;
+            }
+            lIdentity= lIdentity && (lLibColumns[j] == j);
+        }
+        if (!lIdentity) lJob.mColumns.assign(lLibColumns, lLibColumns+ *lLibNrPacked);
+    }
+    lJob.mBatchSize= lBatchSize;
+    lJob.mNextBatch= 0;
+    lJob.mError= false;
+    lJob.mErrorRecord= 0;
+    lJob.mEnsemble= NULL;
+    lJob.mWeighted= (lVote == "weighted");
+    if (!lVote.empty())
+    {
+        lJob.mEnsemble= (EnsemblePredict)dlsym(lLib, "ensemble_predict");
+        if (!lJob.mEnsemble)
+        {
+            fprintf(stderr, "%s does not contain an ensemble kernel.\n", lLibPath.c_str());
+            return 1;
+        }
+    }
+    else if (lAll)
+    {
+        lJob.mIndividuals.assign(lLibIndividuals, lLibIndividuals+ *lLibNrIndividuals);
+    }
+    else
+    {
+        if (lIndex < 0 || lIndex >= *lLibNrIndividuals)
+        {
+            fprintf(stderr, "Individual %d requested, %s contains %d.\n", lIndex, lLibPath.c_str(), *lLibNrIndividuals);
+            return 1;
+        }
+        lJob.mIndividuals.push_back(lLibIndividuals[lIndex]);
+    }
+    if (lJob.mIndividuals.empty() && !lJob.mEnsemble)
+    {
+        fprintf(stderr, "%s does not contain any individuals.\n", lLibPath.c_str());
+        return 1;
+    }
+
+    // Map the input into memory.
+    int lFD= open(lInputPath.c_str(), O_RDONLY);
+    struct stat lStat;
+    if (lFD < 0 || fstat(lFD, &lStat) != 0)
+    {
+        fprintf(stderr, "Cannot open %s: %s.\n", lInputPath.c_str(), strerror(errno));
+        return 1;
+    }
+    lJob.mSize= lStat.st_size;
+    lJob.mData= NULL;
+    if (lJob.mSize > 0)
+    {
+        void* lMap= mmap(NULL, lJob.mSize, PROT_READ, MAP_PRIVATE, lFD, 0);
+        if (lMap == MAP_FAILED)
+        {
+            fprintf(stderr, "Cannot map %s: %s.\n", lInputPath.c_str(), strerror(errno));
+            return 1;
+        }
+        madvise(lMap, lJob.mSize, MADV_SEQUENTIAL);
+        lJob.mData= (const char*)lMap;
+    }
+    close(lFD);
+
+    double lStart= now();
+
+    // Find the records in the input.
+    if (lJob.mBinary)
+    {
+        if (lJob.mSize% (lNrColumns* sizeof(float)) != 0)
+        {
+            fprintf(stderr, "Size of %s is not a multiple of %d floats.\n", lInputPath.c_str(), lNrColumns);
+            return 1;
+        }
+        lJob.mNrRecords= lJob.mSize/ (lNrColumns* sizeof(float));
+    }
+    else
+    {
+        const char* lPos= lJob.mData;
+        const char* lEnd= lJob.mData+ lJob.mSize;
+        while (lPos < lEnd)
+        {
+            const char* lNewline= (const char*)memchr(lPos, '\n', lEnd- lPos);
+            if (!lNewline) lNewline= lEnd;
+            // Skip empty lines.
+            if (lNewline > lPos && !(lNewline- lPos == 1 && *lPos == '\r'))
+            {
+                lJob.mOffsets.push_back(lPos- lJob.mData);
+            }
+            lPos= lNewline+ 1;
+        }
+        lJob.mNrRecords= lJob.mOffsets.size();
+    }
+    const size_t lNrIndividuals= lJob.mEnsemble ? 1 : lJob.mIndividuals.size();
+    lJob.mPredictions.resize(lJob.mNrRecords* lNrIndividuals);
+
+    // Score.
+    std::vector<pthread_t> lThreads(lNrThreads);
+    for(long i=0; i<lNrThreads; ++i)
+    {
+        if (pthread_create(&lThreads[i], NULL, scoreBatches, &lJob) != 0)
+        {
+            fprintf(stderr, "Cannot create thread: %s.\n", strerror(errno));
+            return 1;
+        }
+    }
+    for(long i=0; i<lNrThreads; ++i)
+    {
+        pthread_join(lThreads[i], NULL);
+    }
+    if (lJob.mError)
+    {
+        fprintf(stderr, "Record %lu: expected %d comma separated values.\n",
+            (unsigned long)lJob.mErrorRecord+ 1, lNrColumns);
+        return 1;
+    }
+    double lScored= now();
+
+    // Write predictions.
+    FILE* lOut= lOutputPath.empty() ? stdout : fopen(lOutputPath.c_str(), "w");
+    if (!lOut)
+    {
+        fprintf(stderr, "Cannot open %s: %s.\n", lOutputPath.c_str(), strerror(errno));
+        return 1;
+    }
+    std::vector<char> lLine(2* lNrIndividuals);
+    for(size_t i=0; i<lJob.mNrRecords; ++i)
+    {
+        for(size_t k=0; k<lNrIndividuals; ++k)
+        {
+            lLine[2* k]= lJob.mPredictions[i* lNrIndividuals+ k];
+            lLine[2* k+ 1]= (k+ 1 < lNrIndividuals) ? ',' : '\n';
+        }
+        fwrite(&lLine[0], 1, lLine.size(), lOut);
+    }
+    if (lOut != stdout) fclose(lOut);
+    else fflush(stdout);
+    double lWritten= now();
+
+    fprintf(stderr, "%lu records, %lu predictions per record, %ld threads: scored in %.3f s (%.0f records/s), written in %.3f s.\n",
+        (unsigned long)lJob.mNrRecords, (unsigned long)lNrIndividuals, lNrThreads,
+        lScored- lStart, (lScored > lStart) ? lJob.mNrRecords/ (lScored- lStart) : 0.0,
+        lWritten- lScored);
+
+    if (lJob.mData) munmap((void*)lJob.mData, lJob.mSize);
+    dlclose(lLib);
+    return 0;
+}